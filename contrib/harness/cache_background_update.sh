@@ -0,0 +1,90 @@
+#!/bin/sh
+
+# Copyright (C) agent
+
+
+# a stale cached response is served while a background subrequest
+# refreshes it, and the refreshed response comes with "X-Accel-Buffering: no";
+# the client connection must stay usable for the next keepalive request
+#
+#     sh contrib/harness/cache_background_update.sh [objs/nginx [port]]
+
+NGINX=${1:-objs/nginx}
+PORT=${2:-18300}
+BACKEND=`expr $PORT + 1`
+
+case $NGINX in
+    /*) ;;
+    *) NGINX=`pwd`/$NGINX ;;
+esac
+
+PREFIX=`mktemp -d /tmp/nginx-harness.XXXXXX`
+mkdir $PREFIX/logs $PREFIX/conf $PREFIX/html $PREFIX/cache
+chmod -R 777 $PREFIX
+
+cat > $PREFIX/conf/nginx.conf << END
+daemon on;
+error_log logs/error.log info;
+pid logs/nginx.pid;
+events { worker_connections 64; }
+http {
+    access_log off;
+    proxy_cache_path $PREFIX/cache levels=1 keys_zone=harness:1m;
+
+    server {
+        listen 127.0.0.1:$PORT;
+        location / {
+            proxy_cache harness;
+            proxy_cache_use_stale updating;
+            proxy_cache_background_update on;
+            proxy_pass http://127.0.0.1:$BACKEND;
+        }
+    }
+
+    server {
+        listen 127.0.0.1:$BACKEND;
+        root $PREFIX/html;
+        expires 1s;
+        location / {
+            if (-f $PREFIX/html/unbuffered) {
+                add_header X-Accel-Buffering no;
+            }
+        }
+    }
+}
+END
+
+echo v1 > $PREFIX/html/t
+
+if ! $NGINX -p $PREFIX/ -c conf/nginx.conf; then
+    echo "FAIL: nginx did not start"
+    exit 1
+fi
+
+sleep 1
+
+URL=http://127.0.0.1:$PORT/t
+
+curl -s -o /dev/null $URL
+
+echo v2 > $PREFIX/html/t
+touch $PREFIX/html/unbuffered
+sleep 2
+
+# the first request triggers the background update, the second one
+# must reuse the connection
+
+CONNECTS=`curl -s -w '%{num_connects} ' -o /dev/null $URL -o /dev/null $URL`
+
+sleep 1
+
+kill `cat $PREFIX/logs/nginx.pid`
+
+if [ "$CONNECTS" = "1 0 " ]; then
+    echo "ok: the client connection was reused"
+    rm -rf $PREFIX
+    exit 0
+fi
+
+echo "FAIL: connects per request: $CONNECTS, see $PREFIX/logs/error.log"
+exit 1
@@ -0,0 +1,136 @@
+#!/bin/sh
+
+# Copyright (C) agent
+
+
+# a 10m file is cached in 1m slices: a cold range request must fetch
+# only the slice it falls into, full and ranged bodies must be byte-exact,
+# and once all slices are cached the ranges must be served without the
+# backend; needs --with-http_slice_module
+#
+#     sh contrib/harness/cache_slice.sh [objs/nginx [port]]
+
+NGINX=${1:-objs/nginx}
+PORT=${2:-18320}
+BACKEND=`expr $PORT + 1`
+
+case $NGINX in
+    /*) ;;
+    *) NGINX=`pwd`/$NGINX ;;
+esac
+
+PREFIX=`mktemp -d /tmp/nginx-harness.XXXXXX`
+mkdir $PREFIX/logs $PREFIX/conf $PREFIX/html $PREFIX/cache
+chmod -R 777 $PREFIX
+
+cat > $PREFIX/conf/nginx.conf << END
+daemon on;
+error_log logs/error.log info;
+pid logs/nginx.pid;
+events { worker_connections 64; }
+http {
+    access_log off;
+    proxy_cache_path $PREFIX/cache levels=1 keys_zone=harness:1m;
+
+    server {
+        listen 127.0.0.1:$PORT;
+        location / {
+            slice 1m;
+            proxy_cache harness;
+            proxy_cache_key \$uri\$is_args\$args\$slice_range;
+            proxy_set_header Range \$slice_range;
+            proxy_cache_valid 200 206 1h;
+            proxy_pass http://127.0.0.1:$BACKEND;
+        }
+    }
+
+    server {
+        listen 127.0.0.1:$BACKEND;
+        root $PREFIX/html;
+    }
+}
+END
+
+dd if=/dev/urandom of=$PREFIX/big bs=1k count=10240 2> /dev/null
+cp $PREFIX/big $PREFIX/html/big
+
+if ! $NGINX -p $PREFIX/ -c conf/nginx.conf; then
+    echo "FAIL: nginx did not start"
+    exit 1
+fi
+
+sleep 1
+
+URL=http://127.0.0.1:$PORT/big
+FAIL=
+
+fail() {
+    echo "FAIL: $*"
+    FAIL=1
+}
+
+# the bytes from $1 to $2 of the file, inclusive
+
+expect() {
+    tail -c +`expr $1 + 1` $PREFIX/big | head -c `expr $2 - $1 + 1` \
+        > $PREFIX/expect
+}
+
+# a cold seek into the middle of the 6th slice
+
+STATUS=`curl -s -w '%{http_code}' -o $PREFIX/body -r 5300000-5300099 $URL`
+expect 5300000 5300099
+
+[ "$STATUS" = 206 ] || fail "cold range: status $STATUS"
+cmp -s $PREFIX/body $PREFIX/expect || fail "cold range: body differs"
+
+FILES=`find $PREFIX/cache -type f | wc -l`
+[ $FILES -eq 1 ] || fail "cold range: $FILES slices cached instead of 1"
+
+# a range across the slice boundary fetches the 7th slice too
+
+STATUS=`curl -s -w '%{http_code}' -o $PREFIX/body -r 6291000-6292000 $URL`
+expect 6291000 6292000
+
+[ "$STATUS" = 206 ] || fail "boundary range: status $STATUS"
+cmp -s $PREFIX/body $PREFIX/expect || fail "boundary range: body differs"
+
+FILES=`find $PREFIX/cache -type f | wc -l`
+[ $FILES -eq 2 ] || fail "boundary range: $FILES slices cached instead of 2"
+
+# the whole file
+
+STATUS=`curl -s -w '%{http_code}' -o $PREFIX/body $URL`
+
+[ "$STATUS" = 200 ] || fail "full: status $STATUS"
+cmp -s $PREFIX/body $PREFIX/big || fail "full: body differs"
+
+FILES=`find $PREFIX/cache -type f | wc -l`
+[ $FILES -eq 10 ] || fail "full: $FILES slices cached instead of 10"
+
+# without the backend file everything comes from the cached slices
+
+rm $PREFIX/html/big
+
+STATUS=`curl -s -w '%{http_code}' -o $PREFIX/body -r 1048000-9437000 $URL`
+expect 1048000 9437000
+
+[ "$STATUS" = 206 ] || fail "cached range: status $STATUS"
+cmp -s $PREFIX/body $PREFIX/expect || fail "cached range: body differs"
+
+STATUS=`curl -s -w '%{http_code}' -o $PREFIX/body -r -100 $URL`
+expect 10485660 10485759
+
+[ "$STATUS" = 206 ] || fail "cached suffix: status $STATUS"
+cmp -s $PREFIX/body $PREFIX/expect || fail "cached suffix: body differs"
+
+kill `cat $PREFIX/logs/nginx.pid`
+
+if [ -z "$FAIL" ]; then
+    echo "ok: the slices were fetched on demand and assembled exactly"
+    rm -rf $PREFIX
+    exit 0
+fi
+
+echo "see $PREFIX/logs/error.log"
+exit 1
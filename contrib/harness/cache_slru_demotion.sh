@@ -0,0 +1,96 @@
+#!/bin/sh
+
+# Copyright (C) agent
+
+
+# with "policy=slru", a node demoted from the protected segment must
+# still expire after "inactive" even if the probation segment has a
+# newer node at its tail; takes about 15 seconds
+#
+#     sh contrib/harness/cache_slru_demotion.sh [objs/nginx [port]]
+
+NGINX=${1:-objs/nginx}
+PORT=${2:-18310}
+BACKEND=`expr $PORT + 1`
+
+case $NGINX in
+    /*) ;;
+    *) NGINX=`pwd`/$NGINX ;;
+esac
+
+PREFIX=`mktemp -d /tmp/nginx-harness.XXXXXX`
+mkdir $PREFIX/logs $PREFIX/conf $PREFIX/html $PREFIX/cache
+chmod -R 777 $PREFIX
+
+cat > $PREFIX/conf/nginx.conf << END
+daemon on;
+error_log logs/error.log info;
+pid logs/nginx.pid;
+events { worker_connections 64; }
+http {
+    access_log off;
+    proxy_cache_path $PREFIX/cache keys_zone=harness:1m max_size=200k
+                     inactive=10s policy=slru;
+
+    server {
+        listen 127.0.0.1:$PORT;
+        location / {
+            proxy_cache harness;
+            proxy_cache_valid 200 1h;
+            proxy_pass http://127.0.0.1:$BACKEND;
+        }
+    }
+
+    server {
+        listen 127.0.0.1:$BACKEND;
+        root $PREFIX/html;
+    }
+}
+END
+
+for f in a b c; do
+    dd if=/dev/zero of=$PREFIX/html/$f bs=1k count=60 2> /dev/null
+done
+
+echo d > $PREFIX/html/d
+
+if ! $NGINX -p $PREFIX/ -c conf/nginx.conf; then
+    echo "FAIL: nginx did not start"
+    exit 1
+fi
+
+sleep 1
+
+get() {
+    for f; do
+        curl -s -o /dev/null http://127.0.0.1:$PORT/$f
+    done
+}
+
+# "a" becomes hot, expires in 10 seconds
+
+get a a
+sleep 8
+
+# "d" goes to the probation tail with a later expire time, then "b" and
+# "c" become hot and the protected segment exceeds 4/5 of max_size,
+# so "a" is demoted
+
+get d
+sleep 0.5
+get b b c c
+
+sleep 4
+
+FILES=`find $PREFIX/cache -type f | wc -l`
+
+kill `cat $PREFIX/logs/nginx.pid`
+
+if [ $FILES -eq 3 ]; then
+    echo "ok: the demoted node expired"
+    rm -rf $PREFIX
+    exit 0
+fi
+
+echo "FAIL: $FILES cached files instead of 3, see $PREFIX/logs/error.log"
+exit 1
@@ -0,0 +1,530 @@
+
+/*
+ * Copyright (C) agent
+ */
+
+
+/*
+ * ngx_http_parse_request_line() and ngx_http_parse_header_line() are
+ * compared with their copies built without the SSE2 code: random and
+ * mutated requests are fed to both versions in the same random pieces,
+ * and every return code, position and request field set by the parsers
+ * must be the same; the requests end right before an inaccessible page,
+ * so a read beyond the end of the buffer crashes the harness
+ *
+ * then both versions parse a typical request with 3K of headers
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+#include "ngx_harness.h"
+
+
+#define NGX_HTTP_PARSE_DIFF_MAX  8192
+
+
+typedef ngx_int_t (*ngx_http_parse_diff_line_pt)(ngx_http_request_t *r,
+    ngx_buf_t *b);
+typedef ngx_int_t (*ngx_http_parse_diff_header_pt)(ngx_http_request_t *r,
+    ngx_buf_t *b, ngx_uint_t allow_underscores);
+
+
+ngx_int_t ngx_http_parse_request_line_scalar(ngx_http_request_t *r,
+    ngx_buf_t *b);
+ngx_int_t ngx_http_parse_header_line_scalar(ngx_http_request_t *r,
+    ngx_buf_t *b, ngx_uint_t allow_underscores);
+
+static size_t ngx_http_parse_diff_generate(u_char *buf, uint32_t *state);
+static ngx_int_t ngx_http_parse_diff_run(u_char *start, u_char *end,
+    uint32_t *state);
+static char *ngx_http_parse_diff_compare(ngx_http_request_t *r,
+    ngx_buf_t *b, ngx_int_t *rc);
+static void ngx_http_parse_diff_dump(u_char *start, u_char *end);
+static double ngx_http_parse_diff_bench(u_char *start, u_char *end,
+    ngx_uint_t n, ngx_http_parse_diff_line_pt parse_request_line,
+    ngx_http_parse_diff_header_pt parse_header_line);
+
+
+static char  *ngx_http_parse_diff_methods[] = {
+    "GET", "GET", "GET", "POST", "HEAD", "PUT", "DELETE", "MKCOL", "COPY",
+    "MOVE", "OPTIONS", "PROPFIND", "PROPPATCH", "LOCK", "UNLOCK", "PATCH",
+    "TRACE", "get", "G", "GETS"
+};
+
+static char  *ngx_http_parse_diff_versions[] = {
+    " HTTP/1.1", " HTTP/1.1", " HTTP/1.0", " HTTP/1.10", " HTTP/2.0",
+    " http/1.1", " HTTP/1.", " HTTP/1.1 ", "  HTTP/1.1", ""
+};
+
+static char  *ngx_http_parse_diff_names[] = {
+    "Host", "User-Agent", "Accept", "Accept-Encoding", "Accept-Language",
+    "Cookie", "Connection", "Referer", "X-Forwarded-For", "Content-Length",
+    "X_Request_Id", "x-a", "Sec-Fetch-Mode", "If-Modified-Since",
+    "X-Very-Long-Header-Name-Beyond-The-Lowcase-Buffer-Length", "Bad@Name",
+    "Bad Name", ""
+};
+
+/* the bytes that change the states of the parsers */
+
+static u_char  ngx_http_parse_diff_special[] = {
+    ' ', ' ', CR, LF, '\0', ':', '?', '#', '%', '/', '.', '+', '_', '-',
+    '\t', '@', 0x80, 0xff
+};
+
+static u_char  ngx_http_parse_diff_request[] =
+    "GET /api/v1/search?q=nginx+http+parser&page=2&per_page=50"
+    "&sort=relevance&lang=en HTTP/1.1" CRLF
+    "Host: api.example.com" CRLF
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36" CRLF
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+    "image/avif,image/webp,*/*;q=0.8" CRLF
+    "Accept-Language: en-US,en;q=0.9,de;q=0.8" CRLF
+    "Accept-Encoding: gzip, deflate, br" CRLF
+    "Referer: https://www.example.com/search?q=nginx" CRLF
+    "X-Forwarded-For: 192.0.2.10, 198.51.100.7" CRLF;
+
+static u_char  ngx_http_parse_diff_usual[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+    "=&;,-_~!$'()*";
+
+
+int
+main(int argc, char *const *argv)
+{
+    int          ch;
+    size_t       len;
+    double       simd, scalar;
+    u_char      *buf, *guard;
+    uint32_t     state;
+    ngx_uint_t   i, n, b;
+
+    n = 1000000;
+    b = 1000000;
+    state = 2463534242u;
+
+    while ((ch = getopt(argc, argv, "n:b:s:")) != -1) {
+        switch (ch) {
+
+        case 'n':
+            n = atoi(optarg);
+            break;
+
+        case 'b':
+            b = atoi(optarg);
+            break;
+
+        case 's':
+            state = atoi(optarg);
+            break;
+
+        default:
+            fprintf(stderr, "usage: http_parse_diff [-n requests] "
+                            "[-b iterations] [-s seed]\n");
+            return 2;
+        }
+    }
+
+    ngx_harness_init();
+
+    if (state == 0) {
+        state = 1;
+    }
+
+    buf = mmap(NULL, NGX_HTTP_PARSE_DIFF_MAX + ngx_pagesize,
+               PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE, -1, 0);
+    if (buf == MAP_FAILED) {
+        perror("mmap");
+        return 2;
+    }
+
+    guard = buf + NGX_HTTP_PARSE_DIFF_MAX;
+
+    if (mprotect(guard, ngx_pagesize, PROT_NONE) == -1) {
+        perror("mprotect");
+        return 2;
+    }
+
+    for (i = 0; i < n; i++) {
+        len = ngx_http_parse_diff_generate(buf, &state);
+
+        ngx_memmove(guard - len, buf, len);
+
+        if (ngx_http_parse_diff_run(guard - len, guard, &state) != NGX_OK) {
+            printf("FAIL: request %lu\n", (unsigned long) i);
+            return 1;
+        }
+    }
+
+    printf("%lu requests parsed identically\n", (unsigned long) n);
+
+    if (b == 0) {
+        return 0;
+    }
+
+    len = ngx_cpymem(buf, ngx_http_parse_diff_request,
+                     sizeof(ngx_http_parse_diff_request) - 1)
+          - buf;
+
+    /* session cookies of 2.5K */
+
+    len += ngx_sprintf(buf + len, "Cookie: ") - (buf + len);
+
+    for (i = 0; i < 20; i++) {
+        len += ngx_sprintf(buf + len, "%ssession_%02ui=", i ? "; " : "",
+                           i) - (buf + len);
+
+        while (len % 128 < 120) {
+            buf[len] = ngx_http_parse_diff_usual[
+                           ngx_harness_random(&state) % 62];
+            len++;
+        }
+    }
+
+    len += ngx_sprintf(buf + len, CRLF CRLF) - (buf + len);
+
+    simd = ngx_http_parse_diff_bench(buf, buf + len, b,
+                                     ngx_http_parse_request_line,
+                                     ngx_http_parse_header_line);
+
+    scalar = ngx_http_parse_diff_bench(buf, buf + len, b,
+                                       ngx_http_parse_request_line_scalar,
+                                       ngx_http_parse_header_line_scalar);
+
+    printf("%lu bytes request: %.1f ns, %.0f MB/s; "
+           "without SSE2: %.1f ns, %.0f MB/s\n",
+           (unsigned long) len, simd * 1e9, len / simd / 1e6,
+           scalar * 1e9, len / scalar / 1e6);
+
+    return 0;
+}
+
+
+static size_t
+ngx_http_parse_diff_generate(u_char *buf, uint32_t *state)
+{
+    u_char      *p, *last;
+    char        *s;
+    size_t       len;
+    ngx_uint_t   i, n, k;
+
+    p = buf;
+    last = buf + NGX_HTTP_PARSE_DIFF_MAX;
+
+    s = ngx_http_parse_diff_methods[ngx_harness_random(state)
+                                    % (sizeof(ngx_http_parse_diff_methods)
+                                       / sizeof(char *))];
+    p = ngx_cpymem(p, s, ngx_strlen(s));
+    *p++ = ' ';
+
+    if (ngx_harness_random(state) % 8 == 0) {
+        p = ngx_cpymem(p, "http://Example.com:8080", 23);
+    }
+
+    /* the path and the arguments, long enough for the 16 bytes scans */
+
+    n = ngx_harness_random(state) % 400;
+
+    for (i = 0; i < n; i++) {
+        k = ngx_harness_random(state) % 32;
+
+        if (i == 0 || k == 0) {
+            *p++ = '/';
+
+        } else if (k == 1) {
+            *p++ = ngx_http_parse_diff_special[ngx_harness_random(state)
+                                   % sizeof(ngx_http_parse_diff_special)];
+
+        } else if (k == 2 && i > n / 2) {
+            *p++ = '?';
+
+        } else {
+            *p++ = ngx_http_parse_diff_usual[ngx_harness_random(state)
+                                   % (sizeof(ngx_http_parse_diff_usual) - 1)];
+        }
+    }
+
+    s = ngx_http_parse_diff_versions[ngx_harness_random(state)
+                                     % (sizeof(ngx_http_parse_diff_versions)
+                                        / sizeof(char *))];
+    p = ngx_cpymem(p, s, ngx_strlen(s));
+    p = ngx_cpymem(p, CRLF, (ngx_harness_random(state) % 8) ? 2 : 1);
+
+    /* the headers, some of them with long values as cookies */
+
+    n = ngx_harness_random(state) % 12;
+
+    for (i = 0; i < n; i++) {
+        s = ngx_http_parse_diff_names[ngx_harness_random(state)
+                                      % (sizeof(ngx_http_parse_diff_names)
+                                         / sizeof(char *))];
+        p = ngx_cpymem(p, s, ngx_strlen(s));
+        p = ngx_cpymem(p, ":  ", ngx_harness_random(state) % 4);
+
+        len = ngx_harness_random(state) % 4 ? ngx_harness_random(state) % 60
+                                            : ngx_harness_random(state) % 600;
+
+        if (len > (size_t) (last - p) - 64) {
+            break;
+        }
+
+        while (len--) {
+            k = ngx_harness_random(state);
+
+            *p++ = (k % 64 == 0) ? ' '
+                                 : ngx_http_parse_diff_usual[(k >> 8)
+                                   % (sizeof(ngx_http_parse_diff_usual) - 1)];
+        }
+
+        p = ngx_cpymem(p, "  ", ngx_harness_random(state) % 3);
+        p = ngx_cpymem(p, CRLF, (ngx_harness_random(state) % 8) ? 2 : 1);
+    }
+
+    p = ngx_cpymem(p, CRLF, 2);
+
+    len = p - buf;
+
+    /* the mutations */
+
+    n = ngx_harness_random(state) % 4;
+
+    for (i = 0; i < n; i++) {
+        k = ngx_harness_random(state) % len;
+
+        switch (ngx_harness_random(state) % 3) {
+
+        case 0:
+            buf[k] = ngx_http_parse_diff_special[ngx_harness_random(state)
+                                   % sizeof(ngx_http_parse_diff_special)];
+            break;
+
+        case 1:
+            buf[k] = (u_char) ngx_harness_random(state);
+            break;
+
+        default:
+            len = k + 1;
+            break;
+        }
+    }
+
+    return len;
+}
+
+
+static ngx_int_t
+ngx_http_parse_diff_run(u_char *start, u_char *end, uint32_t *state)
+{
+    char                *field;
+    size_t               piece;
+    ngx_int_t            rc[2];
+    ngx_uint_t           i, headers, allow_underscores;
+    ngx_buf_t            b[2];
+    ngx_connection_t     c;
+    ngx_http_request_t   r[2];
+
+    ngx_memzero(&c, sizeof(ngx_connection_t));
+    c.log = ngx_cycle->log;
+
+    ngx_memzero(r, sizeof(r));
+    ngx_memzero(b, sizeof(b));
+
+    switch (ngx_harness_random(state) % 3) {
+
+    case 0:
+        piece = end - start;
+        break;
+
+    case 1:
+        piece = 1 + ngx_harness_random(state) % 32;
+        break;
+
+    default:
+        piece = 1 + ngx_harness_random(state) % 1024;
+        break;
+    }
+
+    for (i = 0; i < 2; i++) {
+        r[i].connection = &c;
+        b[i].pos = start;
+        b[i].last = ngx_min(start + piece, end);
+    }
+
+    headers = 0;
+    allow_underscores = ngx_harness_random(state) & 1;
+
+    for ( ;; ) {
+
+        if (headers) {
+            rc[0] = ngx_http_parse_header_line(&r[0], &b[0],
+                                               allow_underscores);
+            rc[1] = ngx_http_parse_header_line_scalar(&r[1], &b[1],
+                                                      allow_underscores);
+
+        } else {
+            rc[0] = ngx_http_parse_request_line(&r[0], &b[0]);
+            rc[1] = ngx_http_parse_request_line_scalar(&r[1], &b[1]);
+        }
+
+        field = ngx_http_parse_diff_compare(r, b, rc);
+
+        if (field) {
+            printf("%s %s differs: ", headers ? "header line" : "request line",
+                   field);
+            ngx_http_parse_diff_dump(start, end);
+            return NGX_ERROR;
+        }
+
+        if (rc[0] == NGX_AGAIN) {
+
+            if (b[0].last == end) {
+                return NGX_OK;
+            }
+
+            for (i = 0; i < 2; i++) {
+                b[i].last = ngx_min(b[i].last + piece, end);
+            }
+
+            continue;
+        }
+
+        if (rc[0] == NGX_OK) {
+            headers = 1;
+            continue;
+        }
+
+        /* NGX_HTTP_PARSE_HEADER_DONE or an error */
+
+        return NGX_OK;
+    }
+}
+
+
+#define ngx_http_parse_diff_field(f)                                          \
+    if (r[0].f != r[1].f) {                                                   \
+        return #f;                                                            \
+    }
+
+static char *
+ngx_http_parse_diff_compare(ngx_http_request_t *r, ngx_buf_t *b,
+    ngx_int_t *rc)
+{
+    if (rc[0] != rc[1]) {
+        return "return code";
+    }
+
+    if (b[0].pos != b[1].pos) {
+        return "buffer position";
+    }
+
+    ngx_http_parse_diff_field(state);
+    ngx_http_parse_diff_field(request_start);
+    ngx_http_parse_diff_field(method_end);
+    ngx_http_parse_diff_field(method);
+    ngx_http_parse_diff_field(schema_start);
+    ngx_http_parse_diff_field(schema_end);
+    ngx_http_parse_diff_field(host_start);
+    ngx_http_parse_diff_field(host_end);
+    ngx_http_parse_diff_field(port_end);
+    ngx_http_parse_diff_field(uri_start);
+    ngx_http_parse_diff_field(uri_end);
+    ngx_http_parse_diff_field(uri_ext);
+    ngx_http_parse_diff_field(args_start);
+    ngx_http_parse_diff_field(http_protocol.data);
+    ngx_http_parse_diff_field(request_end);
+    ngx_http_parse_diff_field(http_major);
+    ngx_http_parse_diff_field(http_minor);
+    ngx_http_parse_diff_field(http_version);
+    ngx_http_parse_diff_field(complex_uri);
+    ngx_http_parse_diff_field(quoted_uri);
+    ngx_http_parse_diff_field(plus_in_uri);
+    ngx_http_parse_diff_field(space_in_uri);
+
+    ngx_http_parse_diff_field(header_name_start);
+    ngx_http_parse_diff_field(header_name_end);
+    ngx_http_parse_diff_field(header_start);
+    ngx_http_parse_diff_field(header_end);
+    ngx_http_parse_diff_field(header_hash);
+    ngx_http_parse_diff_field(lowcase_index);
+    ngx_http_parse_diff_field(invalid_header);
+
+    if (ngx_memcmp(r[0].lowcase_header, r[1].lowcase_header,
+                   ngx_min(r[0].lowcase_index, NGX_HTTP_LC_HEADER_LEN))
+        != 0)
+    {
+        return "lowcase_header";
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_parse_diff_dump(u_char *start, u_char *end)
+{
+    u_char  *p;
+
+    for (p = start; p < end; p++) {
+        if (*p >= 0x20 && *p < 0x7f && *p != '\\') {
+            putchar(*p);
+
+        } else {
+            printf("\\x%02x", *p);
+        }
+    }
+
+    putchar('\n');
+}
+
+
+static double
+ngx_http_parse_diff_bench(u_char *start, u_char *end, ngx_uint_t n,
+    ngx_http_parse_diff_line_pt parse_request_line,
+    ngx_http_parse_diff_header_pt parse_header_line)
+{
+    double               elapsed;
+    ngx_int_t            rc;
+    ngx_uint_t           i;
+    ngx_buf_t            b;
+    ngx_connection_t     c;
+    ngx_http_request_t   r;
+
+    ngx_memzero(&c, sizeof(ngx_connection_t));
+    c.log = ngx_cycle->log;
+
+    ngx_memzero(&r, sizeof(ngx_http_request_t));
+    r.connection = &c;
+
+    ngx_memzero(&b, sizeof(ngx_buf_t));
+    b.last = end;
+
+    elapsed = ngx_harness_time();
+
+    for (i = 0; i < n; i++) {
+        r.state = 0;
+        b.pos = start;
+
+        if (parse_request_line(&r, &b) != NGX_OK) {
+            fprintf(stderr, "the benchmark request is invalid\n");
+            exit(2);
+        }
+
+        r.state = 0;
+
+        do {
+            rc = parse_header_line(&r, &b, 0);
+        } while (rc == NGX_OK);
+
+        if (rc != NGX_HTTP_PARSE_HEADER_DONE) {
+            fprintf(stderr, "the benchmark headers are invalid\n");
+            exit(2);
+        }
+    }
+
+    elapsed = ngx_harness_time() - elapsed;
+
+    return elapsed / n;
+}
@@ -0,0 +1,80 @@
+
+/*
+ * Copyright (C) agent
+ */
+
+
+/*
+ * the harnesses link with all objects of the built tree except nginx.o,
+ * its globals are taken from here together with nginx.c without main()
+ */
+
+#define main  ngx_harness_nginx_main
+#include "../../src/core/nginx.c"
+#undef main
+
+#include "ngx_harness.h"
+
+
+static ngx_open_file_t  ngx_harness_log_file;
+static ngx_log_t        ngx_harness_log;
+static ngx_cycle_t      ngx_harness_cycle;
+
+
+void
+ngx_harness_init(void)
+{
+    ngx_uint_t  n;
+
+    ngx_pid = ngx_getpid();
+
+    ngx_pagesize = getpagesize();
+    ngx_cacheline_size = NGX_CPU_CACHE_LINE;
+
+    for (n = ngx_pagesize; n >>= 1; ngx_pagesize_shift++) { /* void */ }
+
+    ngx_ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (ngx_ncpu < 1) {
+        ngx_ncpu = 1;
+    }
+
+    ngx_time_init();
+
+    ngx_harness_log_file.fd = ngx_stderr;
+    ngx_harness_log.file = &ngx_harness_log_file;
+    ngx_harness_log.log_level = NGX_LOG_NOTICE;
+
+    ngx_harness_cycle.log = &ngx_harness_log;
+    ngx_cycle = &ngx_harness_cycle;
+}
+
+
+double
+ngx_harness_time(void)
+{
+    struct timespec  ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* xorshift32, the harnesses must be reproducible for a given seed */
+
+uint32_t
+ngx_harness_random(uint32_t *state)
+{
+    uint32_t  x;
+
+    x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    *state = x;
+
+    return x;
+}
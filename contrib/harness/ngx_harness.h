@@ -0,0 +1,20 @@
+
+/*
+ * Copyright (C) agent
+ */
+
+
+#ifndef _NGX_HARNESS_H_INCLUDED_
+#define _NGX_HARNESS_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+void ngx_harness_init(void);
+double ngx_harness_time(void);
+uint32_t ngx_harness_random(uint32_t *state);
+
+
+#endif /* _NGX_HARNESS_H_INCLUDED_ */
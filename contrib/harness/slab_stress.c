@@ -0,0 +1,226 @@
+
+/*
+ * Copyright (C) agent
+ */
+
+
+/*
+ * several processes allocate and free chunks of random sizes in one
+ * shared slab pool; with -m every operation is also serialized by the
+ * zone mutex, as before the pool was locked per size class
+ *
+ * every chunk is filled with a per-process pattern that is checked
+ * before the chunk is freed, and at exit all pages must be free again
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <sys/wait.h>
+
+#include "ngx_harness.h"
+
+
+#define NGX_SLAB_STRESS_LIVE  512
+
+
+static size_t  ngx_slab_stress_sizes[] = {
+    8, 24, 40, 64, 64, 64, 100, 128, 200, 300, 700, 1500, 3000, 4096
+};
+
+
+static void ngx_slab_stress_worker(ngx_slab_pool_t *sp, ngx_uint_t n,
+    ngx_uint_t mutex, ngx_uint_t worker);
+
+
+int
+main(int argc, char *const *argv)
+{
+    int               ch, status;
+    double            start, elapsed;
+    size_t            size;
+    ngx_uint_t        i, processes, n, mutex, failed, pages, total;
+    ngx_pid_t         pid;
+    ngx_slab_pool_t  *sp;
+    ngx_slab_page_t  *page;
+
+    processes = 4;
+    n = 1000000;
+    size = 32;
+    mutex = 0;
+
+    while ((ch = getopt(argc, argv, "p:n:s:m")) != -1) {
+        switch (ch) {
+
+        case 'p':
+            processes = atoi(optarg);
+            break;
+
+        case 'n':
+            n = atoi(optarg);
+            break;
+
+        case 's':
+            size = atoi(optarg);
+            break;
+
+        case 'm':
+            mutex = 1;
+            break;
+
+        default:
+            fprintf(stderr, "usage: slab_stress [-p processes] "
+                            "[-n operations] [-s megabytes] [-m]\n");
+            return 2;
+        }
+    }
+
+    ngx_harness_init();
+
+    size *= 1024 * 1024;
+
+    sp = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED, -1, 0);
+    if (sp == MAP_FAILED) {
+        perror("mmap");
+        return 2;
+    }
+
+    sp->end = (u_char *) sp + size;
+    sp->min_shift = 3;
+    sp->addr = sp;
+
+    ngx_slab_init(sp);
+
+    if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+        return 2;
+    }
+
+    start = ngx_harness_time();
+
+    for (i = 0; i < processes; i++) {
+        pid = fork();
+
+        if (pid == -1) {
+            perror("fork");
+            return 2;
+        }
+
+        if (pid == 0) {
+            ngx_pid = ngx_getpid();
+            ngx_slab_stress_worker(sp, n, mutex, i);
+        }
+    }
+
+    failed = 0;
+
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failed++;
+        }
+    }
+
+    elapsed = ngx_harness_time() - start;
+
+    pages = 0;
+
+    for (page = sp->free.next; page != &sp->free; page = page->next) {
+        pages += page->slab;
+    }
+
+    total = (sp->end - sp->start) >> ngx_pagesize_shift;
+
+    printf("%s, %lu processes x %lu operations: %.3f s, %.0f ops/s, "
+           "free pages %lu/%lu, failed processes %lu\n",
+           mutex ? "zone mutex" : "size class locks",
+           (unsigned long) processes, (unsigned long) n, elapsed,
+           processes * n / elapsed, (unsigned long) pages,
+           (unsigned long) total, (unsigned long) failed);
+
+    return (failed || pages != total) ? 1 : 0;
+}
+
+
+static void
+ngx_slab_stress_worker(ngx_slab_pool_t *sp, ngx_uint_t n, ngx_uint_t mutex,
+    ngx_uint_t worker)
+{
+    u_char      *p, pattern;
+    size_t       j;
+    uint32_t     rnd, state;
+    ngx_uint_t   i, k, corrupted, failures;
+    u_char      *live[NGX_SLAB_STRESS_LIVE];
+    size_t       sizes[NGX_SLAB_STRESS_LIVE];
+
+    ngx_memzero(live, sizeof(live));
+
+    state = 2463534242u + worker * 7919;
+    corrupted = 0;
+    failures = 0;
+
+    for (i = 0; i < n; i++) {
+        rnd = ngx_harness_random(&state);
+
+        k = rnd % NGX_SLAB_STRESS_LIVE;
+        pattern = (u_char) (worker * NGX_SLAB_STRESS_LIVE + k);
+
+        p = live[k];
+
+        if (p) {
+            for (j = 0; j < sizes[k]; j++) {
+                if (p[j] != pattern) {
+                    corrupted++;
+                    break;
+                }
+            }
+
+            if (mutex) {
+                ngx_shmtx_lock(&sp->mutex);
+                ngx_slab_free_locked(sp, p);
+                ngx_shmtx_unlock(&sp->mutex);
+
+            } else {
+                ngx_slab_free(sp, p);
+            }
+
+            live[k] = NULL;
+            continue;
+        }
+
+        sizes[k] = ngx_slab_stress_sizes[(rnd >> 16)
+                                         % (sizeof(ngx_slab_stress_sizes)
+                                            / sizeof(size_t))];
+
+        if (mutex) {
+            ngx_shmtx_lock(&sp->mutex);
+            p = ngx_slab_alloc_locked(sp, sizes[k]);
+            ngx_shmtx_unlock(&sp->mutex);
+
+        } else {
+            p = ngx_slab_alloc(sp, sizes[k]);
+        }
+
+        if (p == NULL) {
+            failures++;
+            continue;
+        }
+
+        ngx_memset(p, pattern, sizes[k]);
+
+        live[k] = p;
+    }
+
+    for (k = 0; k < NGX_SLAB_STRESS_LIVE; k++) {
+        if (live[k]) {
+            ngx_slab_free(sp, live[k]);
+        }
+    }
+
+    if (corrupted || failures) {
+        fprintf(stderr, "process %lu: %lu corrupted chunks, "
+                        "%lu failed allocations\n",
+                (unsigned long) worker, (unsigned long) corrupted,
+                (unsigned long) failures);
+    }
+
+    exit(corrupted ? 1 : 0);
+}
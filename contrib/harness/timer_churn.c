@@ -0,0 +1,292 @@
+
+/*
+ * Copyright (C) agent
+ */
+
+
+/*
+ * the same simulated timer workload is run against the rbtree and
+ * the timer wheel: connections re-arm and delete their timers between
+ * the event loop iterations, which wake up every few milliseconds, and
+ * re-arm them again when they expire; the clock is simulated, so both
+ * runs must fire the same timers at the same milliseconds, and a timer
+ * must fire at the first wakeup after its time
+ *
+ * with -i the loop sleeps until the time returned by
+ * ngx_event_find_timer(), this shows the wakeups of an idle worker,
+ * and every timer must fire exactly at its time
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+#include "ngx_harness.h"
+
+
+typedef struct {
+    ngx_uint_t   fired;
+    ngx_uint_t   early;
+    ngx_uint_t   late;
+    ngx_uint_t   wakeups;
+    ngx_uint_t   idle;
+    ngx_uint_t   ops;
+    uint64_t     sum;
+} ngx_timer_churn_stat_t;
+
+
+static void ngx_timer_churn_run(ngx_uint_t wheel, ngx_timer_churn_stat_t *st);
+static void ngx_timer_churn_handler(ngx_event_t *e);
+static ngx_msec_t ngx_timer_churn_timeout(uint32_t *state);
+
+
+static ngx_uint_t               ngx_timer_churn_events = 10000;
+static ngx_uint_t               ngx_timer_churn_ops = 10;
+static ngx_msec_t               ngx_timer_churn_duration = 600000;
+static ngx_uint_t               ngx_timer_churn_idle;
+
+static ngx_event_t             *ngx_timer_churn_ev;
+static ngx_connection_t        *ngx_timer_churn_conn;
+static uint32_t                *ngx_timer_churn_states;
+static ngx_msec_t              *ngx_timer_churn_keys;
+static ngx_msec_t               ngx_timer_churn_last;
+static ngx_timer_churn_stat_t  *ngx_timer_churn_stat;
+
+
+int
+main(int argc, char *const *argv)
+{
+    int                     ch;
+    ngx_uint_t              wheel, rc;
+    ngx_timer_churn_stat_t  st[2];
+
+    while ((ch = getopt(argc, argv, "n:o:t:i")) != -1) {
+        switch (ch) {
+
+        case 'n':
+            ngx_timer_churn_events = atoi(optarg);
+            break;
+
+        case 'o':
+            ngx_timer_churn_ops = atoi(optarg);
+            break;
+
+        case 't':
+            ngx_timer_churn_duration = (ngx_msec_t) atoi(optarg) * 1000;
+            break;
+
+        case 'i':
+            ngx_timer_churn_idle = 1;
+            break;
+
+        default:
+            fprintf(stderr, "usage: timer_churn [-n events] "
+                            "[-o operations per iteration] [-t seconds] "
+                            "[-i]\n");
+            return 2;
+        }
+    }
+
+    ngx_harness_init();
+
+    ngx_timer_churn_ev = calloc(ngx_timer_churn_events, sizeof(ngx_event_t));
+    ngx_timer_churn_conn = calloc(ngx_timer_churn_events,
+                                  sizeof(ngx_connection_t));
+    ngx_timer_churn_states = calloc(ngx_timer_churn_events, sizeof(uint32_t));
+    ngx_timer_churn_keys = calloc(ngx_timer_churn_events, sizeof(ngx_msec_t));
+
+    if (ngx_timer_churn_ev == NULL
+        || ngx_timer_churn_conn == NULL
+        || ngx_timer_churn_states == NULL
+        || ngx_timer_churn_keys == NULL)
+    {
+        return 2;
+    }
+
+    for (wheel = 0; wheel < 2; wheel++) {
+        ngx_timer_churn_run(wheel, &st[wheel]);
+    }
+
+    rc = 0;
+
+    if (st[0].fired != st[1].fired || st[0].sum != st[1].sum) {
+        printf("FAIL: the rbtree and the wheel fired different timers\n");
+        rc = 1;
+    }
+
+    for (wheel = 0; wheel < 2; wheel++) {
+        if (st[wheel].early || st[wheel].late) {
+            printf("FAIL: %s: %lu timers fired early, %lu late\n",
+                   wheel ? "wheel" : "rbtree",
+                   (unsigned long) st[wheel].early,
+                   (unsigned long) st[wheel].late);
+            rc = 1;
+        }
+    }
+
+    return rc;
+}
+
+
+static void
+ngx_timer_churn_run(ngx_uint_t wheel, ngx_timer_churn_stat_t *st)
+{
+    double       start, elapsed;
+    uint32_t     state;
+    ngx_uint_t   i, k, n;
+    ngx_msec_t   timer, step, end;
+
+    ngx_memzero(st, sizeof(ngx_timer_churn_stat_t));
+    ngx_timer_churn_stat = st;
+
+    ngx_current_msec = 1000;
+    end = ngx_current_msec + ngx_timer_churn_duration;
+
+    ngx_event_timer_use_wheel = wheel;
+
+    if (ngx_event_timer_init(ngx_cycle->log) != NGX_OK) {
+        exit(2);
+    }
+
+    state = 2463534242u;
+
+    ngx_memzero(ngx_timer_churn_ev,
+                ngx_timer_churn_events * sizeof(ngx_event_t));
+
+    for (i = 0; i < ngx_timer_churn_events; i++) {
+        ngx_timer_churn_conn[i].fd = (ngx_socket_t) i;
+        ngx_timer_churn_ev[i].data = &ngx_timer_churn_conn[i];
+        ngx_timer_churn_ev[i].log = ngx_cycle->log;
+        ngx_timer_churn_ev[i].handler = ngx_timer_churn_handler;
+
+        ngx_timer_churn_states[i] = 7919 * (i + 1);
+
+        ngx_add_timer(&ngx_timer_churn_ev[i],
+                      ngx_timer_churn_timeout(&ngx_timer_churn_states[i]));
+        ngx_timer_churn_keys[i] = ngx_timer_churn_ev[i].timer.key;
+    }
+
+    start = ngx_harness_time();
+
+    while ((ngx_msec_int_t) (end - ngx_current_msec) > 0) {
+
+        /* the requests handled by the iteration re-arm or delete timers */
+
+        n = ngx_timer_churn_idle ? 0 : ngx_timer_churn_ops;
+
+        for (i = 0; i < n; i++) {
+            k = ngx_harness_random(&state) % ngx_timer_churn_events;
+
+            if (ngx_timer_churn_ev[k].timer_set
+                && (ngx_harness_random(&state) & 7) == 0)
+            {
+                ngx_del_timer(&ngx_timer_churn_ev[k]);
+
+            } else {
+                timer = ngx_timer_churn_timeout(&ngx_timer_churn_states[k]);
+                ngx_add_timer(&ngx_timer_churn_ev[k], timer);
+                ngx_timer_churn_keys[k] = ngx_timer_churn_ev[k].timer.key;
+            }
+
+            st->ops++;
+        }
+
+        timer = ngx_event_find_timer();
+
+        step = ngx_timer_churn_idle ? timer
+                                    : 1 + ngx_harness_random(&state) % 5;
+
+        if (step > end - ngx_current_msec) {
+            step = end - ngx_current_msec;
+        }
+
+        ngx_timer_churn_last = ngx_current_msec;
+        ngx_current_msec += step;
+
+        st->wakeups++;
+
+        k = st->fired;
+
+        ngx_event_expire_timers();
+
+        if (k == st->fired) {
+            st->idle++;
+        }
+    }
+
+    elapsed = ngx_harness_time() - start;
+
+    printf("%s: %lu timer operations, %lu timers fired, %lu wakeups "
+           "(%lu without a timer), %.3f s, %.1f ns per operation\n",
+           wheel ? "wheel" : "rbtree", (unsigned long) st->ops,
+           (unsigned long) st->fired, (unsigned long) st->wakeups,
+           (unsigned long) st->idle, elapsed,
+           elapsed * 1e9 / (st->ops + st->fired + st->wakeups));
+
+    for (i = 0; i < ngx_timer_churn_events; i++) {
+        if (ngx_timer_churn_ev[i].timer_set) {
+            ngx_del_timer(&ngx_timer_churn_ev[i]);
+        }
+    }
+}
+
+
+static void
+ngx_timer_churn_handler(ngx_event_t *e)
+{
+    ngx_uint_t  i;
+    ngx_msec_t  key;
+
+    i = e - ngx_timer_churn_ev;
+
+    ngx_timer_churn_stat->fired++;
+    ngx_timer_churn_stat->sum += (uint64_t) (i + 1) * ngx_current_msec;
+
+    /* ngx_rbtree_delete() zeroes the key in the debug builds */
+
+    key = ngx_timer_churn_keys[i];
+
+    if ((ngx_msec_int_t) (ngx_current_msec - key) < 0) {
+        ngx_timer_churn_stat->early++;
+
+    } else if (ngx_timer_churn_idle
+               ? ngx_current_msec != key
+               : (ngx_msec_int_t) (key - ngx_timer_churn_last) <= 0)
+    {
+        ngx_timer_churn_stat->late++;
+    }
+
+    e->timedout = 0;
+
+    ngx_add_timer(e, ngx_timer_churn_timeout(&ngx_timer_churn_states[i]));
+    ngx_timer_churn_keys[i] = e->timer.key;
+}
+
+
+/* keepalive, read and send timeouts and a few long timers */
+
+static ngx_msec_t
+ngx_timer_churn_timeout(uint32_t *state)
+{
+    uint32_t  r;
+
+    r = ngx_harness_random(state);
+
+    switch (r % 10) {
+
+    case 0:
+        return 1 + (r >> 8) % 1000;
+
+    case 1:
+    case 2:
+    case 3:
+        return 5000 + (r >> 8) % 55000;
+
+    case 9:
+        return 300000 + (r >> 8) % 3600000;
+
+    default:
+        return 60000;
+    }
+}
@@ -0,0 +1,547 @@
+
+/*
+ * Copyright (C) agent
+ */
+
+
+/*
+ * ngx_http_parse_complex_uri(), ngx_escape_uri() and ngx_unescape_uri()
+ * are compared with their copies built without the SSE2 code on URIs
+ * looking like the ones of search and API requests, and on their random
+ * mutations: the return values, the output and all request fields set
+ * must be the same for every merge_slashes value, every escape type and
+ * every unescape type both in place and not; the input and every output
+ * buffer end right before an inaccessible page, the output buffers are
+ * sized as nginx allocates them
+ *
+ * then both versions process a corpus of such URIs for comparison
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+#include "ngx_harness.h"
+
+
+#define NGX_URI_DIFF_MAX     1024
+#define NGX_URI_DIFF_BUF     (4 * NGX_URI_DIFF_MAX)
+#define NGX_URI_DIFF_CORPUS  1000
+
+
+typedef struct {
+    char        *name;
+    ngx_int_t  (*parse_complex_uri)(ngx_http_request_t *r,
+                    ngx_uint_t merge_slashes);
+    uintptr_t  (*escape_uri)(u_char *dst, u_char *src, size_t size,
+                    ngx_uint_t type);
+    void       (*unescape_uri)(u_char **dst, u_char **src, size_t size,
+                    ngx_uint_t type);
+} ngx_uri_diff_impl_t;
+
+
+ngx_int_t ngx_http_parse_complex_uri_scalar(ngx_http_request_t *r,
+    ngx_uint_t merge_slashes);
+uintptr_t ngx_escape_uri_scalar(u_char *dst, u_char *src, size_t size,
+    ngx_uint_t type);
+void ngx_unescape_uri_scalar(u_char **dst, u_char **src, size_t size,
+    ngx_uint_t type);
+
+static size_t ngx_uri_diff_generate(u_char *buf, uint32_t *state,
+    ngx_uint_t mutate);
+static char *ngx_uri_diff_run(u_char *uri, size_t len);
+static char *ngx_uri_diff_complex(u_char *uri, size_t len,
+    ngx_uint_t merge_slashes);
+static ngx_int_t ngx_uri_diff_complex_uri(ngx_uri_diff_impl_t *impl,
+    ngx_http_request_t *r, u_char *uri, size_t len, size_t size, u_char *out,
+    ngx_uint_t merge_slashes);
+static void ngx_uri_diff_dump(u_char *uri, size_t len);
+static void ngx_uri_diff_bench(ngx_uri_diff_impl_t *impl, u_char *corpus,
+    size_t *lens, ngx_uint_t n, double *times);
+static u_char *ngx_uri_diff_buffer(void);
+
+
+static ngx_uri_diff_impl_t  ngx_uri_diff_impls[] = {
+    { "SSE2", ngx_http_parse_complex_uri, ngx_escape_uri, ngx_unescape_uri },
+    { "without SSE2", ngx_http_parse_complex_uri_scalar,
+      ngx_escape_uri_scalar, ngx_unescape_uri_scalar }
+};
+
+
+static char  *ngx_uri_diff_segments[] = {
+    "api", "v1", "v2", "users", "12345", "orders", "search", "static",
+    "images", "css", "js", "index.html", "style.min.css", "app.js",
+    "photo.jpg", "download", "archive.tar.gz", "~user", "wiki",
+    "Main_Page", "caf%C3%A9", "%D0%BF%D1%80%D0%B8%D0%B2%D0%B5%D1%82",
+    "New%20Folder", "a+b", "C%2B%2B", "2024", "report-final.pdf"
+};
+
+static char  *ngx_uri_diff_args[] = {
+    "q=nginx+http+server", "page=2", "per_page=50", "sort=-date",
+    "lang=en", "utm_source=newsletter", "id=9f86d081884c7d65",
+    "redirect=%2Fhome%3Ftab%3D1", "filter=price%3E100", "tags=a,b,c",
+    "name=J%C3%BCrgen", "empty=", "flag"
+};
+
+/* the bytes that change the states of the parsers */
+
+static u_char  ngx_uri_diff_special[] = {
+    '%', '%', '/', '/', '.', '.', '?', '#', '+', '&', '=', '\\', ' ', '\0',
+    CR, LF, 0x80, 0xff, 'A', 'f', 'g', '2', 'F'
+};
+
+
+static u_char  *ngx_uri_diff_in;
+static u_char  *ngx_uri_diff_out[2];
+
+
+int
+main(int argc, char *const *argv)
+{
+    int          ch;
+    char        *op;
+    size_t       len, *lens;
+    u_char      *buf, *corpus, *p;
+    uint32_t     state;
+    ngx_uint_t   i, n, b;
+    double       times[2][3];
+
+    n = 2000000;
+    b = 1000;
+    state = 2463534242u;
+
+    while ((ch = getopt(argc, argv, "n:b:s:")) != -1) {
+        switch (ch) {
+
+        case 'n':
+            n = atoi(optarg);
+            break;
+
+        case 'b':
+            b = atoi(optarg);
+            break;
+
+        case 's':
+            state = atoi(optarg);
+            break;
+
+        default:
+            fprintf(stderr, "usage: uri_diff [-n uris] [-b passes] "
+                            "[-s seed]\n");
+            return 2;
+        }
+    }
+
+    ngx_harness_init();
+
+    if (state == 0) {
+        state = 1;
+    }
+
+    ngx_uri_diff_in = ngx_uri_diff_buffer();
+    ngx_uri_diff_out[0] = ngx_uri_diff_buffer();
+    ngx_uri_diff_out[1] = ngx_uri_diff_buffer();
+
+    buf = malloc(NGX_URI_DIFF_MAX);
+    corpus = malloc(NGX_URI_DIFF_CORPUS * NGX_URI_DIFF_MAX);
+    lens = malloc(NGX_URI_DIFF_CORPUS * sizeof(size_t));
+
+    if (buf == NULL || corpus == NULL || lens == NULL) {
+        return 2;
+    }
+
+    for (i = 0; i < n; i++) {
+        len = ngx_uri_diff_generate(buf, &state, i & 1);
+
+        op = ngx_uri_diff_run(buf, len);
+
+        if (op) {
+            printf("FAIL: uri %lu, %s differs: ", (unsigned long) i, op);
+            ngx_uri_diff_dump(buf, len);
+            return 1;
+        }
+    }
+
+    printf("%lu uris processed identically\n", (unsigned long) n);
+
+    if (b == 0) {
+        return 0;
+    }
+
+    len = 0;
+    p = corpus;
+
+    for (i = 0; i < NGX_URI_DIFF_CORPUS; i++) {
+        lens[i] = ngx_uri_diff_generate(p, &state, 0);
+        p[lens[i]] = LF;
+
+        len += lens[i];
+        p += lens[i] + 1;
+    }
+
+    for (i = 0; i < 2; i++) {
+        ngx_uri_diff_bench(&ngx_uri_diff_impls[i], corpus, lens, b, times[i]);
+    }
+
+    printf("%u uris of %.1f bytes on average, ns per uri:\n",
+           NGX_URI_DIFF_CORPUS, (double) len / NGX_URI_DIFF_CORPUS);
+
+    for (i = 0; i < 2; i++) {
+        printf("%-12s  complex uri %7.1f  escape %7.1f  unescape %7.1f\n",
+               ngx_uri_diff_impls[i].name,
+               times[i][0] * 1e9 / (b * NGX_URI_DIFF_CORPUS),
+               times[i][1] * 1e9 / (b * NGX_URI_DIFF_CORPUS),
+               times[i][2] * 1e9 / (b * NGX_URI_DIFF_CORPUS));
+    }
+
+    return 0;
+}
+
+
+static size_t
+ngx_uri_diff_generate(u_char *buf, uint32_t *state, ngx_uint_t mutate)
+{
+    u_char      *p, *last;
+    char        *s;
+    size_t       len;
+    ngx_uint_t   i, n, k;
+
+    p = buf;
+    last = buf + NGX_URI_DIFF_MAX - 64;
+
+    n = 1 + ngx_harness_random(state) % 8;
+
+    for (i = 0; i < n; i++) {
+        k = ngx_harness_random(state);
+
+        /* "//", "/./" and "/../" are rare in real requests */
+
+        switch (k % 64) {
+        case 0:
+            s = "";
+            break;
+        case 1:
+            s = ".";
+            break;
+        case 2:
+            s = "..";
+            break;
+        default:
+            s = ngx_uri_diff_segments[(k >> 8)
+                                      % (sizeof(ngx_uri_diff_segments)
+                                         / sizeof(char *))];
+        }
+
+        *p++ = '/';
+        p = ngx_cpymem(p, s, ngx_strlen(s));
+    }
+
+    if (ngx_harness_random(state) % 2) {
+        n = 1 + ngx_harness_random(state) % 6;
+
+        for (i = 0; i < n && p < last; i++) {
+            s = ngx_uri_diff_args[ngx_harness_random(state)
+                                  % (sizeof(ngx_uri_diff_args)
+                                     / sizeof(char *))];
+
+            *p++ = i ? '&' : '?';
+            p = ngx_cpymem(p, s, ngx_strlen(s));
+        }
+    }
+
+    len = p - buf;
+
+    if (!mutate) {
+        return len;
+    }
+
+    n = ngx_harness_random(state) % 6;
+
+    for (i = 0; i < n; i++) {
+        k = ngx_harness_random(state) % len;
+
+        switch (ngx_harness_random(state) % 4) {
+
+        case 0:
+        case 1:
+            buf[k] = ngx_uri_diff_special[ngx_harness_random(state)
+                                          % sizeof(ngx_uri_diff_special)];
+            break;
+
+        case 2:
+            buf[k] = (u_char) ngx_harness_random(state);
+            break;
+
+        default:
+            len = k + 1;
+            break;
+        }
+    }
+
+    return len;
+}
+
+
+static char *
+ngx_uri_diff_run(u_char *uri, size_t len)
+{
+    char        *op;
+    u_char      *d[2], *s[2], *src;
+    uintptr_t    n[2];
+    ngx_uint_t   i, type;
+
+    /* the URI is followed by a line feed as in the request line */
+
+    src = ngx_uri_diff_in - len - 1;
+    ngx_memcpy(src, uri, len);
+    src[len] = LF;
+
+    for (i = 0; i < 2; i++) {
+        op = ngx_uri_diff_complex(src, len, i);
+        if (op) {
+            return op;
+        }
+    }
+
+    for (type = NGX_ESCAPE_URI; type <= NGX_ESCAPE_MAIL_AUTH; type++) {
+
+        for (i = 0; i < 2; i++) {
+            n[i] = ngx_uri_diff_impls[i].escape_uri(NULL, src, len, type);
+        }
+
+        if (n[0] != n[1]) {
+            return "ngx_escape_uri() count";
+        }
+
+        for (i = 0; i < 2; i++) {
+            d[i] = ngx_uri_diff_out[i] - len - 2 * n[i];
+            s[i] = (u_char *) ngx_uri_diff_impls[i].escape_uri(d[i], src, len,
+                                                               type);
+        }
+
+        if (s[0] - d[0] != s[1] - d[1]
+            || s[0] != ngx_uri_diff_out[0]
+            || ngx_memcmp(d[0], d[1], s[0] - d[0]) != 0)
+        {
+            return "ngx_escape_uri()";
+        }
+    }
+
+    for (type = 0; type <= NGX_UNESCAPE_REDIRECT; type++) {
+
+        for (i = 0; i < 2; i++) {
+            d[i] = ngx_uri_diff_out[i] - len;
+            s[i] = src;
+            ngx_uri_diff_impls[i].unescape_uri(&d[i], &s[i], len, type);
+        }
+
+        if (s[0] != s[1]
+            || d[0] - ngx_uri_diff_out[0] != d[1] - ngx_uri_diff_out[1]
+            || ngx_memcmp(ngx_uri_diff_out[0] - len, ngx_uri_diff_out[1] - len,
+                          d[0] - (ngx_uri_diff_out[0] - len)) != 0)
+        {
+            return "ngx_unescape_uri()";
+        }
+
+        /* in place */
+
+        for (i = 0; i < 2; i++) {
+            d[i] = ngx_uri_diff_out[i] - len;
+            s[i] = d[i];
+            ngx_memcpy(d[i], src, len);
+            ngx_uri_diff_impls[i].unescape_uri(&d[i], &s[i], len, type);
+        }
+
+        if (s[0] - ngx_uri_diff_out[0] != s[1] - ngx_uri_diff_out[1]
+            || d[0] - ngx_uri_diff_out[0] != d[1] - ngx_uri_diff_out[1]
+            || ngx_memcmp(ngx_uri_diff_out[0] - len, ngx_uri_diff_out[1] - len,
+                          d[0] - (ngx_uri_diff_out[0] - len)) != 0)
+        {
+            return "in place ngx_unescape_uri()";
+        }
+    }
+
+    return NULL;
+}
+
+
+#define ngx_uri_diff_field(f)                                                 \
+    if (r[0].f != r[1].f) {                                                   \
+        return "ngx_http_parse_complex_uri() " #f;                            \
+    }
+
+#define ngx_uri_diff_offset(f)                                                \
+    if ((r[0].f ? r[0].f - out[0] : -1) != (r[1].f ? r[1].f - out[1] : -1)) {\
+        return "ngx_http_parse_complex_uri() " #f;                            \
+    }
+
+static char *
+ngx_uri_diff_complex(u_char *uri, size_t len, ngx_uint_t merge_slashes)
+{
+    size_t               size;
+    u_char              *out[2], *q;
+    ngx_int_t            rc[2];
+    ngx_uint_t           i;
+    ngx_http_request_t   r[2];
+
+    /* r->uri.data is allocated for the URI without the arguments */
+
+    q = ngx_strlchr(uri, uri + len, '?');
+    size = q ? (size_t) (q - uri) : len;
+
+    ngx_memzero(r, sizeof(r));
+
+    for (i = 0; i < 2; i++) {
+        out[i] = ngx_uri_diff_out[i] - size - 1;
+
+        rc[i] = ngx_uri_diff_complex_uri(&ngx_uri_diff_impls[i], &r[i], uri,
+                                         len, size, out[i], merge_slashes);
+    }
+
+    if (rc[0] != rc[1]) {
+        return "ngx_http_parse_complex_uri() return code";
+    }
+
+    if (rc[0] != NGX_OK) {
+        return NULL;
+    }
+
+    ngx_uri_diff_field(uri.len);
+    ngx_uri_diff_field(args_start);
+    ngx_uri_diff_field(args.len);
+    ngx_uri_diff_field(args.data);
+    ngx_uri_diff_field(exten.len);
+    ngx_uri_diff_field(plus_in_uri);
+    ngx_uri_diff_field(quoted_uri);
+    ngx_uri_diff_offset(uri_ext);
+    ngx_uri_diff_offset(exten.data);
+
+    if (ngx_memcmp(out[0], out[1], r[0].uri.len) != 0) {
+        return "ngx_http_parse_complex_uri() output";
+    }
+
+    return NULL;
+}
+
+
+/*
+ * the request fields are set as ngx_http_process_request_line() does,
+ * the rest of the request is zeroed by the caller
+ */
+
+static ngx_int_t
+ngx_uri_diff_complex_uri(ngx_uri_diff_impl_t *impl, ngx_http_request_t *r,
+    u_char *uri, size_t len, size_t size, u_char *out,
+    ngx_uint_t merge_slashes)
+{
+    static ngx_connection_t  c;
+
+    c.log = ngx_cycle->log;
+
+    r->connection = &c;
+    r->uri_start = uri;
+    r->uri_end = uri + len;
+    r->uri.len = size;
+    r->uri.data = out;
+
+    return impl->parse_complex_uri(r, merge_slashes);
+}
+
+
+static void
+ngx_uri_diff_dump(u_char *uri, size_t len)
+{
+    u_char  *p;
+
+    for (p = uri; p < uri + len; p++) {
+        if (*p >= 0x20 && *p < 0x7f && *p != '\\') {
+            putchar(*p);
+
+        } else {
+            printf("\\x%02x", *p);
+        }
+    }
+
+    putchar('\n');
+}
+
+
+static void
+ngx_uri_diff_bench(ngx_uri_diff_impl_t *impl, u_char *corpus, size_t *lens,
+    ngx_uint_t n, double *times)
+{
+    u_char              *p, *d, *s, *out;
+    double               start, elapsed;
+    ngx_uint_t           i, j, k, t;
+    ngx_http_request_t   r;
+
+    out = ngx_uri_diff_out[0] - NGX_URI_DIFF_BUF;
+
+    ngx_memzero(&r, sizeof(ngx_http_request_t));
+
+    /* the best of three runs */
+
+    for (i = 0; i < 3; i++) {
+        times[i] = 0;
+
+        for (t = 0; t < 3; t++) {
+            start = ngx_harness_time();
+
+            for (k = 0; k < n; k++) {
+                p = corpus;
+
+                for (j = 0; j < NGX_URI_DIFF_CORPUS; p += lens[j++] + 1) {
+
+                    switch (i) {
+
+                    case 0:
+                        (void) ngx_uri_diff_complex_uri(impl, &r, p, lens[j],
+                                                        lens[j], out, 1);
+                        break;
+
+                    case 1:
+                        (void) impl->escape_uri(out, p, lens[j],
+                                                NGX_ESCAPE_ARGS);
+                        break;
+
+                    default:
+                        d = out;
+                        s = p;
+                        impl->unescape_uri(&d, &s, lens[j], NGX_UNESCAPE_URI);
+                        break;
+                    }
+                }
+            }
+
+            elapsed = ngx_harness_time() - start;
+
+            if (times[i] == 0 || elapsed < times[i]) {
+                times[i] = elapsed;
+            }
+        }
+    }
+}
+
+
+/* returns the end of a buffer followed by an inaccessible page */
+
+static u_char *
+ngx_uri_diff_buffer(void)
+{
+    u_char  *p;
+
+    p = mmap(NULL, NGX_URI_DIFF_BUF + ngx_pagesize, PROT_READ|PROT_WRITE,
+             MAP_ANON|MAP_PRIVATE, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        exit(2);
+    }
+
+    if (mprotect(p + NGX_URI_DIFF_BUF, ngx_pagesize, PROT_NONE) == -1) {
+        perror("mprotect");
+        exit(2);
+    }
+
+    return p + NGX_URI_DIFF_BUF;
+}
@@ -52,6 +52,8 @@ struct ngx_listening_s {
     ngx_listening_t    *previous;//多个ngx_listening_t对象由previous指针组成单链表
     ngx_connection_t   *connection;
 
+    ngx_uint_t          worker;/*reuseport时该套接字所属worker进程的序号*/
+
     unsigned            open:1;/*为1时表示当前监听套接字有效，为0表示正常关闭*/
     unsigned            remain:1;
     unsigned            ignore:1;
@@ -69,6 +71,11 @@ struct ngx_listening_s {
 #endif
     unsigned            keepalive:2;
 
+#if (NGX_HAVE_REUSEPORT)
+    unsigned            reuseport:1;
+    unsigned            add_reuseport:1;
+#endif
+
 #if (NGX_HAVE_DEFERRED_ACCEPT)
     unsigned            deferred_accept:1;
     unsigned            delete_deferred:1;
@@ -185,6 +192,7 @@ struct ngx_connection_s {
 
 ngx_listening_t *ngx_create_listening(ngx_conf_t *cf, void *sockaddr,
     socklen_t socklen);
+ngx_int_t ngx_clone_listening(ngx_conf_t *cf, ngx_listening_t *ls);
 ngx_int_t ngx_set_inherited_sockets(ngx_cycle_t *cycle);
 ngx_int_t ngx_open_listening_sockets(ngx_cycle_t *cycle);
 void ngx_configure_listening_sockets(ngx_cycle_t *cycle);
@@ -27,6 +27,12 @@ struct ngx_file_s {
     ngx_event_aio_t           *aio;
 #endif
 
+#if (NGX_THREAD_POOL)
+    ngx_int_t                (*thread_handler)(ngx_thread_task_t *task,
+                                               ngx_file_t *file);
+    void                      *thread_ctx;
+#endif
+
     unsigned                   valid_info:1;
     unsigned                   directio:1;
 };
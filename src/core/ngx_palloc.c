@@ -11,6 +11,23 @@
 
 static void *ngx_palloc_block(ngx_pool_t *pool, size_t size);
 static void *ngx_palloc_large(ngx_pool_t *pool, size_t size);
+static void *ngx_palloc_free(ngx_pool_t *pool, size_t size);
+static ngx_pool_ext_t *ngx_pool_get_ext(ngx_pool_t *pool);
+static void ngx_pool_free_ext(ngx_pool_ext_t *ext);
+static void ngx_pool_link_large(ngx_pool_t *pool, ngx_pool_large_t *large,
+    void *p, size_t size);
+
+
+static ngx_inline ngx_uint_t
+ngx_pool_large_key(void *p, ngx_uint_t hsize)
+{
+    uintptr_t  key;
+
+    key = (uintptr_t) p >> 4;
+
+    return (ngx_uint_t) ((key ^ (key >> 8)) & (hsize - 1));
+}
+
 
 /* 创建内存池 */
 ngx_pool_t *
@@ -36,6 +53,7 @@ ngx_create_pool(size_t size, ngx_log_t *log)
     p->large = NULL;
     p->cleanup = NULL;
     p->log = log;
+    p->ext = NULL;
 
     return p;
 }
@@ -66,6 +84,10 @@ ngx_destroy_pool(ngx_pool_t *pool)
         }
     }
 
+    if (pool->ext) {
+        ngx_pool_free_ext(pool->ext);
+    }
+
 #if (NGX_DEBUG)
 
     /*
@@ -107,6 +129,11 @@ ngx_reset_pool(ngx_pool_t *pool)
     }
 
     pool->large = NULL;
+
+    if (pool->ext) {
+        ngx_pool_free_ext(pool->ext);
+        pool->ext = NULL;
+    }
 	//重置内存池的last指针
     for (p = pool; p; p = p->d.next) {
         p->d.last = (u_char *) p + sizeof(ngx_pool_t);
@@ -114,6 +141,93 @@ ngx_reset_pool(ngx_pool_t *pool)
 }
 
 
+/*
+ * 从缓存中取出一个大小为size的内存池, the servers may have different
+ * request_pool_size's, so the whole list is searched
+ */
+ngx_pool_t *
+ngx_create_cached_pool(ngx_pool_cache_t *cache, size_t size, ngx_log_t *log)
+{
+    ngx_pool_t  *p, **pp;
+
+    for (pp = &cache->free; *pp; pp = &p->d.next) {
+        p = *pp;
+
+        if ((size_t) (p->d.end - (u_char *) p) != size) {
+            continue;
+        }
+
+        *pp = p->d.next;
+        cache->nfree--;
+        cache->hits++;
+
+        p->d.next = NULL;
+        p->log = log;
+
+        return p;
+    }
+
+    cache->misses++;
+
+    return ngx_create_pool(size, log);
+}
+
+/* 清理内存池并放回缓存，只保留第一个内存块 */
+void
+ngx_destroy_cached_pool(ngx_pool_cache_t *cache, ngx_pool_t *pool)
+{
+    ngx_pool_t          *p, *n;
+    ngx_pool_large_t    *l;
+    ngx_pool_cleanup_t  *c;
+
+    if (cache->nfree >= cache->max) {
+        ngx_destroy_pool(pool);
+        return;
+    }
+
+    for (c = pool->cleanup; c; c = c->next) {
+        if (c->handler) {
+            ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
+                           "run cleanup: %p", c);
+            c->handler(c->data);
+        }
+    }
+
+    for (l = pool->large; l; l = l->next) {
+
+        ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0, "free: %p", l->alloc);
+
+        if (l->alloc) {
+            ngx_free(l->alloc);
+        }
+    }
+
+    if (pool->ext) {
+        ngx_pool_free_ext(pool->ext);
+    }
+
+    for (p = pool->d.next; p; p = n) {
+        n = p->d.next;
+        ngx_free(p);
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
+                   "cache pool: %p, cached: %ui", pool, cache->nfree + 1);
+
+    pool->d.last = (u_char *) pool + sizeof(ngx_pool_t);
+    pool->d.failed = 0;
+    pool->current = pool;
+    pool->chain = NULL;
+    pool->large = NULL;
+    pool->cleanup = NULL;
+    pool->ext = NULL;
+
+    pool->d.next = cache->free;
+    cache->free = pool;
+    cache->nfree++;
+}
+
+
 /* 从内存池分配size大小空间，返回数据存储的首地址 */
 void *
 ngx_palloc(ngx_pool_t *pool, size_t size)
@@ -123,6 +237,13 @@ ngx_palloc(ngx_pool_t *pool, size_t size)
 
     if (size <= pool->max) {
 
+        if (pool->ext && pool->ext->free_size) {
+            m = ngx_palloc_free(pool, size);
+            if (m) {
+                return m;
+            }
+        }
+
         p = pool->current;/* 真正开始匹配的内存池 */
 
         do {
@@ -154,6 +275,13 @@ ngx_pnalloc(ngx_pool_t *pool, size_t size)
 
     if (size <= pool->max) {
 
+        if (pool->ext && pool->ext->free_size) {
+            m = ngx_palloc_free(pool, size);
+            if (m) {
+                return m;
+            }
+        }
+
         p = pool->current;
 
         do {
@@ -233,11 +361,16 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
         return NULL;
     }
 
+    if (ngx_pool_get_ext(pool) == NULL) {
+        ngx_free(p);
+        return NULL;
+    }
+
     n = 0;
 
     for (large = pool->large; large; large = large->next) {
         if (large->alloc == NULL) {/* 查找没有使用的大块内存池 */
-            large->alloc = p;
+            ngx_pool_link_large(pool, large, p, size);
             return p;
         }
 
@@ -255,10 +388,11 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
     }
 
 	/* 将新创建的内存池加入到链(头部)中 */
-    large->alloc = p;
     large->next = pool->large;
     pool->large = large;
 
+    ngx_pool_link_large(pool, large, p, size);
+
     return p;
 }
 
@@ -274,37 +408,272 @@ ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment)
         return NULL;
     }
 
+    if (ngx_pool_get_ext(pool) == NULL) {
+        ngx_free(p);
+        return NULL;
+    }
+
     large = ngx_palloc(pool, sizeof(ngx_pool_large_t));
     if (large == NULL) {
         ngx_free(p);
         return NULL;
     }
 
-    large->alloc = p;
     large->next = pool->large;
     pool->large = large;
 
+    ngx_pool_link_large(pool, large, p, size);
+
     return p;
 }
 
+
+static void
+ngx_pool_link_large(ngx_pool_t *pool, ngx_pool_large_t *large, void *p,
+    size_t size)
+{
+    ngx_uint_t          n, hsize;
+    ngx_pool_ext_t     *ext;
+    ngx_pool_large_t  **hash, *l;
+
+    large->alloc = p;
+    large->size = size;
+
+    ext = pool->ext;
+
+    ext->nlarge++;
+    ext->large_size += size;
+
+    if (ext->large_peak < ext->large_size) {
+        ext->large_peak = ext->large_size;
+    }
+
+    if (ext->hash == NULL && ext->nlarge <= NGX_POOL_LARGE_LIST) {
+        return;
+    }
+
+    if (ext->hash == NULL || ext->nlarge > 2 * ext->hsize) {
+
+        /* build or grow the index, the large block is already in the list */
+
+        hsize = ext->hash ? 2 * ext->hsize : 4 * NGX_POOL_LARGE_LIST;
+
+        hash = ngx_calloc(hsize * sizeof(ngx_pool_large_t *), pool->log);
+
+        if (hash) {
+            for (l = pool->large; l; l = l->next) {
+                if (l->alloc) {
+                    n = ngx_pool_large_key(l->alloc, hsize);
+                    l->hnext = hash[n];
+                    hash[n] = l;
+                }
+            }
+
+            if (ext->hash) {
+                ngx_free(ext->hash);
+            }
+
+            ext->hash = hash;
+            ext->hsize = hsize;
+
+            return;
+        }
+
+        if (ext->hash == NULL) {
+            return;
+        }
+    }
+
+    n = ngx_pool_large_key(p, ext->hsize);
+    large->hnext = ext->hash[n];
+    ext->hash[n] = large;
+}
+
 /* 释放large链的数据内存 */
 ngx_int_t
 ngx_pfree(ngx_pool_t *pool, void *p)
 {
-    ngx_pool_large_t  *l;
+    ngx_pool_ext_t     *ext;
+    ngx_pool_large_t   *l, **lp;
+
+    ext = pool->ext;
+
+    if (ext == NULL) {
+        return NGX_DECLINED;
+    }
+
+    if (ext->hash) {
+        for (lp = &ext->hash[ngx_pool_large_key(p, ext->hsize)];
+             *lp;
+             lp = &(*lp)->hnext)
+        {
+            l = *lp;
+
+            if (p == l->alloc) {
+                *lp = l->hnext;
+                goto found;
+            }
+        }
+
+        return NGX_DECLINED;
+    }
 
     for (l = pool->large; l; l = l->next) {
         if (p == l->alloc) {
-            ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
-                           "free: %p", l->alloc);
-            ngx_free(l->alloc);
-            l->alloc = NULL;
-
-            return NGX_OK;
+            goto found;
         }
     }
 
     return NGX_DECLINED;
+
+found:
+
+    ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0, "free: %p", l->alloc);
+
+    ngx_free(l->alloc);
+    l->alloc = NULL;
+
+    ext->nlarge--;
+    ext->large_size -= l->size;
+
+    return NGX_OK;
+}
+
+
+/*
+ * a small chunk is put to the free list of the largest class it fits,
+ * and is reused by ngx_palloc() and ngx_pnalloc() of that class;
+ * the chunks of ngx_pnalloc() may be unaligned and are not reused
+ */
+
+ngx_int_t
+ngx_pfree_size(ngx_pool_t *pool, void *p, size_t size)
+{
+    ngx_uint_t        n;
+    ngx_pool_ext_t   *ext;
+    ngx_pool_free_t  *f;
+
+    if (size > pool->max) {
+        return ngx_pfree(pool, p);
+    }
+
+    if (size < (1 << NGX_POOL_FREE_SHIFT)
+        || ((uintptr_t) p & (NGX_ALIGNMENT - 1)))
+    {
+        return NGX_DECLINED;
+    }
+
+    ext = ngx_pool_get_ext(pool);
+    if (ext == NULL) {
+        return NGX_DECLINED;
+    }
+
+    if (ext->free == NULL) {
+        ext->free = ngx_calloc(NGX_POOL_FREE_CLASSES * sizeof(ngx_pool_free_t *),
+                               pool->log);
+        if (ext->free == NULL) {
+            return NGX_DECLINED;
+        }
+    }
+
+    n = (ngx_min(size, NGX_POOL_FREE_MAX) >> NGX_POOL_FREE_SHIFT) - 1;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
+                   "free: %p, size:%uz, class:%ui", p, size, n);
+
+    f = p;
+    f->next = ext->free[n];
+    ext->free[n] = f;
+
+    ext->free_size += (n + 1) << NGX_POOL_FREE_SHIFT;
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_palloc_free(ngx_pool_t *pool, size_t size)
+{
+    ngx_uint_t        n;
+    ngx_pool_ext_t   *ext;
+    ngx_pool_free_t  *f;
+
+    if (size > NGX_POOL_FREE_MAX) {
+        return NULL;
+    }
+
+    n = (size + (1 << NGX_POOL_FREE_SHIFT) - 1) >> NGX_POOL_FREE_SHIFT;
+
+    if (n) {
+        n--;
+    }
+
+    ext = pool->ext;
+
+    f = ext->free[n];
+
+    if (f == NULL) {
+        return NULL;
+    }
+
+    ext->free[n] = f->next;
+    ext->free_size -= (n + 1) << NGX_POOL_FREE_SHIFT;
+
+    return f;
+}
+
+
+static ngx_pool_ext_t *
+ngx_pool_get_ext(ngx_pool_t *pool)
+{
+    if (pool->ext == NULL) {
+        pool->ext = ngx_calloc(sizeof(ngx_pool_ext_t), pool->log);
+    }
+
+    return pool->ext;
+}
+
+
+static void
+ngx_pool_free_ext(ngx_pool_ext_t *ext)
+{
+    if (ext->hash) {
+        ngx_free(ext->hash);
+    }
+
+    if (ext->free) {
+        ngx_free(ext->free);
+    }
+
+    ngx_free(ext);
+}
+
+
+/*
+ * the blocks are never freed while the pool lives, so the peak is
+ * the size of the blocks and the largest size of the large blocks
+ */
+
+void
+ngx_pool_stat(ngx_pool_t *pool, ngx_pool_stat_t *stat)
+{
+    ngx_pool_t  *p;
+
+    stat->size = 0;
+    stat->wasted = 0;
+
+    for (p = pool; p; p = p->d.next) {
+        stat->size += p->d.end - (u_char *) p;
+        stat->wasted += p->d.end - p->d.last;
+    }
+
+    stat->peak = stat->size;
+
+    if (pool->ext) {
+        stat->size += pool->ext->large_size;
+        stat->peak += pool->ext->large_peak;
+        stat->wasted += pool->ext->free_size;
+    }
 }
 
 /* 在内存池中申请空间，同时清零*/
@@ -22,10 +22,24 @@
 #define NGX_DEFAULT_POOL_SIZE    (16 * 1024)
 
 #define NGX_POOL_ALIGNMENT       16
+
+/*
+ * the size and the address index link of the large blocks raise it
+ * from 112 to 160 bytes on 64-bit platforms, so the smaller
+ * connection_pool_size and request_pool_size values are rejected
+ */
 #define NGX_MIN_POOL_SIZE                                                     \
     ngx_align((sizeof(ngx_pool_t) + 2 * sizeof(ngx_pool_large_t)),            \
               NGX_POOL_ALIGNMENT)
 
+/* small chunks returned by ngx_pfree_size() are kept in 8-byte classes */
+#define NGX_POOL_FREE_SHIFT      3
+#define NGX_POOL_FREE_MAX        512
+#define NGX_POOL_FREE_CLASSES    (NGX_POOL_FREE_MAX >> NGX_POOL_FREE_SHIFT)
+
+/* the large blocks are indexed by address when there are more of them */
+#define NGX_POOL_LARGE_LIST      8
+
 
 typedef void (*ngx_pool_cleanup_pt)(void *data);
 
@@ -43,9 +57,31 @@ typedef struct ngx_pool_large_s  ngx_pool_large_t;
 struct ngx_pool_large_s {
     ngx_pool_large_t     *next; /* 下一个大块区域 */
     void                 *alloc;/* 空间的起始地址 */
+    size_t                size;
+    ngx_pool_large_t     *hnext;/* 地址索引中的下一个 */
 };
 
 
+typedef struct ngx_pool_free_s  ngx_pool_free_t;
+
+struct ngx_pool_free_s {
+    ngx_pool_free_t      *next;
+};
+
+
+/* allocated outside of the pool on the first large block or freed chunk */
+
+typedef struct {
+    ngx_pool_free_t     **free;      /* 按大小分级的空闲链 */
+    size_t                free_size;
+    ngx_pool_large_t    **hash;      /* 大块的地址索引 */
+    ngx_uint_t            hsize;
+    ngx_uint_t            nlarge;
+    size_t                large_size;
+    size_t                large_peak;
+} ngx_pool_ext_t;
+
+
 typedef struct {
     u_char               *last;/* 可用空间的起始地址 */
     u_char               *end;/* 可用空间的结束地址 */
@@ -62,9 +98,33 @@ struct ngx_pool_s {
     ngx_pool_large_t     *large;/* 大的数据块，大小超过了max */
     ngx_pool_cleanup_t   *cleanup;
     ngx_log_t            *log;
+    ngx_pool_ext_t       *ext;
 };
 
 
+typedef struct {
+    size_t                size;      /* the blocks and live large blocks */
+    size_t                peak;
+    size_t                wasted;    /* unused tails and freed chunks */
+} ngx_pool_stat_t;
+
+
+/*
+ * the pools kept by a process instead of freeing them, only the first
+ * block of a pool is kept; "max" limits the number of the pools rather
+ * than their bytes, so the cache may hold up to max * size bytes, where
+ * "size" is the largest size the pools were created with
+ */
+
+typedef struct {
+    ngx_pool_t           *free;      /* linked by d.next */
+    ngx_uint_t            nfree;
+    ngx_uint_t            max;
+    ngx_uint_t            hits;
+    ngx_uint_t            misses;
+} ngx_pool_cache_t;
+
+
 typedef struct {
     ngx_fd_t              fd;
     u_char               *name;
@@ -78,12 +138,17 @@ void *ngx_calloc(size_t size, ngx_log_t *log);
 ngx_pool_t *ngx_create_pool(size_t size, ngx_log_t *log);
 void ngx_destroy_pool(ngx_pool_t *pool);
 void ngx_reset_pool(ngx_pool_t *pool);
+ngx_pool_t *ngx_create_cached_pool(ngx_pool_cache_t *cache, size_t size,
+    ngx_log_t *log);
+void ngx_destroy_cached_pool(ngx_pool_cache_t *cache, ngx_pool_t *pool);
 
 void *ngx_palloc(ngx_pool_t *pool, size_t size);
 void *ngx_pnalloc(ngx_pool_t *pool, size_t size);
 void *ngx_pcalloc(ngx_pool_t *pool, size_t size);
 void *ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment);
 ngx_int_t ngx_pfree(ngx_pool_t *pool, void *p);
+ngx_int_t ngx_pfree_size(ngx_pool_t *pool, void *p, size_t size);
+void ngx_pool_stat(ngx_pool_t *pool, ngx_pool_stat_t *stat);
 
 
 ngx_pool_cleanup_t *ngx_pool_cleanup_add(ngx_pool_t *p, size_t size);
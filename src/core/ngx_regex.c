@@ -11,6 +11,7 @@
 
 typedef struct {
     ngx_flag_t  pcre_jit;
+    size_t      pcre_jit_stack_size;
 } ngx_regex_conf_t;
 
 
@@ -18,9 +19,11 @@ static void * ngx_libc_cdecl ngx_regex_malloc(size_t size);
 static void ngx_libc_cdecl ngx_regex_free(void *p);
 #if (NGX_HAVE_PCRE_JIT)
 static void ngx_pcre_free_studies(void *data);
+static void ngx_pcre_free_jit_stack(void *data);
 #endif
 
 static ngx_int_t ngx_regex_module_init(ngx_cycle_t *cycle);
+static void ngx_regex_exit_process(ngx_cycle_t *cycle);
 
 static void *ngx_regex_create_conf(ngx_cycle_t *cycle);
 static char *ngx_regex_init_conf(ngx_cycle_t *cycle, void *conf);
@@ -38,6 +41,13 @@ static ngx_command_t  ngx_regex_commands[] = {
       offsetof(ngx_regex_conf_t, pcre_jit),
       &ngx_regex_pcre_jit_post },
 
+    { ngx_string("pcre_jit_stack_size"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      0,
+      offsetof(ngx_regex_conf_t, pcre_jit_stack_size),
+      NULL },
+
       ngx_null_command
 };
 
@@ -59,7 +69,7 @@ ngx_module_t  ngx_regex_module = {
     NULL,                                  /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
-    NULL,                                  /* exit process */
+    ngx_regex_exit_process,                /* exit process */
     NULL,                                  /* exit master */
     NGX_MODULE_V1_PADDING
 };
@@ -68,6 +78,8 @@ ngx_module_t  ngx_regex_module = {
 static ngx_pool_t  *ngx_pcre_pool;
 static ngx_list_t  *ngx_pcre_studies;
 
+ngx_regex_stat_t    ngx_regex_stat;
+
 
 void
 ngx_regex_init(void)
@@ -241,6 +253,40 @@ ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log)
 }
 
 
+#ifdef PCRE_EXTRA_MARK
+
+/*
+ * returns the last (*MARK) name passed on the matching path; the studied
+ * data of the regex are shared, so the mark is requested in their copy
+ */
+
+ngx_int_t
+ngx_regex_exec_mark(ngx_regex_t *re, ngx_str_t *s, u_char **mark)
+{
+    pcre_extra  extra;
+
+    if (re->extra) {
+        extra = *re->extra;
+
+    } else {
+        ngx_memzero(&extra, sizeof(pcre_extra));
+    }
+
+    extra.flags |= PCRE_EXTRA_MARK;
+    extra.mark = mark;
+
+    *mark = NULL;
+
+    ngx_regex_stat.matches++;
+    ngx_regex_stat.jit_matches += re->jit;
+
+    return pcre_exec(re->pcre, &extra, (const char *) s->data, s->len, 0, 0,
+                     NULL, 0);
+}
+
+#endif
+
+
 static void * ngx_libc_cdecl
 ngx_regex_malloc(size_t size)
 {
@@ -309,6 +355,15 @@ ngx_pcre_free_studies(void *data)
     }
 }
 
+
+static void
+ngx_pcre_free_jit_stack(void *data)
+{
+    pcre_jit_stack  *stack = data;
+
+    pcre_jit_stack_free(stack);
+}
+
 #endif
 
 
@@ -320,10 +375,19 @@ ngx_regex_module_init(ngx_cycle_t *cycle)
     ngx_uint_t        i;
     ngx_list_part_t  *part;
     ngx_regex_elt_t  *elts;
+#if (NGX_HAVE_PCRE_JIT)
+    pcre_jit_stack   *stack;
+#endif
 
     opt = 0;
 
+    ngx_regex_stat.compiled = 0;
+    ngx_regex_stat.jit_compiled = 0;
+
 #if (NGX_HAVE_PCRE_JIT)
+
+    stack = NULL;
+
     {
     ngx_regex_conf_t    *rcf;
     ngx_pool_cleanup_t  *cln;
@@ -346,6 +410,39 @@ ngx_regex_module_init(ngx_cycle_t *cycle)
 
         cln->handler = ngx_pcre_free_studies;
         cln->data = ngx_pcre_studies;
+
+        /*
+         * By default the JIT code runs on a 32K machine stack, and matching
+         * of a large alternation fails with PCRE_ERROR_JIT_STACKLIMIT.
+         * The stack is mapped here, before the workers are forked, so each
+         * worker gets its own private copy of it.
+         */
+
+        if (rcf->pcre_jit_stack_size) {
+            ngx_regex_malloc_init(cycle->pool);
+
+            stack = pcre_jit_stack_alloc((int) ngx_min(32 * 1024,
+                                                  rcf->pcre_jit_stack_size),
+                                         (int) rcf->pcre_jit_stack_size);
+
+            ngx_regex_malloc_done();
+
+            if (stack == NULL) {
+                ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                              "pcre_jit_stack_alloc(%uz) failed",
+                              rcf->pcre_jit_stack_size);
+                return NGX_ERROR;
+            }
+
+            cln = ngx_pool_cleanup_add(cycle->pool, 0);
+            if (cln == NULL) {
+                pcre_jit_stack_free(stack);
+                return NGX_ERROR;
+            }
+
+            cln->handler = ngx_pcre_free_jit_stack;
+            cln->data = stack;
+        }
     }
     }
 #endif
@@ -375,6 +472,8 @@ ngx_regex_module_init(ngx_cycle_t *cycle)
                           errstr, elts[i].name);
         }
 
+        ngx_regex_stat.compiled++;
+
 #if (NGX_HAVE_PCRE_JIT)
         if (opt & PCRE_STUDY_JIT_COMPILE) {
             int jit, n;
@@ -387,6 +486,14 @@ ngx_regex_module_init(ngx_cycle_t *cycle)
                 ngx_log_error(NGX_LOG_INFO, cycle->log, 0,
                               "JIT compiler does not support pattern: \"%s\"",
                               elts[i].name);
+                continue;
+            }
+
+            elts[i].regex->jit = 1;
+            ngx_regex_stat.jit_compiled++;
+
+            if (stack) {
+                pcre_assign_jit_stack(elts[i].regex->extra, NULL, stack);
             }
         }
 #endif
@@ -396,10 +503,29 @@ ngx_regex_module_init(ngx_cycle_t *cycle)
 
     ngx_pcre_studies = NULL;
 
+    if (opt) {
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                      "pcre JIT compiled %ui of %ui regular expressions",
+                      ngx_regex_stat.jit_compiled, ngx_regex_stat.compiled);
+    }
+
     return NGX_OK;
 }
 
 
+static void
+ngx_regex_exit_process(ngx_cycle_t *cycle)
+{
+    if (ngx_regex_stat.matches == 0) {
+        return;
+    }
+
+    ngx_log_error(NGX_LOG_INFO, cycle->log, 0,
+                  "pcre matches: %ui, by JIT: %ui",
+                  ngx_regex_stat.matches, ngx_regex_stat.jit_matches);
+}
+
+
 static void *
 ngx_regex_create_conf(ngx_cycle_t *cycle)
 {
@@ -411,6 +537,7 @@ ngx_regex_create_conf(ngx_cycle_t *cycle)
     }
 
     rcf->pcre_jit = NGX_CONF_UNSET;
+    rcf->pcre_jit_stack_size = NGX_CONF_UNSET_SIZE;
 
     ngx_pcre_studies = ngx_list_create(cycle->pool, 8, sizeof(ngx_regex_elt_t));
     if (ngx_pcre_studies == NULL) {
@@ -427,6 +554,7 @@ ngx_regex_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_regex_conf_t *rcf = conf;
 
     ngx_conf_init_value(rcf->pcre_jit, 0);
+    ngx_conf_init_size_value(rcf->pcre_jit_stack_size, 0);
 
     return NGX_CONF_OK;
 }
@@ -23,6 +23,7 @@
 typedef struct {
     pcre        *pcre;
     pcre_extra  *extra;
+    unsigned     jit:1;
 } ngx_regex_t;
 
 
@@ -46,15 +47,33 @@ typedef struct {
 } ngx_regex_elt_t;
 
 
+/* per-process counters, the workers do not share them */
+
+typedef struct {
+    ngx_uint_t    compiled;
+    ngx_uint_t    jit_compiled;
+    ngx_uint_t    matches;
+    ngx_uint_t    jit_matches;
+} ngx_regex_stat_t;
+
+
+extern ngx_regex_stat_t  ngx_regex_stat;
+
+
 void ngx_regex_init(void);
 ngx_int_t ngx_regex_compile(ngx_regex_compile_t *rc);
 
 #define ngx_regex_exec(re, s, captures, size)                                \
-    pcre_exec(re->pcre, re->extra, (const char *) (s)->data, (s)->len, 0, 0, \
-              captures, size)
+    (ngx_regex_stat.matches++, ngx_regex_stat.jit_matches += (re)->jit,      \
+     pcre_exec(re->pcre, re->extra, (const char *) (s)->data, (s)->len, 0, 0,\
+               captures, size))
 #define ngx_regex_exec_n      "pcre_exec()"
 
 ngx_int_t ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log);
 
+#ifdef PCRE_EXTRA_MARK
+ngx_int_t ngx_regex_exec_mark(ngx_regex_t *re, ngx_str_t *s, u_char **mark);
+#endif
+
 
 #endif /* _NGX_REGEX_H_INCLUDED_ */
@@ -60,6 +60,29 @@
 
 #endif
 
+
+/*
+ * 每个分级(slot)和空闲页链表各有一把自旋锁，锁值为持有者的pid，
+ * 以便worker异常退出时由master强制解锁；
+ * 加锁顺序总是先分级锁，后页锁
+ */
+
+#if (NGX_HAVE_ATOMIC_OPS)
+
+#define ngx_slab_lock(lock)    ngx_spinlock(lock, ngx_pid, 1024)
+#define ngx_slab_unlock(lock)  (void) ngx_atomic_cmp_set(lock, ngx_pid, 0)
+
+#else
+
+#define ngx_slab_lock(lock)    (void) (lock)
+#define ngx_slab_unlock(lock)  (void) (lock)
+
+#endif
+
+#define ngx_slab_slot_lock(pool, slot)                                        \
+    &(pool)->locks[(slot) & (NGX_SLAB_LOCKS - 1)].lock
+
+
 static ngx_slab_page_t *ngx_slab_alloc_pages(ngx_slab_pool_t *pool,
     ngx_uint_t pages);
 static void ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
@@ -150,12 +173,30 @@ ngx_slab_init(ngx_slab_pool_t *pool)
 
     pool->log_ctx = &pool->zero;
     pool->zero = '\0';
+
+    pool->mutexes = NULL;
+    pool->nmutexes = 0;
+
+    pool->pages_lock.lock = 0;
+
+    for (i = 0; i < NGX_SLAB_LOCKS; i++) {
+        pool->locks[i].lock = 0;
+    }
 }
 
-/* 申请内存(使用互斥锁) */
+/*
+ * 申请内存；有原子操作时slab内部已按分级加锁，不再需要pool->mutex，
+ * 否则仍使用互斥锁
+ */
 void *
 ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 {
+#if (NGX_HAVE_ATOMIC_OPS)
+
+    return ngx_slab_alloc_locked(pool, size);
+
+#else
+
     void  *p;
 
     ngx_shmtx_lock(&pool->mutex);
@@ -165,15 +206,18 @@ ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
     ngx_shmtx_unlock(&pool->mutex);
 
     return p;
+
+#endif
 }
 
-/* 申请内存(未使用互斥锁) */
+/* 申请内存(不使用pool->mutex，调用者用它保护自己的数据) */
 void *
 ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 {
     size_t            s;
     uintptr_t         p, n, m, mask, *bitmap;
     ngx_uint_t        i, slot, shift, map;
+    ngx_atomic_t     *lock;
     ngx_slab_page_t  *page, *prev, *slots;
 
 	//如果申请的空间>=ngx_slab_max_size(2048)，则直接申请页面
@@ -210,6 +254,10 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
     ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
                    "slab alloc: %uz slot: %ui", size, slot);
 
+    lock = ngx_slab_slot_lock(pool, slot);
+
+    ngx_slab_lock(lock);
+
     slots = (ngx_slab_page_t *) ((u_char *) pool + sizeof(ngx_slab_pool_t));
     page = slots[slot].next;
 	//第一次分级分配时，page->next与page相同，
@@ -250,7 +298,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
                                      if (bitmap[n] != NGX_SLAB_BUSY) {
                                          p = (uintptr_t) bitmap + i;
 
-                                         goto done;
+                                         goto unlock;
                                      }
                                 }
 
@@ -266,7 +314,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
                             p = (uintptr_t) bitmap + i;
 
-                            goto done;
+                            goto unlock;
                         }
                     }
                 }
@@ -301,7 +349,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
                         p += i << shift;
                         p += (uintptr_t) pool->start;
 
-                        goto done;
+                        goto unlock;
                     }
                 }
 
@@ -343,7 +391,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
                         p += i << shift;//跳过i个块
                         p += (uintptr_t) pool->start;
 
-                        goto done;
+                        goto unlock;
                     }
                 }
 
@@ -391,7 +439,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
             p = ((page - pool->pages) << ngx_pagesize_shift) + s * n;
             p += (uintptr_t) pool->start;
 
-            goto done;
+            goto unlock;
 
         } else if (shift == ngx_slab_exact_shift) {//shift = 6
 
@@ -404,7 +452,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
             p = (page - pool->pages) << ngx_pagesize_shift;
             p += (uintptr_t) pool->start;
 
-            goto done;
+            goto unlock;
 
         } else { /* shift > ngx_slab_exact_shift , shift > 6*/
 
@@ -417,12 +465,16 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
             p = (page - pool->pages) << ngx_pagesize_shift;
             p += (uintptr_t) pool->start;
 
-            goto done;
+            goto unlock;
         }
     }
 
     p = 0;
 
+unlock:
+
+    ngx_slab_unlock(lock);
+
 done:
 
     ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0, "slab alloc: %p", p);
@@ -435,11 +487,19 @@ done:
 void
 ngx_slab_free(ngx_slab_pool_t *pool, void *p)
 {
+#if (NGX_HAVE_ATOMIC_OPS)
+
+    ngx_slab_free_locked(pool, p);
+
+#else
+
     ngx_shmtx_lock(&pool->mutex);
 
     ngx_slab_free_locked(pool, p);
 
     ngx_shmtx_unlock(&pool->mutex);
+
+#endif
 }
 
 /* 释放内存，与ngx_slab_alloc_locked对应 */
@@ -449,9 +509,12 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
     size_t            size;
     uintptr_t         slab, m, *bitmap;
     ngx_uint_t        n, type, slot, shift, map;
+    ngx_atomic_t     *lock;
     ngx_slab_page_t  *slots, *page;
 
     ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0, "slab free: %p", p);
+
+    lock = NULL;
 	//检测释放的内存地址是否有效
     if ((u_char *) p < pool->start || (u_char *) p > pool->end) {
         ngx_slab_error(pool, NGX_LOG_ALERT, "ngx_slab_free(): outside of pool");
@@ -460,9 +523,25 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 	//找到p所在的内存页和页管理结构体
     n = ((u_char *) p - pool->start) >> ngx_pagesize_shift;//页编号
     page = &pool->pages[n];//对应的页管理结构体
-    slab = page->slab;
     type = page->prev & NGX_SLAB_PAGE_MASK;//获取低2bit
 
+	//p所在的页尚未释放，其类型和块大小(slab低4bit)不会被并发修改，
+	//据此找到分级锁后再读取bitmap
+    if (type != NGX_SLAB_PAGE) {
+        shift = (type == NGX_SLAB_EXACT) ? ngx_slab_exact_shift
+                                         : (page->slab & NGX_SLAB_SHIFT_MASK);
+
+        if (shift < pool->min_shift || shift >= ngx_pagesize_shift) {
+            goto wrong_chunk;
+        }
+
+        lock = ngx_slab_slot_lock(pool, shift - pool->min_shift);
+
+        ngx_slab_lock(lock);
+    }
+
+    slab = page->slab;
+
     switch (type) {
 
     case NGX_SLAB_SMALL://小块
@@ -516,9 +595,7 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
                 }
             }
 			
-            ngx_slab_free_pages(pool, page, 1);
-
-            goto done;
+            goto free_page;
         }
 
         goto chunk_already_free;
@@ -552,9 +629,7 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
                 goto done;
             }
 
-            ngx_slab_free_pages(pool, page, 1);
-
-            goto done;
+            goto free_page;
         }
 
         goto chunk_already_free;
@@ -591,9 +666,7 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
                 goto done;
             }
 
-            ngx_slab_free_pages(pool, page, 1);
-
-            goto done;
+            goto free_page;
         }
 
         goto chunk_already_free;
@@ -619,10 +692,10 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
         n = ((u_char *) p - pool->start) >> ngx_pagesize_shift;
         size = slab & ~NGX_SLAB_PAGE_START;//页数
 
-        ngx_slab_free_pages(pool, &pool->pages[n], size);
-
         ngx_slab_junk(p, size << ngx_pagesize_shift);
 
+        ngx_slab_free_pages(pool, &pool->pages[n], size);
+
         return;
     }
 
@@ -634,6 +707,20 @@ done:
 
     ngx_slab_junk(p, size);
 
+    ngx_slab_unlock(lock);
+
+    return;
+
+free_page:
+
+    /* the page may be reused as soon as it is in the free list */
+
+    ngx_slab_junk(p, size);
+
+    ngx_slab_free_pages(pool, page, 1);
+
+    ngx_slab_unlock(lock);
+
     return;
 
 wrong_chunk:
@@ -650,6 +737,10 @@ chunk_already_free:
 
 fail:
 
+    if (lock) {
+        ngx_slab_unlock(lock);
+    }
+
     return;
 }
 
@@ -658,6 +749,9 @@ static ngx_slab_page_t *
 ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
 {
     ngx_slab_page_t  *page, *p;
+
+    ngx_slab_lock(&pool->pages_lock.lock);
+
 	/* 遍历所有空闲页面 */
     for (page = pool->free.next; page != &pool->free; page = page->next) {
 	
@@ -684,6 +778,7 @@ ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
             page->prev = NGX_SLAB_PAGE;//按页分配
 
             if (--pages == 0) {
+                ngx_slab_unlock(&pool->pages_lock.lock);
                 return page;
             }
 			//设置剩余连续页管理结构状态
@@ -694,10 +789,14 @@ ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
                 p++;
             }
 
+            ngx_slab_unlock(&pool->pages_lock.lock);
+
             return page;
         }
     }
 
+    ngx_slab_unlock(&pool->pages_lock.lock);
+
     ngx_slab_error(pool, NGX_LOG_CRIT, "ngx_slab_alloc() failed: no memory");
 
     return NULL;
@@ -716,12 +815,14 @@ ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
         ngx_memzero(&page[1], pages * sizeof(ngx_slab_page_t));
     }
 
-    if (page->next) {
+    if (page->next) {//从slots链中分离，调用者已持有该分级的锁
         prev = (ngx_slab_page_t *) (page->prev & ~NGX_SLAB_PAGE_MASK);//将prev低2bit清0
         prev->next = page->next;
         page->next->prev = page->prev;
     }
 
+    ngx_slab_lock(&pool->pages_lock.lock);
+
 	//将page加入free链的头部
     page->prev = (uintptr_t) &pool->free;
     page->next = pool->free.next;
@@ -729,6 +830,80 @@ ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
     page->next->prev = (uintptr_t) page;
 
     pool->free.next = page;
+
+    ngx_slab_unlock(&pool->pages_lock.lock);
+}
+
+
+/*
+ * 在zone内创建n把互斥锁，供模块按分片加锁；
+ * 登记在pool中，以便worker异常退出时由master强制解锁
+ */
+ngx_shmtx_t *
+ngx_slab_alloc_mutexes(ngx_slab_pool_t *pool, ngx_uint_t n)
+{
+#if (NGX_HAVE_ATOMIC_OPS)
+
+    ngx_uint_t       i;
+    ngx_shmtx_t     *mtx;
+    ngx_shmtx_sh_t  *sh;
+
+    mtx = ngx_slab_alloc(pool, n * (sizeof(ngx_shmtx_t)
+                                    + sizeof(ngx_shmtx_sh_t)));
+    if (mtx == NULL) {
+        return NULL;
+    }
+
+    ngx_memzero(mtx, n * (sizeof(ngx_shmtx_t) + sizeof(ngx_shmtx_sh_t)));
+
+    sh = (ngx_shmtx_sh_t *) &mtx[n];
+
+    for (i = 0; i < n; i++) {
+        if (ngx_shmtx_create(&mtx[i], &sh[i], NULL) != NGX_OK) {
+            return NULL;
+        }
+    }
+
+    pool->mutexes = mtx;
+    pool->nmutexes = n;
+
+    return mtx;
+
+#else
+
+    return NULL;
+
+#endif
+}
+
+
+/* 强制释放异常退出的进程pid所持有的slab锁，返回释放的锁的数目 */
+ngx_uint_t
+ngx_slab_force_unlock(ngx_slab_pool_t *pool, ngx_pid_t pid)
+{
+#if (NGX_HAVE_ATOMIC_OPS)
+
+    ngx_uint_t  i, n;
+
+    n = 0;
+
+    if (ngx_atomic_cmp_set(&pool->pages_lock.lock, pid, 0)) {
+        n++;
+    }
+
+    for (i = 0; i < NGX_SLAB_LOCKS; i++) {
+        if (ngx_atomic_cmp_set(&pool->locks[i].lock, pid, 0)) {
+            n++;
+        }
+    }
+
+    return n;
+
+#else
+
+    return 0;
+
+#endif
 }
 
 
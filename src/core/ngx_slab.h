@@ -28,6 +28,14 @@ struct ngx_slab_page_s {
     uintptr_t         prev;//用低3bit表示分配类型(NGX_SLAB_PAGE,NGX_SLAB_BIG,NGX_SLAB_EXACT,NGX_SLAB_SMALL)
 };
 
+#define NGX_SLAB_LOCKS  16
+
+/* 每个分级一把自旋锁，按cache line对齐，避免不同分级的锁互相干扰 */
+typedef struct {
+    ngx_atomic_t      lock;
+    u_char            pad[NGX_CPU_CACHE_LINE - sizeof(ngx_atomic_t)];
+} ngx_slab_lock_t;
+
 /* slab内存池:对共享内存进一步的内部划分与管理 */
 typedef struct {
     ngx_shmtx_sh_t    lock;
@@ -48,6 +56,12 @@ typedef struct {
 
     void             *data;
     void             *addr;
+
+    ngx_shmtx_t      *mutexes; /* 模块在zone内创建的分片锁 */
+    ngx_uint_t        nmutexes;
+
+    ngx_slab_lock_t   pages_lock; /* 保护空闲页链表 */
+    ngx_slab_lock_t   locks[NGX_SLAB_LOCKS]; /* 保护各分级的slots链及bitmap */
 } ngx_slab_pool_t;
 
 
@@ -56,6 +70,8 @@ void *ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size);
 void ngx_slab_free(ngx_slab_pool_t *pool, void *p);
 void ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p);
+ngx_shmtx_t *ngx_slab_alloc_mutexes(ngx_slab_pool_t *pool, ngx_uint_t n);
+ngx_uint_t ngx_slab_force_unlock(ngx_slab_pool_t *pool, ngx_pid_t pid);
 
 
 #endif /* _NGX_SLAB_H_INCLUDED_ */
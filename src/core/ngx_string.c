@@ -8,11 +8,21 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 
+#if (NGX_HAVE_SSE2)
+#include <emmintrin.h>
+#endif
+
 
 static u_char *ngx_sprintf_num(u_char *buf, u_char *last, uint64_t ui64,
     u_char zero, ngx_uint_t hexadecimal, ngx_uint_t width);
 static ngx_int_t ngx_decode_base64_internal(ngx_str_t *dst, ngx_str_t *src,
     const u_char *basis);
+#if (NGX_HAVE_SSE2)
+static ngx_inline size_t ngx_escape_uri_safe(u_char *dst, u_char *src,
+    size_t size, ngx_uint_t slash);
+static ngx_inline size_t ngx_unescape_uri_usual(u_char *dst, u_char *src,
+    size_t size, ngx_uint_t args);
+#endif
 
 
 void
@@ -1342,6 +1352,11 @@ ngx_escape_uri(u_char *dst, u_char *src, size_t size, ngx_uint_t type)
 {
     ngx_uint_t      n;
     uint32_t       *escape;
+#if (NGX_HAVE_SSE2)
+    size_t          len;
+    u_char         *next;
+    ngx_uint_t      slash;
+#endif
     static u_char   hex[] = "0123456789abcdef";
 
                     /* " ", "#", "%", "?", %00-%1F, %7F-%FF */
@@ -1472,6 +1487,17 @@ ngx_escape_uri(u_char *dst, u_char *src, size_t size, ngx_uint_t type)
 
     escape = map[type];
 
+#if (NGX_HAVE_SSE2)
+    slash = (escape['/' >> 5] & (1 << ('/' & 0x1f))) ? 0 : 1;
+
+    /*
+     * the runs are mostly short, so a run is looked for at most once
+     * in 16 bytes, otherwise the scan costs more than it saves
+     */
+
+    next = src;
+#endif
+
     if (dst == NULL) {
 
         /* find the number of the characters to be escaped */
@@ -1481,6 +1507,14 @@ ngx_escape_uri(u_char *dst, u_char *src, size_t size, ngx_uint_t type)
         while (size) {
             if (escape[*src >> 5] & (1 << (*src & 0x1f))) {
                 n++;
+
+#if (NGX_HAVE_SSE2)
+            } else if (src >= next) {
+                len = ngx_escape_uri_safe(NULL, src + 1, size - 1, slash);
+                src += len;
+                size -= len;
+                next = src + 16;
+#endif
             }
             src++;
             size--;
@@ -1498,6 +1532,16 @@ ngx_escape_uri(u_char *dst, u_char *src, size_t size, ngx_uint_t type)
 
         } else {
             *dst++ = *src++;
+
+#if (NGX_HAVE_SSE2)
+            if (src >= next) {
+                len = ngx_escape_uri_safe(dst, src, size - 1, slash);
+                dst += len;
+                src += len;
+                size -= len;
+                next = src + 16;
+            }
+#endif
         }
         size--;
     }
@@ -1510,6 +1554,9 @@ void
 ngx_unescape_uri(u_char **dst, u_char **src, size_t size, ngx_uint_t type)
 {
     u_char  *d, *s, ch, c, decoded;
+#if (NGX_HAVE_SSE2)
+    size_t   n;
+#endif
     enum {
         sw_usual = 0,
         sw_quoted,
@@ -1541,6 +1588,15 @@ ngx_unescape_uri(u_char **dst, u_char **src, size_t size, ngx_uint_t type)
             }
 
             *d++ = ch;
+
+#if (NGX_HAVE_SSE2)
+            n = ngx_unescape_uri_usual(d, s, size,
+                                       type & (NGX_UNESCAPE_URI
+                                               |NGX_UNESCAPE_REDIRECT));
+            d += n;
+            s += n;
+            size -= n;
+#endif
             break;
 
         case sw_quoted:
@@ -1636,6 +1692,105 @@ done:
 }
 
 
+#if (NGX_HAVE_SSE2)
+
+/*
+ * returns the length of the leading run of ALPHA, DIGIT, "-", "." and "_",
+ * and of "/" if it is not escaped, these are never escaped by any of the
+ * ngx_escape_uri() maps; 16 bytes are tested at once and a tail shorter
+ * than 16 bytes is left to the caller
+ *
+ * if "dst" is set, the run is copied there by whole blocks: the escaped
+ * string is not shorter than the rest of the source, so the bytes stored
+ * after the run fit and are overwritten later
+ */
+
+static ngx_inline size_t
+ngx_escape_uri_safe(u_char *dst, u_char *src, size_t size, ngx_uint_t slash)
+{
+    size_t    len;
+    unsigned  m;
+    __m128i   v, lo, sl;
+
+    len = 0;
+    sl = slash ? _mm_set1_epi8('/') : _mm_set1_epi8('-');
+
+    while (size - len >= 16) {
+        v = _mm_loadu_si128((__m128i *) (src + len));
+
+        /* 比较是有符号的, 0x80 以上的字节都不会落在区间内 */
+        lo = _mm_or_si128(v, _mm_set1_epi8(0x20));
+
+        m = _mm_movemask_epi8(
+                _mm_or_si128(
+                    _mm_or_si128(
+                        _mm_and_si128(
+                            _mm_cmpgt_epi8(lo, _mm_set1_epi8('a' - 1)),
+                            _mm_cmplt_epi8(lo, _mm_set1_epi8('z' + 1))),
+                        _mm_and_si128(
+                            _mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                            _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)))),
+                    _mm_or_si128(
+                        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('-')),
+                                     _mm_cmpeq_epi8(v, _mm_set1_epi8('.'))),
+                        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('_')),
+                                     _mm_cmpeq_epi8(v, sl)))));
+
+        if (dst) {
+            _mm_storeu_si128((__m128i *) (dst + len), v);
+        }
+
+        if (m != 0xffff) {
+            return len + __builtin_ctz(~m);
+        }
+
+        len += 16;
+    }
+
+    return len;
+}
+
+
+/*
+ * copies the leading run of bytes without "%" and, if "args" is set,
+ * without "?"; the copy may be done in place, therefore only whole
+ * blocks are stored with one instruction
+ */
+
+static ngx_inline size_t
+ngx_unescape_uri_usual(u_char *dst, u_char *src, size_t size, ngx_uint_t args)
+{
+    size_t    len;
+    unsigned  m, n;
+    __m128i   v, q;
+
+    len = 0;
+    q = args ? _mm_set1_epi8('?') : _mm_set1_epi8('%');
+
+    while (size - len >= 16) {
+        v = _mm_loadu_si128((__m128i *) (src + len));
+
+        m = _mm_movemask_epi8(
+                _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('%')),
+                             _mm_cmpeq_epi8(v, q)));
+
+        if (m) {
+            n = __builtin_ctz(m);
+            ngx_movemem(dst + len, src + len, n);
+            return len + n;
+        }
+
+        _mm_storeu_si128((__m128i *) (dst + len), v);
+
+        len += 16;
+    }
+
+    return len;
+}
+
+#endif
+
+
 uintptr_t
 ngx_escape_html(u_char *dst, u_char *src, size_t size)
 {
@@ -1708,6 +1863,95 @@ ngx_escape_html(u_char *dst, u_char *src, size_t size)
 }
 
 
+uintptr_t
+ngx_escape_json(u_char *dst, u_char *src, size_t size)
+{
+    u_char      ch;
+    ngx_uint_t  len;
+
+    if (dst == NULL) {
+        len = 0;
+
+        while (size) {
+            ch = *src++;
+
+            if (ch == '\\' || ch == '"') {
+                len++;
+
+            } else if (ch <= 0x1f) {
+
+                switch (ch) {
+                case '\n':
+                case '\r':
+                case '\t':
+                case '\b':
+                case '\f':
+                    len++;
+                    break;
+
+                default:
+                    len += sizeof("00e0") - 1;
+                }
+            }
+
+            size--;
+        }
+
+        return (uintptr_t) len;
+    }
+
+    while (size) {
+        ch = *src++;
+
+        if (ch > 0x1f) {
+
+            if (ch == '\\' || ch == '"') {
+                *dst++ = '\\';
+            }
+
+            *dst++ = ch;
+
+        } else {
+            *dst++ = '\\';
+
+            switch (ch) {
+            case '\n':
+                *dst++ = 'n';
+                break;
+
+            case '\r':
+                *dst++ = 'r';
+                break;
+
+            case '\t':
+                *dst++ = 't';
+                break;
+
+            case '\b':
+                *dst++ = 'b';
+                break;
+
+            case '\f':
+                *dst++ = 'f';
+                break;
+
+            default:
+                *dst++ = 'u'; *dst++ = '0'; *dst++ = '0';
+                *dst++ = '0' + (ch >> 4);
+
+                ch &= 0xf;
+
+                *dst++ = (ch < 10) ? ('0' + ch) : ('a' + ch - 10);
+            }
+        }
+
+        size--;
+    }
+
+    return (uintptr_t) dst;
+}
+
+
 void
 ngx_str_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
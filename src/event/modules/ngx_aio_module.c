@@ -51,7 +51,10 @@ ngx_event_module_t  ngx_aio_module_ctx = {
         NULL,                              /* process the changes */
         ngx_aio_process_events,            /* process the events */
         ngx_aio_init,                      /* init the events */
-        ngx_aio_done                       /* done the events */
+        ngx_aio_done,                      /* done the events */
+#if (NGX_THREAD_POOL)
+        NULL,                              /* trigger a notify */
+#endif
     }
 
 };
@@ -92,6 +92,9 @@ ngx_event_module_t  ngx_devpoll_module_ctx = {
         ngx_devpoll_process_events,        /* process the events */
         ngx_devpoll_init,                  /* init the events */
         ngx_devpoll_done,                  /* done the events */
+#if (NGX_THREAD_POOL)
+        NULL,                              /* trigger a notify */
+#endif
     }
 
 };
@@ -145,6 +145,9 @@ ngx_event_module_t  ngx_eventport_module_ctx = {
         ngx_eventport_process_events,      /* process the events */
         ngx_eventport_init,                /* init the events */
         ngx_eventport_done,                /* done the events */
+#if (NGX_THREAD_POOL)
+        NULL,                              /* trigger a notify */
+#endif
     }
 
 };
@@ -92,7 +92,10 @@ ngx_event_module_t  ngx_kqueue_module_ctx = {
         ngx_kqueue_process_changes,        /* process the changes */
         ngx_kqueue_process_events,         /* process the events */
         ngx_kqueue_init,                   /* init the events */
-        ngx_kqueue_done                    /* done the events */
+        ngx_kqueue_done,                   /* done the events */
+#if (NGX_THREAD_POOL)
+        NULL,                              /* trigger a notify */
+#endif
     }
 
 };
@@ -42,7 +42,10 @@ ngx_event_module_t  ngx_poll_module_ctx = {
         NULL,                              /* process the changes */
         ngx_poll_process_events,           /* process the events */
         ngx_poll_init,                     /* init the events */
-        ngx_poll_done                      /* done the events */
+        ngx_poll_done,                     /* done the events */
+#if (NGX_THREAD_POOL)
+        NULL,                              /* trigger a notify */
+#endif
     }
 
 };
@@ -122,6 +122,9 @@ ngx_event_module_t  ngx_rtsig_module_ctx = {
         ngx_rtsig_process_events,        /* process the events */
         ngx_rtsig_init,                  /* init the events */
         ngx_rtsig_done,                  /* done the events */
+#if (NGX_THREAD_POOL)
+        NULL,                            /* trigger a notify */
+#endif
     }
 
 };
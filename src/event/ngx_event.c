@@ -29,6 +29,8 @@ static char *ngx_events_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_event_connections(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_event_use(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_event_multi_accept(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static char *ngx_event_debug_connection(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 
@@ -61,18 +63,12 @@ ngx_file_t            ngx_accept_mutex_lock_file;
 
 #if (NGX_STAT_STUB)
 
-ngx_atomic_t   ngx_stat_accepted0;
-ngx_atomic_t  *ngx_stat_accepted = &ngx_stat_accepted0;
-ngx_atomic_t   ngx_stat_handled0;
-ngx_atomic_t  *ngx_stat_handled = &ngx_stat_handled0;
-ngx_atomic_t   ngx_stat_requests0;
-ngx_atomic_t  *ngx_stat_requests = &ngx_stat_requests0;
-ngx_atomic_t   ngx_stat_active0;
-ngx_atomic_t  *ngx_stat_active = &ngx_stat_active0;
-ngx_atomic_t   ngx_stat_reading0;
-ngx_atomic_t  *ngx_stat_reading = &ngx_stat_reading0;
-ngx_atomic_t   ngx_stat_writing0;
-ngx_atomic_t  *ngx_stat_writing = &ngx_stat_writing0;
+static ngx_stat_t   ngx_stat0;
+ngx_stat_t         *ngx_stat = &ngx_stat0;
+
+/* NGX_MAX_PROCESSES组计数器，每组占ngx_stats_size字节 */
+static u_char      *ngx_stats;
+static size_t       ngx_stats_size;
 
 #endif
 
@@ -139,12 +135,12 @@ static ngx_command_t  ngx_event_core_commands[] = {
       0,
       0,
       NULL },
-	/*尽可能接受多个连接*/
+	/*尽可能接受多个连接，参数为数字时表示一次最多接受的连接数*/
     { ngx_string("multi_accept"),
-      NGX_EVENT_CONF|NGX_CONF_FLAG,
-      ngx_conf_set_flag_slot,
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_event_multi_accept,
+      0,
       0,
-      offsetof(ngx_event_conf_t, multi_accept),
       NULL },
 	/*确定是否使用accept_mutex负载均衡锁，默认是开启*/
     { ngx_string("accept_mutex"),
@@ -161,6 +157,14 @@ static ngx_command_t  ngx_event_core_commands[] = {
       offsetof(ngx_event_conf_t, accept_mutex_delay),
       NULL },
 	/*对指定的IP打印Debug调试信息*/
+	/*定时器使用分层时间轮，插入和删除的复杂度为O(1)*/
+    { ngx_string("timer_wheel"),
+      NGX_EVENT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_event_conf_t, timer_wheel),
+      NULL },
+
     { ngx_string("debug_connection"),
       NGX_EVENT_CONF|NGX_CONF_TAKE1,
       ngx_event_debug_connection,
@@ -177,7 +181,11 @@ ngx_event_module_t  ngx_event_core_module_ctx = {
     ngx_event_core_create_conf,            /* create configuration */
     ngx_event_core_init_conf,              /* init configuration */
 
-    { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL }
+    { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL
+#if (NGX_THREAD_POOL)
+      , NULL
+#endif
+    }
 };
 
 
@@ -518,12 +526,7 @@ ngx_event_module_init(ngx_cycle_t *cycle)
 
 #if (NGX_STAT_STUB)
 
-    size += cl           /* ngx_stat_accepted */
-           + cl          /* ngx_stat_handled */
-           + cl          /* ngx_stat_requests */
-           + cl          /* ngx_stat_active */
-           + cl          /* ngx_stat_reading */
-           + cl;         /* ngx_stat_writing */
+    size += NGX_MAX_PROCESSES * cl;  /* ngx_stats */
 
 #endif
 
@@ -564,12 +567,8 @@ ngx_event_module_init(ngx_cycle_t *cycle)
 
 #if (NGX_STAT_STUB)
 
-    ngx_stat_accepted = (ngx_atomic_t *) (shared + 3 * cl);
-    ngx_stat_handled = (ngx_atomic_t *) (shared + 4 * cl);
-    ngx_stat_requests = (ngx_atomic_t *) (shared + 5 * cl);
-    ngx_stat_active = (ngx_atomic_t *) (shared + 6 * cl);
-    ngx_stat_reading = (ngx_atomic_t *) (shared + 7 * cl);
-    ngx_stat_writing = (ngx_atomic_t *) (shared + 8 * cl);
+    ngx_stats = shared + 3 * cl;
+    ngx_stats_size = cl;
 
 #endif
 
@@ -577,6 +576,58 @@ ngx_event_module_init(ngx_cycle_t *cycle)
 }
 
 
+#if (NGX_STAT_STUB)
+
+/* 累加所有进程的计数器 */
+void
+ngx_stat_sum(ngx_stat_t *st)
+{
+    ngx_uint_t   i;
+    ngx_stat_t  *s;
+
+    if (ngx_stats == NULL) {
+        ngx_memcpy(st, ngx_stat, sizeof(ngx_stat_t));
+        return;
+    }
+
+    ngx_memzero(st, sizeof(ngx_stat_t));
+
+    for (i = 0; i < NGX_MAX_PROCESSES; i++) {
+        s = (ngx_stat_t *) (ngx_stats + i * ngx_stats_size);
+
+        st->accepted += s->accepted;
+        st->handled += s->handled;
+        st->requests += s->requests;
+        st->active += s->active;
+        st->reading += s->reading;
+        st->writing += s->writing;
+    }
+}
+
+
+/*
+ * 主进程回收子进程时调用：进程的连接已随它关闭，清零它的连接数，
+ * 累计的计数保留在slot中
+ */
+void
+ngx_stat_reset(ngx_int_t slot)
+{
+    ngx_stat_t  *s;
+
+    if (ngx_stats == NULL) {
+        return;
+    }
+
+    s = (ngx_stat_t *) (ngx_stats + slot * ngx_stats_size);
+
+    s->active = 0;
+    s->reading = 0;
+    s->writing = 0;
+}
+
+#endif
+
+
 #if !(NGX_WIN32)
 /*定时器超时的处理函数*/
 void
@@ -616,12 +667,29 @@ ngx_event_process_init(ngx_cycle_t *cycle)
         ngx_use_accept_mutex = 0;
     }
 
+#if (NGX_STAT_STUB)
+
+    if (ngx_stats) {
+        ngx_stat = (ngx_stat_t *) (ngx_stats
+                                   + ngx_process_slot * ngx_stats_size);
+
+        /* 此前使用该slot的进程已退出，它的连接已不存在 */
+
+        ngx_stat->active = 0;
+        ngx_stat->reading = 0;
+        ngx_stat->writing = 0;
+    }
+
+#endif
+
 #if (NGX_THREADS)
     ngx_posted_events_mutex = ngx_mutex_init(cycle->log, 0);
     if (ngx_posted_events_mutex == NULL) {
         return NGX_ERROR;
     }
 #endif
+    ngx_event_timer_use_wheel = ecf->timer_wheel;
+
 	//初始化定时器红黑树ngx_event_timer_rbtree
     if (ngx_event_timer_init(cycle->log) == NGX_ERROR) {
         return NGX_ERROR;
@@ -758,6 +826,13 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 	//设置监听端口事的读事件的处理函数ngx_event_accept
     ls = cycle->listening.elts;
     for (i = 0; i < cycle->listening.nelts; i++) {
+
+#if (NGX_HAVE_REUSEPORT)
+        /*reuseport的套接字只由其所属的worker进程处理*/
+        if (ls[i].reuseport && ls[i].worker != ngx_worker) {
+            continue;
+        }
+#endif
 		/*获取一个空闲连接*/
         c = ngx_get_connection(ls[i].fd, cycle->log);
 
@@ -780,7 +855,7 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 #endif
 
         if (!(ngx_event_flags & NGX_USE_IOCP_EVENT)) {
-            if (ls[i].previous) {
+            if (ls[i].previous && ls[i].previous->connection) {
 
                 /*
                  * delete the old accept events that were bound to
@@ -839,6 +914,17 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 
         rev->handler = ngx_event_accept;/*设置监听套接字的读事件处理函数*/
 
+#if (NGX_HAVE_REUSEPORT)
+        /*每个worker独占的套接字不受accept_mutex控制*/
+        if (ls[i].reuseport) {
+            if (ngx_add_event(rev, NGX_READ_EVENT, 0) == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            continue;
+        }
+#endif
+
 		/*如果使用了accept_mutex互斥锁，不会立即将监听套接字加入到事件机制中*/
 		/*而是在之后哪个worker进程拥有互斥锁，它就将监听套接字加入到事件机制中(猜测)？*/
         if (ngx_use_accept_mutex) {
@@ -1009,6 +1095,50 @@ ngx_event_connections(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_event_multi_accept(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_event_conf_t  *ecf = conf;
+
+    ngx_int_t   n;
+    ngx_str_t  *value;
+
+    if (ecf->multi_accept != NGX_CONF_UNSET) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcasecmp(value[1].data, (u_char *) "on") == 0) {
+        ecf->multi_accept = 1;
+        ecf->accept_batch = 0;
+
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strcasecmp(value[1].data, (u_char *) "off") == 0) {
+        ecf->multi_accept = 0;
+        ecf->accept_batch = 0;
+
+        return NGX_CONF_OK;
+    }
+
+    n = ngx_atoi(value[1].data, value[1].len);
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive, "
+                           "it must be \"on\", \"off\" or a number",
+                           &value[1], &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    ecf->multi_accept = (n > 1);
+    ecf->accept_batch = n;
+
+    return NGX_CONF_OK;
+}
+
+
 static char *
 ngx_event_use(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -1152,8 +1282,10 @@ ngx_event_core_create_conf(ngx_cycle_t *cycle)
     ecf->connections = NGX_CONF_UNSET_UINT;
     ecf->use = NGX_CONF_UNSET_UINT;
     ecf->multi_accept = NGX_CONF_UNSET;
+    ecf->accept_batch = NGX_CONF_UNSET_UINT;
     ecf->accept_mutex = NGX_CONF_UNSET;
     ecf->accept_mutex_delay = NGX_CONF_UNSET_MSEC;
+    ecf->timer_wheel = NGX_CONF_UNSET;
     ecf->name = (void *) NGX_CONF_UNSET;
 
 #if (NGX_DEBUG)
@@ -1267,8 +1399,10 @@ ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_conf_init_ptr_value(ecf->name, event_module->name->data);
 
     ngx_conf_init_value(ecf->multi_accept, 0);
+    ngx_conf_init_uint_value(ecf->accept_batch, 0);
     ngx_conf_init_value(ecf->accept_mutex, 1);
     ngx_conf_init_msec_value(ecf->accept_mutex_delay, 500);
+    ngx_conf_init_value(ecf->timer_wheel, 0);
 
 
 #if (NGX_HAVE_RTSIG)
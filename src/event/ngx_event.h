@@ -66,6 +66,7 @@ struct ngx_event_s {
 
     unsigned         timedout:1;//事件是否已超时
     unsigned         timer_set:1;//事件是否存在定时器中
+    unsigned         cancelable:1;//退出时无需等待该定时器到期
 
     unsigned         delayed:1;//事件是否需要延迟处理
 
@@ -249,6 +250,10 @@ typedef struct {
     ngx_int_t  (*init)(ngx_cycle_t *cycle, ngx_msec_t timer);
 	//退出事件模块时调用
     void       (*done)(ngx_cycle_t *cycle);
+#if (NGX_THREAD_POOL)
+	//唤醒事件循环，由线程池的工作线程调用
+    ngx_int_t  (*notify)(ngx_event_handler_pt handler);
+#endif
 } ngx_event_actions_t;
 
 
@@ -455,6 +460,10 @@ extern ngx_event_actions_t   ngx_event_actions;
 #define ngx_process_events   ngx_event_actions.process_events
 #define ngx_done_events      ngx_event_actions.done
 
+#if (NGX_THREAD_POOL)
+#define ngx_notify           ngx_event_actions.notify
+#endif
+
 #define ngx_add_event        ngx_event_actions.add
 #define ngx_del_event        ngx_event_actions.del
 #define ngx_add_conn         ngx_event_actions.add_conn
@@ -482,10 +491,13 @@ typedef struct {
     ngx_uint_t    use;//使用的事件模型，usr配置项，参数有epoll,select,poll,/dev/poll,kqueue,rtsig,eventport
 
     ngx_flag_t    multi_accept;//为1表示worker进程接收尽可能多的新连接，multi_accept配置项
+    ngx_uint_t    accept_batch;//一次accept事件最多建立的新连接数，0表示不限制
     ngx_flag_t    accept_mutex;//实现负载均衡，实现轮流处理连接。accept_mutex配置项
 
     ngx_msec_t    accept_mutex_delay;//在获取accept锁失败后，worker进程从新开始接收新连接的最大间隔时间。
 
+    ngx_flag_t    timer_wheel;//为1表示定时器使用时间轮而不是红黑树，timer_wheel配置项
+
     u_char       *name;//事件模型名称(epoll,select,poll,/dev/poll,kqueue,rtsig,eventport)
 
 #if (NGX_DEBUG)
@@ -518,12 +530,24 @@ extern ngx_int_t              ngx_accept_disabled;
 
 #if (NGX_STAT_STUB)
 
-extern ngx_atomic_t  *ngx_stat_accepted;
-extern ngx_atomic_t  *ngx_stat_handled;
-extern ngx_atomic_t  *ngx_stat_requests;
-extern ngx_atomic_t  *ngx_stat_active;
-extern ngx_atomic_t  *ngx_stat_reading;
-extern ngx_atomic_t  *ngx_stat_writing;
+/*
+ * 每个进程(按ngx_process_slot)在共享内存中有一组独占cache line的计数器，
+ * 只由该进程自己修改，不需要原子操作；读取时由ngx_stat_sum()累加
+ */
+typedef struct {
+    ngx_atomic_t   accepted;
+    ngx_atomic_t   handled;
+    ngx_atomic_t   requests;
+    ngx_atomic_t   active;
+    ngx_atomic_t   reading;
+    ngx_atomic_t   writing;
+} ngx_stat_t;
+
+
+extern ngx_stat_t    *ngx_stat;
+
+void ngx_stat_sum(ngx_stat_t *st);
+void ngx_stat_reset(ngx_int_t slot);
 
 #endif
 
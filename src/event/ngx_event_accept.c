@@ -24,6 +24,7 @@ ngx_event_accept(ngx_event_t *ev)
 {
     socklen_t          socklen;
     ngx_err_t          err;
+    ngx_uint_t         accepted;
     ngx_log_t         *log;
     ngx_socket_t       s;
     ngx_event_t       *rev, *wev;
@@ -51,13 +52,15 @@ ngx_event_accept(ngx_event_t *ev)
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
                    "accept on %V, ready: %d", &ls->addr_text, ev->available);
 
+    accepted = 0;
+
     do {
         socklen = NGX_SOCKADDRLEN;
 		//接收客户端请求，建立连接
 #if (NGX_HAVE_ACCEPT4)
         if (use_accept4) {
             s = accept4(lc->fd, (struct sockaddr *) sa, &socklen,
-                        SOCK_NONBLOCK);
+                        SOCK_NONBLOCK|SOCK_CLOEXEC);
         } else {
             s = accept(lc->fd, (struct sockaddr *) sa, &socklen);
         }
@@ -105,7 +108,7 @@ ngx_event_accept(ngx_event_t *ev)
         }
 
 #if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_accepted, 1);
+        ngx_stat->accepted++;
 #endif
 		/* 连接数阈值（用于负载均衡）
 		 * 初始时，没有任何连接，ngx_accept_disabled为(-ngx_cycle->connection_n * 7 / 8)
@@ -126,7 +129,7 @@ ngx_event_accept(ngx_event_t *ev)
         }
 
 #if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_active, 1);
+        ngx_stat->active++;
 #endif
 		//为连接对象的创建内存池
         c->pool = ngx_create_pool(ls->pool_size, ev->log);
@@ -231,7 +234,7 @@ ngx_event_accept(ngx_event_t *ev)
         c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
 
 #if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_handled, 1);
+        ngx_stat->handled++;
 #endif
 
 #if (NGX_THREADS)
@@ -294,6 +297,20 @@ ngx_event_accept(ngx_event_t *ev)
             ev->available--;
         }
 
+        /*
+         * the batch is bounded by multi_accept's number and by the free
+         * connections: the rest stay in the listen queue until the next
+         * event instead of being accepted only to be closed
+         */
+
+        if (ecf->accept_batch && ++accepted >= ecf->accept_batch) {
+            break;
+        }
+
+        if (ngx_cycle->free_connection_n == 0) {
+            break;
+        }
+
     } while (ev->available);//如果ev->available>0，表示还可以建立连接
 }
 
@@ -364,6 +381,10 @@ ngx_enable_accept_events(ngx_cycle_t *cycle)
 
         c = ls[i].connection;
 
+        if (c == NULL || c->read->active) {
+            continue;
+        }
+
         if (ngx_event_flags & NGX_USE_RTSIG_EVENT) {
 
             if (ngx_add_conn(c) == NGX_ERROR) {
@@ -397,10 +418,20 @@ ngx_disable_accept_events(ngx_cycle_t *cycle)
 
         c = ls[i].connection;
 
-        if (!c->read->active) {
+        if (c == NULL || !c->read->active) {
             continue;
         }
 
+#if (NGX_HAVE_REUSEPORT)
+
+        /* the worker's own "reuseport" sockets are not under accept mutex */
+
+        if (ls[i].reuseport) {
+            continue;
+        }
+
+#endif
+
         if (ngx_event_flags & NGX_USE_RTSIG_EVENT) {
             if (ngx_del_conn(c, NGX_DISABLE_EVENT) == NGX_ERROR) {
                 return NGX_ERROR;
@@ -439,7 +470,7 @@ ngx_close_accepted_connection(ngx_connection_t *c)
     }
 
 #if (NGX_STAT_STUB)
-    (void) ngx_atomic_fetch_add(ngx_stat_active, -1);
+    ngx_stat->active--;
 #endif
 }
 
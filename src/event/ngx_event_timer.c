@@ -18,6 +18,20 @@ ngx_mutex_t  *ngx_event_timer_mutex;
 ngx_thread_volatile ngx_rbtree_t  ngx_event_timer_rbtree;
 static ngx_rbtree_node_t          ngx_event_timer_sentinel;
 
+ngx_event_timer_wheel_t           ngx_event_timer_wheel;
+ngx_uint_t                        ngx_event_timer_use_wheel;
+
+
+static ngx_msec_t ngx_event_find_wheel_timer(void);
+static void ngx_event_expire_wheel_timers(void);
+static void ngx_event_cancel_wheel_timers(void);
+static void ngx_event_timer_wheel_link(ngx_rbtree_node_t *node);
+static void ngx_event_timer_wheel_unlink(ngx_rbtree_node_t *node);
+static void ngx_event_timer_wheel_cascade(ngx_rbtree_node_t *head);
+static ngx_uint_t ngx_event_timer_wheel_next(ngx_event_timer_wheel_t *wheel,
+    ngx_uint_t i);
+
+
 /*
  * the event timer rbtree may contain the duplicate keys, however,
  * it should not be a problem, because we use the rbtree to find
@@ -31,10 +45,38 @@ static ngx_rbtree_node_t          ngx_event_timer_sentinel;
 ngx_int_t
 ngx_event_timer_init(ngx_log_t *log)
 {
+    ngx_uint_t                i, n;
+    ngx_rbtree_node_t        *head;
+    ngx_event_timer_wheel_t  *wheel;
+
 	//初始化红黑树ngx_event_timer_rbtree
     ngx_rbtree_init(&ngx_event_timer_rbtree, &ngx_event_timer_sentinel,
                     ngx_rbtree_insert_timer_value);
 
+    if (ngx_event_timer_use_wheel) {
+        wheel = &ngx_event_timer_wheel;
+
+        for (i = 0; i < NGX_TIMER_WHEEL_ROOT_SIZE; i++) {
+            head = &wheel->root[i];
+            head->left = head;
+            head->right = head;
+        }
+
+        for (n = 0; n < NGX_TIMER_WHEEL_LEVELS; n++) {
+            for (i = 0; i < NGX_TIMER_WHEEL_LEVEL_SIZE; i++) {
+                head = &wheel->level[n][i];
+                head->left = head;
+                head->right = head;
+            }
+        }
+
+        ngx_memzero(wheel->bitmap, sizeof(wheel->bitmap));
+
+        wheel->current = ngx_current_msec;
+        wheel->count = 0;
+        wheel->cancelable = 0;
+    }
+
 #if (NGX_THREADS)
 
     if (ngx_event_timer_mutex) {
@@ -62,6 +104,10 @@ ngx_event_find_timer(void)
     ngx_msec_int_t      timer;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_use_wheel) {
+        return ngx_event_find_wheel_timer();
+    }
+
     if (ngx_event_timer_rbtree.root == &ngx_event_timer_sentinel) {
         return NGX_TIMER_INFINITE;
     }
@@ -90,6 +136,11 @@ ngx_event_expire_timers(void)
     ngx_event_t        *ev;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_use_wheel) {
+        ngx_event_expire_wheel_timers();
+        return;
+    }
+
     sentinel = ngx_event_timer_rbtree.sentinel;
 
     for ( ;; ) {
@@ -168,3 +219,500 @@ ngx_event_expire_timers(void)
 
     ngx_mutex_unlock(ngx_event_timer_mutex);
 }
+
+
+/*
+ * a gracefully exiting worker waits for all timers to expire, the timers
+ * of periodic tasks are marked "cancelable" and their handlers are called
+ * at once; the handlers must check ngx_exiting and not set timers again
+ */
+
+void
+ngx_event_cancel_timers(void)
+{
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *node, *root, *sentinel;
+
+    if (ngx_event_timer_use_wheel) {
+        ngx_event_cancel_wheel_timers();
+        return;
+    }
+
+    sentinel = ngx_event_timer_rbtree.sentinel;
+
+    for ( ;; ) {
+        root = ngx_event_timer_rbtree.root;
+
+        if (root == sentinel) {
+            return;
+        }
+
+        node = ngx_rbtree_min(root, sentinel);
+
+        ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+        /* the rest are cancelled when the earlier timers will expire */
+
+        if (!ev->cancelable) {
+            return;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "event timer cancel: %d: %M",
+                       ngx_event_ident(ev->data), ev->timer.key);
+
+        ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
+
+#if (NGX_DEBUG)
+        ev->timer.left = NULL;
+        ev->timer.right = NULL;
+        ev->timer.parent = NULL;
+#endif
+
+        ev->timer_set = 0;
+
+        ev->handler(ev);
+    }
+}
+
+
+/*
+ * the node's "data" remembers whether the timer was counted as cancelable
+ * when it was inserted, so the counter stays balanced even if the event's
+ * flag is changed while the timer is set
+ */
+
+void
+ngx_event_timer_wheel_insert(ngx_rbtree_node_t *node)
+{
+    ngx_event_t  *ev;
+
+    ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+    node->data = ev->cancelable ? 1 : 0;
+
+    ngx_event_timer_wheel_link(node);
+
+    ngx_event_timer_wheel.count++;
+    ngx_event_timer_wheel.cancelable += node->data;
+}
+
+
+void
+ngx_event_timer_wheel_delete(ngx_rbtree_node_t *node)
+{
+    ngx_event_timer_wheel_unlink(node);
+
+    ngx_event_timer_wheel.count--;
+    ngx_event_timer_wheel.cancelable -= node->data;
+}
+
+
+static void
+ngx_event_timer_wheel_link(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t                n, i, shift;
+    ngx_msec_t                key;
+    ngx_msec_int_t            diff;
+    ngx_rbtree_node_t        *head;
+    ngx_event_timer_wheel_t  *wheel;
+
+    wheel = &ngx_event_timer_wheel;
+
+    key = node->key;
+    diff = (ngx_msec_int_t) (key - wheel->current);
+
+    if (diff < NGX_TIMER_WHEEL_ROOT_SIZE) {
+
+        /* the already expired timers go to the current slot */
+
+        if (diff < 0) {
+            key = wheel->current;
+        }
+
+        i = key & NGX_TIMER_WHEEL_ROOT_MASK;
+        head = &wheel->root[i];
+
+        wheel->bitmap[i / NGX_TIMER_WHEEL_BITMAP_BITS]
+                        |= (ngx_uint_t) 1 << (i % NGX_TIMER_WHEEL_BITMAP_BITS);
+
+    } else {
+
+        shift = NGX_TIMER_WHEEL_ROOT_BITS;
+
+        for (n = 0; n < NGX_TIMER_WHEEL_LEVELS; n++) {
+            if ((diff >> shift) < NGX_TIMER_WHEEL_LEVEL_SIZE) {
+                break;
+            }
+
+            shift += NGX_TIMER_WHEEL_LEVEL_BITS;
+        }
+
+        if (n == NGX_TIMER_WHEEL_LEVELS) {
+
+            /*
+             * a timer beyond the wheel is placed to the farthest slot
+             * and will be cascaded there again until it fits the wheel
+             */
+
+            n--;
+            shift -= NGX_TIMER_WHEEL_LEVEL_BITS;
+            key = wheel->current
+                  + ((ngx_msec_t) NGX_TIMER_WHEEL_LEVEL_MASK << shift);
+        }
+
+        i = (key >> shift) & NGX_TIMER_WHEEL_LEVEL_MASK;
+        head = &wheel->level[n][i];
+    }
+
+    node->parent = head;
+    node->right = head;
+    node->left = head->left;
+    head->left->right = node;
+    head->left = node;
+}
+
+
+static void
+ngx_event_timer_wheel_unlink(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t                i;
+    ngx_rbtree_node_t        *head;
+    ngx_event_timer_wheel_t  *wheel;
+
+    wheel = &ngx_event_timer_wheel;
+
+    head = node->parent;
+
+    node->left->right = node->right;
+    node->right->left = node->left;
+
+    if (head->right == head
+        && head >= wheel->root
+        && head < wheel->root + NGX_TIMER_WHEEL_ROOT_SIZE)
+    {
+        i = head - wheel->root;
+
+        wheel->bitmap[i / NGX_TIMER_WHEEL_BITMAP_BITS]
+                     &= ~((ngx_uint_t) 1 << (i % NGX_TIMER_WHEEL_BITMAP_BITS));
+    }
+}
+
+
+static ngx_msec_t
+ngx_event_find_wheel_timer(void)
+{
+    ngx_uint_t                i, n, k, d, shift, found;
+    ngx_msec_t                next, start;
+    ngx_msec_int_t            timer;
+    ngx_event_timer_wheel_t  *wheel;
+
+    wheel = &ngx_event_timer_wheel;
+
+    if (wheel->count == 0) {
+        return NGX_TIMER_INFINITE;
+    }
+
+    n = wheel->current & NGX_TIMER_WHEEL_ROOT_MASK;
+
+    /*
+     * the root slots from the current one up to the end of the level
+     * hold the timers of this round only, and the upper levels are not
+     * cascaded before the root level wraps around, so unless the wheel
+     * stands right at the wrap around, the first non-empty slot is
+     * the nearest timer
+     */
+
+    i = ngx_event_timer_wheel_next(wheel, n);
+
+    if (i < NGX_TIMER_WHEEL_ROOT_SIZE) {
+        next = wheel->current + (i - n);
+
+        if (n != 0) {
+            goto found;
+        }
+
+        found = 1;
+
+    } else {
+
+        /* the root slots before the current one belong to the next round */
+
+        i = ngx_event_timer_wheel_next(wheel, 0);
+
+        next = wheel->current + (NGX_TIMER_WHEEL_ROOT_SIZE - n) + i;
+        found = (i < NGX_TIMER_WHEEL_ROOT_SIZE);
+    }
+
+    /*
+     * the timers of an upper level slot expire not earlier than the slot
+     * is cascaded, that is, when the lower levels wrap around to it; if
+     * the lower levels have just wrapped around, the current slot is not
+     * cascaded yet
+     */
+
+    shift = NGX_TIMER_WHEEL_ROOT_BITS;
+
+    for (k = 0; k < NGX_TIMER_WHEEL_LEVELS; k++) {
+
+        i = (wheel->current >> shift) & NGX_TIMER_WHEEL_LEVEL_MASK;
+
+        d = (wheel->current & (((ngx_msec_t) 1 << shift) - 1)) ? 1 : 0;
+
+        for ( /* void */ ; d <= NGX_TIMER_WHEEL_LEVEL_SIZE; d++) {
+            if (wheel->level[k][(i + d) & NGX_TIMER_WHEEL_LEVEL_MASK].right
+                != &wheel->level[k][(i + d) & NGX_TIMER_WHEEL_LEVEL_MASK])
+            {
+                break;
+            }
+        }
+
+        if (d <= NGX_TIMER_WHEEL_LEVEL_SIZE) {
+            start = ((wheel->current >> shift) + d) << shift;
+
+            if (!found || (ngx_msec_int_t) (start - next) < 0) {
+                next = start;
+                found = 1;
+            }
+        }
+
+        shift += NGX_TIMER_WHEEL_LEVEL_BITS;
+    }
+
+found:
+
+    timer = (ngx_msec_int_t) (next - ngx_current_msec);
+
+    return (ngx_msec_t) (timer > 0 ? timer : 0);
+}
+
+
+static void
+ngx_event_expire_wheel_timers(void)
+{
+    ngx_uint_t                i, n, shift;
+    ngx_event_t              *ev;
+    ngx_rbtree_node_t        *head, *node;
+    ngx_event_timer_wheel_t  *wheel;
+
+    wheel = &ngx_event_timer_wheel;
+
+    ngx_mutex_lock(ngx_event_timer_mutex);
+
+    while ((ngx_msec_int_t) (ngx_current_msec - wheel->current) >= 0) {
+
+        if (wheel->count == 0) {
+            wheel->current = ngx_current_msec + 1;
+            break;
+        }
+
+        i = wheel->current & NGX_TIMER_WHEEL_ROOT_MASK;
+
+        if (i == 0) {
+
+            /* the root level wraps around, cascade the upper levels */
+
+            shift = NGX_TIMER_WHEEL_ROOT_BITS;
+
+            for (n = 0; n < NGX_TIMER_WHEEL_LEVELS; n++) {
+                i = (wheel->current >> shift) & NGX_TIMER_WHEEL_LEVEL_MASK;
+
+                ngx_event_timer_wheel_cascade(&wheel->level[n][i]);
+
+                if (i != 0) {
+                    break;
+                }
+
+                shift += NGX_TIMER_WHEEL_LEVEL_BITS;
+            }
+
+            i = 0;
+        }
+
+        head = &wheel->root[i];
+
+        while (head->right != head) {
+
+            node = head->right;
+
+            ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "event timer del: %d: %M",
+                           ngx_event_ident(ev->data), ev->timer.key);
+
+            ngx_event_timer_wheel_delete(node);
+
+            ngx_mutex_unlock(ngx_event_timer_mutex);
+
+#if (NGX_DEBUG)
+            ev->timer.left = NULL;
+            ev->timer.right = NULL;
+            ev->timer.parent = NULL;
+#endif
+
+            ev->timer_set = 0;
+
+            ev->timedout = 1;
+
+            ev->handler(ev);
+
+            ngx_mutex_lock(ngx_event_timer_mutex);
+        }
+
+        /*
+         * skip the empty slots up to the next timer or the wrap around,
+         * but not beyond the current time: the timers added later with
+         * an earlier key are placed to the slot of wheel->current
+         */
+
+        n = ngx_event_timer_wheel_next(wheel, i + 1) - i;
+
+        if ((ngx_msec_int_t) (ngx_current_msec + 1 - wheel->current)
+            < (ngx_msec_int_t) n)
+        {
+            wheel->current = ngx_current_msec + 1;
+            break;
+        }
+
+        wheel->current += n;
+    }
+
+    ngx_mutex_unlock(ngx_event_timer_mutex);
+}
+
+
+static void
+ngx_event_cancel_wheel_timers(void)
+{
+    ngx_uint_t                i, n, found;
+    ngx_msec_t                limit;
+    ngx_event_t              *ev;
+    ngx_rbtree_node_t        *head, *node, *next, cancelled;
+    ngx_event_timer_wheel_t  *wheel;
+
+    wheel = &ngx_event_timer_wheel;
+
+    if (wheel->cancelable == 0) {
+        return;
+    }
+
+    /*
+     * as with the rbtree, only the timers which expire before the earliest
+     * non-cancelable timer are cancelled, the rest are cancelled when
+     * the earlier timers will expire; a single pass over the slots finds
+     * the earliest non-cancelable timer and moves the cancelable ones
+     * to a temporary list, they stay counted in the wheel, so the handlers
+     * may delete any of them
+     */
+
+    cancelled.left = &cancelled;
+    cancelled.right = &cancelled;
+
+    limit = 0;
+    found = 0;
+
+    for (n = 0; n <= NGX_TIMER_WHEEL_LEVELS; n++) {
+
+        for (i = 0; i < (n ? NGX_TIMER_WHEEL_LEVEL_SIZE
+                           : NGX_TIMER_WHEEL_ROOT_SIZE); i++)
+        {
+            head = n ? &wheel->level[n - 1][i] : &wheel->root[i];
+
+            for (node = head->right; node != head; node = next) {
+
+                next = node->right;
+
+                if (!node->data) {
+                    if (!found || (ngx_msec_int_t) (node->key - limit) < 0) {
+                        limit = node->key;
+                        found = 1;
+                    }
+
+                    continue;
+                }
+
+                ngx_event_timer_wheel_unlink(node);
+
+                node->parent = &cancelled;
+                node->right = &cancelled;
+                node->left = cancelled.left;
+                cancelled.left->right = node;
+                cancelled.left = node;
+            }
+        }
+    }
+
+    while (cancelled.right != &cancelled) {
+
+        node = cancelled.right;
+
+        if (found && (ngx_msec_int_t) (node->key - limit) >= 0) {
+            ngx_event_timer_wheel_unlink(node);
+            ngx_event_timer_wheel_link(node);
+            continue;
+        }
+
+        ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "event timer cancel: %d: %M",
+                       ngx_event_ident(ev->data), ev->timer.key);
+
+        ngx_event_timer_wheel_delete(node);
+
+#if (NGX_DEBUG)
+        ev->timer.left = NULL;
+        ev->timer.right = NULL;
+        ev->timer.parent = NULL;
+#endif
+
+        ev->timer_set = 0;
+
+        ev->handler(ev);
+    }
+}
+
+
+static void
+ngx_event_timer_wheel_cascade(ngx_rbtree_node_t *head)
+{
+    ngx_rbtree_node_t  *node;
+
+    while (head->right != head) {
+        node = head->right;
+
+        ngx_event_timer_wheel_unlink(node);
+        ngx_event_timer_wheel_link(node);
+    }
+}
+
+
+/* the first non-empty root slot from i up to the end of the level */
+
+static ngx_uint_t
+ngx_event_timer_wheel_next(ngx_event_timer_wheel_t *wheel, ngx_uint_t i)
+{
+    ngx_uint_t  w;
+
+    while (i < NGX_TIMER_WHEEL_ROOT_SIZE) {
+
+        w = wheel->bitmap[i / NGX_TIMER_WHEEL_BITMAP_BITS]
+            >> (i % NGX_TIMER_WHEEL_BITMAP_BITS);
+
+        if (w == 0) {
+            i = (i / NGX_TIMER_WHEEL_BITMAP_BITS + 1)
+                * NGX_TIMER_WHEEL_BITMAP_BITS;
+            continue;
+        }
+
+        while (!(w & 1)) {
+            w >>= 1;
+            i++;
+        }
+
+        break;
+    }
+
+    return i;
+}
@@ -19,9 +19,54 @@
 #define NGX_TIMER_LAZY_DELAY  300
 
 
+/*
+ * the hierarchical timer wheel: 256 one millisecond slots in the root
+ * level and 4 levels of 64 slots each, that cover 2^14, 2^20, 2^26
+ * and 2^32 milliseconds; the timers of an upper level are cascaded
+ * to the lower levels when the root level wraps around
+ */
+
+#define NGX_TIMER_WHEEL_ROOT_BITS   8
+#define NGX_TIMER_WHEEL_LEVEL_BITS  6
+#define NGX_TIMER_WHEEL_LEVELS      4
+
+#define NGX_TIMER_WHEEL_ROOT_SIZE   (1 << NGX_TIMER_WHEEL_ROOT_BITS)
+#define NGX_TIMER_WHEEL_LEVEL_SIZE  (1 << NGX_TIMER_WHEEL_LEVEL_BITS)
+#define NGX_TIMER_WHEEL_ROOT_MASK   (NGX_TIMER_WHEEL_ROOT_SIZE - 1)
+#define NGX_TIMER_WHEEL_LEVEL_MASK  (NGX_TIMER_WHEEL_LEVEL_SIZE - 1)
+
+#define NGX_TIMER_WHEEL_BITMAP_BITS  (8 * sizeof(ngx_uint_t))
+#define NGX_TIMER_WHEEL_BITMAP_SIZE                                           \
+    (NGX_TIMER_WHEEL_ROOT_SIZE / NGX_TIMER_WHEEL_BITMAP_BITS)
+
+
+/*
+ * the wheel slots are circular lists of the events' timer nodes,
+ * the node's "left" and "right" are used as the "prev" and "next" links
+ * and the "parent" points to the list head of the slot
+ */
+
+typedef struct {
+    ngx_rbtree_node_t   root[NGX_TIMER_WHEEL_ROOT_SIZE];
+    ngx_rbtree_node_t   level[NGX_TIMER_WHEEL_LEVELS]
+                             [NGX_TIMER_WHEEL_LEVEL_SIZE];
+
+    /* the non-empty root slots */
+    ngx_uint_t          bitmap[NGX_TIMER_WHEEL_BITMAP_SIZE];
+
+    ngx_msec_t          current;    /* the first unexpired millisecond */
+    ngx_uint_t          count;
+    ngx_uint_t          cancelable;
+} ngx_event_timer_wheel_t;
+
+
 ngx_int_t ngx_event_timer_init(ngx_log_t *log);
 ngx_msec_t ngx_event_find_timer(void);
 void ngx_event_expire_timers(void);
+void ngx_event_cancel_timers(void);
+
+void ngx_event_timer_wheel_insert(ngx_rbtree_node_t *node);
+void ngx_event_timer_wheel_delete(ngx_rbtree_node_t *node);
 
 
 #if (NGX_THREADS)
@@ -30,6 +75,20 @@ extern ngx_mutex_t  *ngx_event_timer_mutex;
 
 
 extern ngx_thread_volatile ngx_rbtree_t  ngx_event_timer_rbtree;
+extern ngx_event_timer_wheel_t           ngx_event_timer_wheel;
+extern ngx_uint_t                        ngx_event_timer_use_wheel;
+
+
+static ngx_inline ngx_uint_t
+ngx_event_timers_empty(void)
+{
+    if (ngx_event_timer_use_wheel) {
+        return ngx_event_timer_wheel.count == 0;
+    }
+
+    return ngx_event_timer_rbtree.root == ngx_event_timer_rbtree.sentinel;
+}
+
 
 /**
  * @brief 从红黑树中移除事件ev
@@ -43,8 +102,14 @@ ngx_event_del_timer(ngx_event_t *ev)
                     ngx_event_ident(ev->data), ev->timer.key);
 
     ngx_mutex_lock(ngx_event_timer_mutex);
-	//将事件相关的定时器从红黑树中删除
-    ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
+
+    if (ngx_event_timer_use_wheel) {
+        ngx_event_timer_wheel_delete(&ev->timer);
+
+    } else {
+        //将事件相关的定时器从红黑树中删除
+        ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
+    }
 
     ngx_mutex_unlock(ngx_event_timer_mutex);
 
@@ -97,8 +162,14 @@ ngx_event_add_timer(ngx_event_t *ev, ngx_msec_t timer)
                     ngx_event_ident(ev->data), timer, ev->timer.key);
 
     ngx_mutex_lock(ngx_event_timer_mutex);
-	//将定时器加入到红黑树中
-    ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+
+    if (ngx_event_timer_use_wheel) {
+        ngx_event_timer_wheel_insert(&ev->timer);
+
+    } else {
+        //将定时器加入到红黑树中
+        ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+    }
 
     ngx_mutex_unlock(ngx_event_timer_mutex);
 
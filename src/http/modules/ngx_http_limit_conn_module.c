@@ -10,6 +10,9 @@
 #include <ngx_http.h>
 
 
+#define NGX_HTTP_LIMIT_CONN_MAX_SHARDS  256
+
+
 typedef struct {
     u_char              color;
     u_char              len;
@@ -24,13 +27,22 @@ typedef struct {
 } ngx_http_limit_conn_cleanup_t;
 
 
+/*
+ * zone按key的hash分为shards个分片，每个分片有自己的rbtree和锁；
+ * shards为1时使用zone本身的互斥锁
+ */
 typedef struct {
     ngx_rbtree_t       *rbtree;
+    ngx_shmtx_t        *mutex;
     ngx_int_t           index;
     ngx_str_t           var;
+    ngx_uint_t          shards;
 } ngx_http_limit_conn_ctx_t;
 
 
+#define ngx_http_limit_conn_shard(ctx, hash)  ((hash) % (ctx)->shards)
+
+
 typedef struct {
     ngx_shm_zone_t     *shm_zone;
     ngx_uint_t          conn;
@@ -77,7 +89,7 @@ static ngx_conf_enum_t  ngx_http_limit_conn_log_levels[] = {
 static ngx_command_t  ngx_http_limit_conn_commands[] = {
 
     { ngx_string("limit_conn_zone"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE2,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE23,
       ngx_http_limit_conn_zone,
       0,
       0,
@@ -144,7 +156,8 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
 {
     size_t                          len, n;
     uint32_t                        hash;
-    ngx_uint_t                      i;
+    ngx_uint_t                      i, shard;
+    ngx_shmtx_t                    *mutex;
     ngx_slab_pool_t                *shpool;
     ngx_rbtree_node_t              *node;
     ngx_pool_cleanup_t             *cln;
@@ -191,9 +204,12 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
 
         shpool = (ngx_slab_pool_t *) limits[i].shm_zone->shm.addr;
 
-        ngx_shmtx_lock(&shpool->mutex);
+        shard = ngx_http_limit_conn_shard(ctx, hash);
+        mutex = &ctx->mutex[shard];
+
+        ngx_shmtx_lock(mutex);
 
-        node = ngx_http_limit_conn_lookup(ctx->rbtree, vv, hash);
+        node = ngx_http_limit_conn_lookup(&ctx->rbtree[shard], vv, hash);
 
         if (node == NULL) {
 
@@ -204,7 +220,7 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
             node = ngx_slab_alloc_locked(shpool, n);
 
             if (node == NULL) {
-                ngx_shmtx_unlock(&shpool->mutex);
+                ngx_shmtx_unlock(mutex);
                 ngx_http_limit_conn_cleanup_all(r->pool);
                 return NGX_HTTP_SERVICE_UNAVAILABLE;
             }
@@ -216,7 +232,7 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
             lc->conn = 1;
             ngx_memcpy(lc->data, vv->data, len);
 
-            ngx_rbtree_insert(ctx->rbtree, node);
+            ngx_rbtree_insert(&ctx->rbtree[shard], node);
 
         } else {
 
@@ -224,7 +240,7 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
 
             if ((ngx_uint_t) lc->conn >= limits[i].conn) {
 
-                ngx_shmtx_unlock(&shpool->mutex);
+                ngx_shmtx_unlock(mutex);
 
                 ngx_log_error(lccf->log_level, r->connection->log, 0,
                               "limiting connections by zone \"%V\"",
@@ -240,7 +256,7 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
         ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "limit zone: %08XD %d", node->key, lc->conn);
 
-        ngx_shmtx_unlock(&shpool->mutex);
+        ngx_shmtx_unlock(mutex);
 
         cln = ngx_pool_cleanup_add(r->pool,
                                    sizeof(ngx_http_limit_conn_cleanup_t));
@@ -345,6 +361,7 @@ ngx_http_limit_conn_cleanup(void *data)
 {
     ngx_http_limit_conn_cleanup_t  *lccln = data;
 
+    ngx_uint_t                   shard;
     ngx_slab_pool_t             *shpool;
     ngx_rbtree_node_t           *node;
     ngx_http_limit_conn_ctx_t   *ctx;
@@ -355,7 +372,9 @@ ngx_http_limit_conn_cleanup(void *data)
     node = lccln->node;
     lc = (ngx_http_limit_conn_node_t *) &node->color;
 
-    ngx_shmtx_lock(&shpool->mutex);
+    shard = ngx_http_limit_conn_shard(ctx, node->key);
+
+    ngx_shmtx_lock(&ctx->mutex[shard]);
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, lccln->shm_zone->shm.log, 0,
                    "limit zone cleanup: %08XD %d", node->key, lc->conn);
@@ -363,11 +382,11 @@ ngx_http_limit_conn_cleanup(void *data)
     lc->conn--;
 
     if (lc->conn == 0) {
-        ngx_rbtree_delete(ctx->rbtree, node);
+        ngx_rbtree_delete(&ctx->rbtree[shard], node);
         ngx_slab_free_locked(shpool, node);
     }
 
-    ngx_shmtx_unlock(&shpool->mutex);
+    ngx_shmtx_unlock(&ctx->mutex[shard]);
 }
 
 
@@ -393,6 +412,7 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
     ngx_http_limit_conn_ctx_t  *octx = data;
 
     size_t                      len;
+    ngx_uint_t                  i;
     ngx_slab_pool_t            *shpool;
     ngx_rbtree_node_t          *sentinel;
     ngx_http_limit_conn_ctx_t  *ctx;
@@ -408,7 +428,16 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
             return NGX_ERROR;
         }
 
+        if (ctx->shards != octx->shards) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_conn_zone \"%V\" uses %ui shards "
+                          "while previously it used %ui shards",
+                          &shm_zone->shm.name, ctx->shards, octx->shards);
+            return NGX_ERROR;
+        }
+
         ctx->rbtree = octx->rbtree;
+        ctx->mutex = octx->mutex;
 
         return NGX_OK;
     }
@@ -417,24 +446,38 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 
     if (shm_zone->shm.exists) {
         ctx->rbtree = shpool->data;
+        ctx->mutex = (ctx->shards > 1) ? shpool->mutexes : &shpool->mutex;
 
         return NGX_OK;
     }
 
-    ctx->rbtree = ngx_slab_alloc(shpool, sizeof(ngx_rbtree_t));
+    ctx->rbtree = ngx_slab_alloc(shpool, sizeof(ngx_rbtree_t) * ctx->shards);
     if (ctx->rbtree == NULL) {
         return NGX_ERROR;
     }
 
     shpool->data = ctx->rbtree;
 
-    sentinel = ngx_slab_alloc(shpool, sizeof(ngx_rbtree_node_t));
+    sentinel = ngx_slab_alloc(shpool,
+                              sizeof(ngx_rbtree_node_t) * ctx->shards);
     if (sentinel == NULL) {
         return NGX_ERROR;
     }
 
-    ngx_rbtree_init(ctx->rbtree, sentinel,
-                    ngx_http_limit_conn_rbtree_insert_value);
+    for (i = 0; i < ctx->shards; i++) {
+        ngx_rbtree_init(&ctx->rbtree[i], &sentinel[i],
+                        ngx_http_limit_conn_rbtree_insert_value);
+    }
+
+    if (ctx->shards > 1) {
+        ctx->mutex = ngx_slab_alloc_mutexes(shpool, ctx->shards);
+        if (ctx->mutex == NULL) {
+            return NGX_ERROR;
+        }
+
+    } else {
+        ctx->mutex = &shpool->mutex;
+    }
 
     len = sizeof(" in limit_conn_zone \"\"") + shm_zone->shm.name.len;
 
@@ -494,6 +537,7 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     u_char                     *p;
     ssize_t                     size;
     ngx_str_t                  *value, name, s;
+    ngx_int_t                   shards;
     ngx_uint_t                  i;
     ngx_shm_zone_t             *shm_zone;
     ngx_http_limit_conn_ctx_t  *ctx;
@@ -502,6 +546,7 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     ctx = NULL;
     size = 0;
+    shards = 1;
     name.len = 0;
 
     for (i = 1; i < cf->args->nelts; i++) {
@@ -540,6 +585,30 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "shards=", 7) == 0) {
+
+            shards = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (shards <= 0 || shards > NGX_HTTP_LIMIT_CONN_MAX_SHARDS) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid number of shards \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+#if !(NGX_HAVE_ATOMIC_OPS)
+
+            if (shards > 1) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "\"%V\" requires atomic operations",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+#endif
+
+            continue;
+        }
+
         if (value[i].data[0] == '$') {
 
             value[i].len--;
@@ -579,6 +648,8 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    ctx->shards = shards;
+
     shm_zone = ngx_shared_memory_add(cf, &name, size,
                                      &ngx_http_limit_conn_module);
     if (shm_zone == NULL) {
@@ -633,6 +704,7 @@ ngx_http_limit_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     ctx->var = value[2];
+    ctx->shards = 1;
 
     n = ngx_parse_size(&value[3]);
 
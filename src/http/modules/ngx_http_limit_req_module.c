@@ -10,6 +10,9 @@
 #include <ngx_http.h>
 
 
+#define NGX_HTTP_LIMIT_REQ_MAX_SHARDS  256
+
+
 typedef struct {
     u_char                       color;
     u_char                       dummy;
@@ -30,17 +33,27 @@ typedef struct {
 } ngx_http_limit_req_shctx_t;
 
 
+/*
+ * zone按key的hash分为shards个分片，每个分片有自己的rbtree、LRU队列和锁；
+ * shards为1时使用zone本身的互斥锁
+ */
 typedef struct {
     ngx_http_limit_req_shctx_t  *sh;
+    ngx_shmtx_t                 *mutex;
     ngx_slab_pool_t             *shpool;
     /* integer value, 1 corresponds to 0.001 r/s */
     ngx_uint_t                   rate;
     ngx_int_t                    index;
     ngx_str_t                    var;
+    ngx_uint_t                   shards;
     ngx_http_limit_req_node_t   *node;
+    ngx_uint_t                   shard; /* node所在的分片 */
 } ngx_http_limit_req_ctx_t;
 
 
+#define ngx_http_limit_req_shard(ctx, hash)  ((hash) % (ctx)->shards)
+
+
 typedef struct {
     ngx_shm_zone_t              *shm_zone;
     /* integer value, 1 corresponds to 0.001 r/s */
@@ -63,7 +76,7 @@ static ngx_int_t ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit,
 static ngx_msec_t ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits,
     ngx_uint_t n, ngx_uint_t *ep, ngx_http_limit_req_limit_t **limit);
 static void ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx,
-    ngx_uint_t n);
+    ngx_http_limit_req_shctx_t *sh, ngx_uint_t n);
 
 static void *ngx_http_limit_req_create_conf(ngx_conf_t *cf);
 static char *ngx_http_limit_req_merge_conf(ngx_conf_t *cf, void *parent,
@@ -87,7 +100,7 @@ static ngx_conf_enum_t  ngx_http_limit_req_log_levels[] = {
 static ngx_command_t  ngx_http_limit_req_commands[] = {
 
     { ngx_string("limit_req_zone"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE3,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE3|NGX_CONF_TAKE4,
       ngx_http_limit_req_zone,
       0,
       0,
@@ -198,12 +211,14 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
 
         hash = ngx_crc32_short(vv->data, len);
 
-        ngx_shmtx_lock(&ctx->shpool->mutex);
+        ctx->shard = ngx_http_limit_req_shard(ctx, hash);
+
+        ngx_shmtx_lock(&ctx->mutex[ctx->shard]);
 
         rc = ngx_http_limit_req_lookup(limit, hash, vv->data, len, &excess,
                                        (n == lrcf->limits.nelts - 1));
 
-        ngx_shmtx_unlock(&ctx->shpool->mutex);
+        ngx_shmtx_unlock(&ctx->mutex[ctx->shard]);
 
         ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "limit_req[%ui]: %i %ui.%03ui",
@@ -236,11 +251,11 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
                 continue;
             }
 
-            ngx_shmtx_lock(&ctx->shpool->mutex);
+            ngx_shmtx_lock(&ctx->mutex[ctx->shard]);
 
             ctx->node->count--;
 
-            ngx_shmtx_unlock(&ctx->shpool->mutex);
+            ngx_shmtx_unlock(&ctx->mutex[ctx->shard]);
 
             ctx->node = NULL;
         }
@@ -354,22 +369,25 @@ static ngx_int_t
 ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
     u_char *data, size_t len, ngx_uint_t *ep, ngx_uint_t account)
 {
-    size_t                      size;
-    ngx_int_t                   rc, excess;
-    ngx_time_t                 *tp;
-    ngx_msec_t                  now;
-    ngx_msec_int_t              ms;
-    ngx_rbtree_node_t          *node, *sentinel;
-    ngx_http_limit_req_ctx_t   *ctx;
-    ngx_http_limit_req_node_t  *lr;
+    size_t                       size;
+    ngx_int_t                    rc, excess;
+    ngx_uint_t                   i, shard;
+    ngx_time_t                  *tp;
+    ngx_msec_t                   now;
+    ngx_msec_int_t               ms;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_http_limit_req_ctx_t    *ctx;
+    ngx_http_limit_req_node_t   *lr;
+    ngx_http_limit_req_shctx_t  *sh;
 
     tp = ngx_timeofday();
     now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
 
     ctx = limit->shm_zone->data;
+    sh = &ctx->sh[ctx->shard];
 
-    node = ctx->sh->rbtree.root;
-    sentinel = ctx->sh->rbtree.sentinel;
+    node = sh->rbtree.root;
+    sentinel = sh->rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -391,7 +409,7 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
 
         if (rc == 0) {
             ngx_queue_remove(&lr->queue);
-            ngx_queue_insert_head(&ctx->sh->queue, &lr->queue);
+            ngx_queue_insert_head(&sh->queue, &lr->queue);
 
             ms = (ngx_msec_int_t) (now - lr->last);
 
@@ -429,14 +447,34 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
            + offsetof(ngx_http_limit_req_node_t, data)
            + len;
 
-    ngx_http_limit_req_expire(ctx, 1);
+    ngx_http_limit_req_expire(ctx, sh, 1);
 
     node = ngx_slab_alloc_locked(ctx->shpool, size);
 
     if (node == NULL) {
-        ngx_http_limit_req_expire(ctx, 0);
+        ngx_http_limit_req_expire(ctx, sh, 0);
 
         node = ngx_slab_alloc_locked(ctx->shpool, size);
+
+        /*
+         * 分片共用zone的内存，本分片无节点可淘汰时，
+         * 从其它未被占用的分片中淘汰最旧的节点
+         */
+
+        for (i = 1; node == NULL && i < ctx->shards; i++) {
+            shard = (ctx->shard + i) % ctx->shards;
+
+            if (!ngx_shmtx_trylock(&ctx->mutex[shard])) {
+                continue;
+            }
+
+            ngx_http_limit_req_expire(ctx, &ctx->sh[shard], 0);
+
+            ngx_shmtx_unlock(&ctx->mutex[shard]);
+
+            node = ngx_slab_alloc_locked(ctx->shpool, size);
+        }
+
         if (node == NULL) {
             return NGX_ERROR;
         }
@@ -444,11 +482,11 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
 
     node->key = hash;
 
-    ngx_rbtree_insert(&ctx->sh->rbtree, node);
+    ngx_rbtree_insert(&sh->rbtree, node);
 
     lr = (ngx_http_limit_req_node_t *) &node->color;
 
-    ngx_queue_insert_head(&ctx->sh->queue, &lr->queue);
+    ngx_queue_insert_head(&sh->queue, &lr->queue);
 
     lr->len = (u_char) len;
     lr->excess = 0;
@@ -499,7 +537,7 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
             continue;
         }
 
-        ngx_shmtx_lock(&ctx->shpool->mutex);
+        ngx_shmtx_lock(&ctx->mutex[ctx->shard]);
 
         tp = ngx_timeofday();
 
@@ -516,7 +554,7 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
         lr->excess = excess;
         lr->count--;
 
-        ngx_shmtx_unlock(&ctx->shpool->mutex);
+        ngx_shmtx_unlock(&ctx->mutex[ctx->shard]);
 
         ctx->node = NULL;
 
@@ -538,7 +576,8 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
 
 
 static void
-ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
+ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_shctx_t *sh, ngx_uint_t n)
 {
     ngx_int_t                   excess;
     ngx_time_t                 *tp;
@@ -560,11 +599,11 @@ ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
 
     while (n < 3) {
 
-        if (ngx_queue_empty(&ctx->sh->queue)) {
+        if (ngx_queue_empty(&sh->queue)) {
             return;
         }
 
-        q = ngx_queue_last(&ctx->sh->queue);
+        q = ngx_queue_last(&sh->queue);
 
         lr = ngx_queue_data(q, ngx_http_limit_req_node_t, queue);
 
@@ -599,7 +638,7 @@ ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
         node = (ngx_rbtree_node_t *)
                    ((u_char *) lr - offsetof(ngx_rbtree_node_t, color));
 
-        ngx_rbtree_delete(&ctx->sh->rbtree, node);
+        ngx_rbtree_delete(&sh->rbtree, node);
 
         ngx_slab_free_locked(ctx->shpool, node);
     }
@@ -612,6 +651,7 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
     ngx_http_limit_req_ctx_t  *octx = data;
 
     size_t                     len;
+    ngx_uint_t                 i;
     ngx_http_limit_req_ctx_t  *ctx;
 
     ctx = shm_zone->data;
@@ -625,7 +665,16 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
             return NGX_ERROR;
         }
 
+        if (ctx->shards != octx->shards) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_req \"%V\" uses %ui shards "
+                          "while previously it used %ui shards",
+                          &shm_zone->shm.name, ctx->shards, octx->shards);
+            return NGX_ERROR;
+        }
+
         ctx->sh = octx->sh;
+        ctx->mutex = octx->mutex;
         ctx->shpool = octx->shpool;
 
         return NGX_OK;
@@ -635,21 +684,36 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 
     if (shm_zone->shm.exists) {
         ctx->sh = ctx->shpool->data;
+        ctx->mutex = (ctx->shards > 1) ? ctx->shpool->mutexes
+                                       : &ctx->shpool->mutex;
 
         return NGX_OK;
     }
 
-    ctx->sh = ngx_slab_alloc(ctx->shpool, sizeof(ngx_http_limit_req_shctx_t));
+    ctx->sh = ngx_slab_alloc(ctx->shpool,
+                             sizeof(ngx_http_limit_req_shctx_t) * ctx->shards);
     if (ctx->sh == NULL) {
         return NGX_ERROR;
     }
 
     ctx->shpool->data = ctx->sh;
 
-    ngx_rbtree_init(&ctx->sh->rbtree, &ctx->sh->sentinel,
-                    ngx_http_limit_req_rbtree_insert_value);
+    for (i = 0; i < ctx->shards; i++) {
+        ngx_rbtree_init(&ctx->sh[i].rbtree, &ctx->sh[i].sentinel,
+                        ngx_http_limit_req_rbtree_insert_value);
 
-    ngx_queue_init(&ctx->sh->queue);
+        ngx_queue_init(&ctx->sh[i].queue);
+    }
+
+    if (ctx->shards > 1) {
+        ctx->mutex = ngx_slab_alloc_mutexes(ctx->shpool, ctx->shards);
+        if (ctx->mutex == NULL) {
+            return NGX_ERROR;
+        }
+
+    } else {
+        ctx->mutex = &ctx->shpool->mutex;
+    }
 
     len = sizeof(" in limit_req zone \"\"") + shm_zone->shm.name.len;
 
@@ -714,7 +778,7 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     size_t                     len;
     ssize_t                    size;
     ngx_str_t                 *value, name, s;
-    ngx_int_t                  rate, scale;
+    ngx_int_t                  rate, scale, shards;
     ngx_uint_t                 i;
     ngx_shm_zone_t            *shm_zone;
     ngx_http_limit_req_ctx_t  *ctx;
@@ -725,6 +789,7 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     size = 0;
     rate = 1;
     scale = 1;
+    shards = 1;
     name.len = 0;
 
     for (i = 1; i < cf->args->nelts; i++) {
@@ -787,6 +852,30 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "shards=", 7) == 0) {
+
+            shards = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (shards <= 0 || shards > NGX_HTTP_LIMIT_REQ_MAX_SHARDS) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid number of shards \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+#if !(NGX_HAVE_ATOMIC_OPS)
+
+            if (shards > 1) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "\"%V\" requires atomic operations",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+#endif
+
+            continue;
+        }
+
         if (value[i].data[0] == '$') {
 
             value[i].len--;
@@ -827,6 +916,7 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     ctx->rate = rate * 1000 / scale;
+    ctx->shards = shards;
 
     shm_zone = ngx_shared_memory_add(cf, &name, size,
                                      &ngx_http_limit_req_module);
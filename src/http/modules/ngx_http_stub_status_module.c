@@ -10,8 +10,82 @@
 #include <ngx_http.h>
 
 
+/* upstream响应时间直方图的分桶上限(ms)，最后一个桶为无穷大 */
+#define NGX_HTTP_STUB_STATUS_BUCKETS  13
+
+/* 统计的缓存状态数，对应ngx_http_cache_status[] */
+#define NGX_HTTP_STUB_STATUS_CACHE    NGX_HTTP_CACHE_HIT
+
+
+typedef struct {
+    ngx_atomic_t   requests;
+    ngx_atomic_t   responses[5]; /* 1xx ~ 5xx */
+    ngx_atomic_t   received;
+    ngx_atomic_t   sent;
+    ngx_atomic_t   upstream_responses;
+    ngx_atomic_t   upstream_time; /* ms */
+    ngx_atomic_t   upstream_hist[NGX_HTTP_STUB_STATUS_BUCKETS];
+    ngx_atomic_t   cache[NGX_HTTP_STUB_STATUS_CACHE];
+} ngx_http_stub_status_counters_t;
+
+
+/*
+ * 每个进程一组计数器，由slab分配(不小于cache line，因而按cache line对齐)，
+ * counters[0]统计所有请求，counters[n]统计第n个status_zone的请求
+ */
+typedef struct {
+    ngx_uint_t                        generation;
+    ngx_http_stub_status_counters_t   counters[1];
+} ngx_http_stub_status_block_t;
+
+
+typedef struct {
+    ngx_uint_t                        generation;
+    ngx_http_stub_status_block_t     *blocks[NGX_MAX_PROCESSES];
+} ngx_http_stub_status_sh_t;
+
+
+typedef struct {
+    ngx_array_t                       zones;     /* of ngx_str_t */
+    ngx_flag_t                        enable;
+    ngx_shm_zone_t                   *shm_zone;
+    ngx_http_stub_status_sh_t        *sh;
+    ngx_slab_pool_t                  *shpool;
+} ngx_http_stub_status_main_conf_t;
+
+
+typedef struct {
+    ngx_uint_t                        zone;      /* 0 - 无status_zone */
+} ngx_http_stub_status_srv_conf_t;
+
+
+static ngx_int_t ngx_http_stub_status_log_handler(ngx_http_request_t *r);
+static void ngx_http_stub_status_account(ngx_http_request_t *r,
+    ngx_http_stub_status_counters_t *c);
+static void ngx_http_stub_status_sum(ngx_http_stub_status_main_conf_t *smcf,
+    ngx_http_stub_status_counters_t *sum, ngx_uint_t n);
+static ngx_buf_t *ngx_http_stub_status_json(ngx_http_request_t *r,
+    ngx_stat_t *st);
+static u_char *ngx_http_stub_status_json_counters(u_char *p,
+    ngx_http_stub_status_counters_t *c);
+#if (NGX_HTTP_CACHE)
+static ngx_int_t ngx_http_stub_status_caches(ngx_http_request_t *r,
+    ngx_array_t *caches);
+#endif
+static ngx_int_t ngx_http_stub_status_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+
+static void *ngx_http_stub_status_create_main_conf(ngx_conf_t *cf);
+static void *ngx_http_stub_status_create_srv_conf(ngx_conf_t *cf);
+static char *ngx_http_stub_status_merge_srv_conf(ngx_conf_t *cf,
+    void *parent, void *child);
 static char *ngx_http_set_status(ngx_conf_t *cf, ngx_command_t *cmd,
                                  void *conf);
+static char *ngx_http_status_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_stub_status_init(ngx_conf_t *cf);
+static ngx_int_t ngx_http_stub_status_init_process(ngx_cycle_t *cycle);
+
 
 static ngx_command_t  ngx_http_status_commands[] = {
 
@@ -22,6 +96,13 @@ static ngx_command_t  ngx_http_status_commands[] = {
       0,
       NULL },
 
+    { ngx_string("status_zone"),
+      NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_http_status_zone,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -29,13 +110,13 @@ static ngx_command_t  ngx_http_status_commands[] = {
 
 static ngx_http_module_t  ngx_http_stub_status_module_ctx = {
     NULL,                                  /* preconfiguration */
-    NULL,                                  /* postconfiguration */
+    ngx_http_stub_status_init,             /* postconfiguration */
 
-    NULL,                                  /* create main configuration */
+    ngx_http_stub_status_create_main_conf, /* create main configuration */
     NULL,                                  /* init main configuration */
 
-    NULL,                                  /* create server configuration */
-    NULL,                                  /* merge server configuration */
+    ngx_http_stub_status_create_srv_conf,  /* create server configuration */
+    ngx_http_stub_status_merge_srv_conf,   /* merge server configuration */
 
     NULL,                                  /* create location configuration */
     NULL                                   /* merge location configuration */
@@ -49,7 +130,7 @@ ngx_module_t  ngx_http_stub_status_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_stub_status_init_process,     /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -58,12 +139,24 @@ ngx_module_t  ngx_http_stub_status_module = {
 };
 
 
+static ngx_msec_t  ngx_http_stub_status_bounds[] = {
+    1, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000
+};
+
+
+/* 当前进程的计数器 */
+static ngx_http_stub_status_counters_t  *ngx_http_stub_status_counters;
+
+
 static ngx_int_t ngx_http_status_handler(ngx_http_request_t *r)
 {
     size_t             size;
     ngx_int_t          rc;
+    ngx_str_t          format;
+    ngx_uint_t         json;
     ngx_buf_t         *b;
     ngx_chain_t        out;
+    ngx_stat_t         st;
     ngx_atomic_int_t   ap, hn, ac, rq, rd, wr;
 
     if (r->method != NGX_HTTP_GET && r->method != NGX_HTTP_HEAD) {
@@ -76,7 +169,16 @@ static ngx_int_t ngx_http_status_handler(ngx_http_request_t *r)
         return rc;
     }
 
-    ngx_str_set(&r->headers_out.content_type, "text/plain");
+    json = (ngx_http_arg(r, (u_char *) "format", 6, &format) == NGX_OK
+            && format.len == 4
+            && ngx_strncmp(format.data, "json", 4) == 0);
+
+    if (json) {
+        ngx_str_set(&r->headers_out.content_type, "application/json");
+
+    } else {
+        ngx_str_set(&r->headers_out.content_type, "text/plain");
+    }
 
     if (r->method == NGX_HTTP_HEAD) {
         r->headers_out.status = NGX_HTTP_OK;
@@ -88,25 +190,35 @@ static ngx_int_t ngx_http_status_handler(ngx_http_request_t *r)
         }
     }
 
+    ngx_stat_sum(&st);
+
+    if (json) {
+        b = ngx_http_stub_status_json(r, &st);
+        if (b == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        goto send;
+    }
+
     size = sizeof("Active connections:  \n") + NGX_ATOMIC_T_LEN
            + sizeof("server accepts handled requests\n") - 1
            + 6 + 3 * NGX_ATOMIC_T_LEN
-           + sizeof("Reading:  Writing:  Waiting:  \n") + 3 * NGX_ATOMIC_T_LEN;
+           + sizeof("Reading:  Writing:  Waiting:  \n") + 3 * NGX_ATOMIC_T_LEN
+           + sizeof("Worker  request cache: pools   requests   \n")
+           + NGX_INT64_LEN + 6 * NGX_INT_T_LEN;
 
     b = ngx_create_temp_buf(r->pool, size);
     if (b == NULL) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    out.buf = b;
-    out.next = NULL;
-
-    ap = *ngx_stat_accepted;
-    hn = *ngx_stat_handled;
-    ac = *ngx_stat_active;
-    rq = *ngx_stat_requests;
-    rd = *ngx_stat_reading;
-    wr = *ngx_stat_writing;
+    ap = st.accepted;
+    hn = st.handled;
+    ac = st.active;
+    rq = st.requests;
+    rd = st.reading;
+    wr = st.writing;
 
     b->last = ngx_sprintf(b->last, "Active connections: %uA \n", ac);
 
@@ -118,11 +230,29 @@ static ngx_int_t ngx_http_status_handler(ngx_http_request_t *r)
     b->last = ngx_sprintf(b->last, "Reading: %uA Writing: %uA Waiting: %uA \n",
                           rd, wr, ac - (rd + wr));
 
+    /* the cache is per worker, these are the numbers of the current one */
+
+    b->last = ngx_sprintf(b->last,
+                          "Worker %P request cache: pools %ui %ui %ui "
+                          "requests %ui %ui %ui \n",
+                          ngx_pid,
+                          ngx_http_request_cache.pools.nfree,
+                          ngx_http_request_cache.pools.hits,
+                          ngx_http_request_cache.pools.misses,
+                          ngx_http_request_cache.nfree,
+                          ngx_http_request_cache.hits,
+                          ngx_http_request_cache.misses);
+
+send:
+
     r->headers_out.status = NGX_HTTP_OK;
     r->headers_out.content_length_n = b->last - b->pos;
 
     b->last_buf = 1;
 
+    out.buf = b;
+    out.next = NULL;
+
     rc = ngx_http_send_header(r);
 
     if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
@@ -133,12 +263,682 @@ static ngx_int_t ngx_http_status_handler(ngx_http_request_t *r)
 }
 
 
+static ngx_buf_t *
+ngx_http_stub_status_json(ngx_http_request_t *r, ngx_stat_t *st)
+{
+    size_t                             size;
+    ngx_buf_t                         *b;
+    ngx_str_t                         *name;
+    ngx_uint_t                         i, n;
+    ngx_http_stub_status_counters_t   *sum;
+    ngx_http_stub_status_main_conf_t  *smcf;
+#if (NGX_HTTP_CACHE)
+    off_t                              used;
+    ngx_uint_t                         lookups, hits, rejected, evicted;
+    ngx_array_t                        caches;
+    ngx_http_file_cache_t            **cache;
+#endif
+
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_stub_status_module);
+
+    n = smcf->zones.nelts + 1;
+    name = smcf->zones.elts;
+
+    sum = NULL;
+
+    if (smcf->sh) {
+        sum = ngx_palloc(r->pool, n * sizeof(ngx_http_stub_status_counters_t));
+        if (sum == NULL) {
+            return NULL;
+        }
+
+        ngx_http_stub_status_sum(smcf, sum, n);
+    }
+
+    size = sizeof("{\"connections\":{\"active\":,\"reading\":,\"writing\":,"
+                  "\"waiting\":,\"accepted\":,\"handled\":},"
+                  "\"requests\":,\"pid\":,\"http\":{\"total\":"
+                  ",\"server_zones\":{}}}") + 7 * NGX_ATOMIC_T_LEN
+           + NGX_INT64_LEN;
+
+    for (i = 0; i < n; i++) {
+        size += sizeof("\"\":,") + (i ? name[i - 1].len : 0)
+                + sizeof("{\"requests\":,\"responses\":{\"1xx\":,\"2xx\":,"
+                         "\"3xx\":,\"4xx\":,\"5xx\":},\"received\":,"
+                         "\"sent\":,\"upstream\":{\"responses\":,"
+                         "\"response_time\":,\"histogram\":{}},"
+                         "\"cache\":{}}")
+                + (10 + NGX_HTTP_STUB_STATUS_BUCKETS
+                   + NGX_HTTP_STUB_STATUS_CACHE) * NGX_ATOMIC_T_LEN
+                + NGX_HTTP_STUB_STATUS_BUCKETS * sizeof("\"+Inf\":,")
+                + NGX_HTTP_STUB_STATUS_CACHE * sizeof("\"REVALIDATED\":,");
+    }
+
+#if (NGX_HTTP_CACHE)
+
+    if (ngx_http_stub_status_caches(r, &caches) != NGX_OK) {
+        return NULL;
+    }
+
+    cache = caches.elts;
+
+    size += sizeof(",\"caches\":{}");
+
+    for (i = 0; i < caches.nelts; i++) {
+        size += sizeof("\"\":{\"policy\":\"\",\"size\":,\"max_size\":,"
+                       "\"lookups\":,\"hits\":,\"rejected\":,\"evicted\":},")
+                + cache[i]->shm_zone->shm.name.len
+                + ngx_escape_json(NULL, cache[i]->shm_zone->shm.name.data,
+                                  cache[i]->shm_zone->shm.name.len)
+                + ngx_http_file_cache_policies[cache[i]->policy].len
+                + 2 * NGX_OFF_T_LEN + 4 * NGX_ATOMIC_T_LEN;
+    }
+
+#endif
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    b->last = ngx_sprintf(b->last,
+                          "{\"connections\":{\"active\":%uA,\"reading\":%uA,"
+                          "\"writing\":%uA,\"waiting\":%uA,"
+                          "\"accepted\":%uA,\"handled\":%uA},"
+                          "\"requests\":%uA,\"pid\":%P,\"http\":{",
+                          st->active, st->reading, st->writing,
+                          st->active - (st->reading + st->writing),
+                          st->accepted, st->handled, st->requests, ngx_pid);
+
+    if (sum) {
+        b->last = ngx_cpymem(b->last, "\"total\":", sizeof("\"total\":") - 1);
+        b->last = ngx_http_stub_status_json_counters(b->last, &sum[0]);
+        *b->last++ = ',';
+    }
+
+    b->last = ngx_cpymem(b->last, "\"server_zones\":{",
+                         sizeof("\"server_zones\":{") - 1);
+
+    for (i = 1; sum && i < n; i++) {
+        if (i > 1) {
+            *b->last++ = ',';
+        }
+
+        b->last = ngx_sprintf(b->last, "\"%V\":", &name[i - 1]);
+        b->last = ngx_http_stub_status_json_counters(b->last, &sum[i]);
+    }
+
+    b->last = ngx_cpymem(b->last, "}}", 2);
+
+#if (NGX_HTTP_CACHE)
+
+    /* 各缓存的淘汰策略和命中计数，按zone对比不同策略 */
+
+    b->last = ngx_cpymem(b->last, ",\"caches\":{",
+                         sizeof(",\"caches\":{") - 1);
+
+    for (i = 0; i < caches.nelts; i++) {
+
+        ngx_shmtx_lock(&cache[i]->shpool->mutex);
+
+        used = cache[i]->sh->size;
+        lookups = cache[i]->sh->lookups;
+        hits = cache[i]->sh->hits;
+        rejected = cache[i]->sh->rejected;
+        evicted = cache[i]->sh->evicted;
+
+        ngx_shmtx_unlock(&cache[i]->shpool->mutex);
+
+        if (i) {
+            *b->last++ = ',';
+        }
+
+        /* keys_zone names are not restricted, so they are escaped */
+
+        *b->last++ = '"';
+        b->last = (u_char *) ngx_escape_json(b->last,
+                                         cache[i]->shm_zone->shm.name.data,
+                                         cache[i]->shm_zone->shm.name.len);
+
+        b->last = ngx_sprintf(b->last,
+                              "\":{\"policy\":\"%V\",\"size\":%O,"
+                              "\"max_size\":%O,\"lookups\":%ui,\"hits\":%ui,"
+                              "\"rejected\":%ui,\"evicted\":%ui}",
+                              &ngx_http_file_cache_policies[cache[i]->policy],
+                              used * cache[i]->bsize,
+                              cache[i]->max_size * cache[i]->bsize,
+                              lookups, hits, rejected, evicted);
+    }
+
+    *b->last++ = '}';
+
+#endif
+
+    *b->last++ = '}';
+
+    return b;
+}
+
+
+static u_char *
+ngx_http_stub_status_json_counters(u_char *p,
+    ngx_http_stub_status_counters_t *c)
+{
+    ngx_uint_t  i;
+
+    p = ngx_sprintf(p, "{\"requests\":%uA,\"responses\":{\"1xx\":%uA,"
+                    "\"2xx\":%uA,\"3xx\":%uA,\"4xx\":%uA,\"5xx\":%uA},"
+                    "\"received\":%uA,\"sent\":%uA,"
+                    "\"upstream\":{\"responses\":%uA,\"response_time\":%uA,"
+                    "\"histogram\":{",
+                    c->requests, c->responses[0], c->responses[1],
+                    c->responses[2], c->responses[3], c->responses[4],
+                    c->received, c->sent, c->upstream_responses,
+                    c->upstream_time);
+
+    for (i = 0; i < NGX_HTTP_STUB_STATUS_BUCKETS; i++) {
+        if (i) {
+            *p++ = ',';
+        }
+
+        if (i < NGX_HTTP_STUB_STATUS_BUCKETS - 1) {
+            p = ngx_sprintf(p, "\"%M\":%uA",
+                            ngx_http_stub_status_bounds[i],
+                            c->upstream_hist[i]);
+
+        } else {
+            p = ngx_sprintf(p, "\"+Inf\":%uA", c->upstream_hist[i]);
+        }
+    }
+
+    p = ngx_cpymem(p, "}},\"cache\":{", sizeof("}},\"cache\":{") - 1);
+
+#if (NGX_HTTP_CACHE)
+
+    for (i = 0; i < NGX_HTTP_STUB_STATUS_CACHE; i++) {
+        if (i) {
+            *p++ = ',';
+        }
+
+        p = ngx_sprintf(p, "\"%V\":%uA", &ngx_http_cache_status[i],
+                        c->cache[i]);
+    }
+
+#endif
+
+    *p++ = '}';
+    *p++ = '}';
+
+    return p;
+}
+
+
+#if (NGX_HTTP_CACHE)
+
+/* 当前配置中的所有缓存 */
+
+static ngx_int_t
+ngx_http_stub_status_caches(ngx_http_request_t *r, ngx_array_t *caches)
+{
+    ngx_uint_t              i;
+    ngx_list_part_t        *part;
+    ngx_shm_zone_t         *shm_zone;
+    ngx_http_file_cache_t  *cache, **c;
+
+    if (ngx_array_init(caches, r->pool, 4, sizeof(ngx_http_file_cache_t *))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    part = &((ngx_cycle_t *) ngx_cycle)->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        cache = ngx_http_file_cache_zone(&shm_zone[i]);
+
+        if (cache == NULL || cache->sh == NULL) {
+            continue;
+        }
+
+        c = ngx_array_push(caches);
+        if (c == NULL) {
+            return NGX_ERROR;
+        }
+
+        *c = cache;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+/* 累加当前配置下所有进程的计数器 */
+static void
+ngx_http_stub_status_sum(ngx_http_stub_status_main_conf_t *smcf,
+    ngx_http_stub_status_counters_t *sum, ngx_uint_t n)
+{
+    ngx_uint_t                        i, j, k;
+    ngx_atomic_t                     *src, *dst;
+    ngx_http_stub_status_block_t     *blk;
+
+    ngx_memzero(sum, n * sizeof(ngx_http_stub_status_counters_t));
+
+    ngx_shmtx_lock(&smcf->shpool->mutex);
+
+    for (i = 0; i < NGX_MAX_PROCESSES; i++) {
+        blk = smcf->sh->blocks[i];
+
+        if (blk == NULL || blk->generation != smcf->sh->generation) {
+            continue;
+        }
+
+        for (j = 0; j < n; j++) {
+            src = (ngx_atomic_t *) &blk->counters[j];
+            dst = (ngx_atomic_t *) &sum[j];
+
+            for (k = 0;
+                 k < sizeof(ngx_http_stub_status_counters_t)
+                     / sizeof(ngx_atomic_t);
+                 k++)
+            {
+                dst[k] += src[k];
+            }
+        }
+    }
+
+    ngx_shmtx_unlock(&smcf->shpool->mutex);
+}
+
+
+static ngx_int_t
+ngx_http_stub_status_log_handler(ngx_http_request_t *r)
+{
+    ngx_http_stub_status_srv_conf_t  *sscf;
+
+    if (ngx_http_stub_status_counters == NULL) {
+        return NGX_OK;
+    }
+
+    ngx_http_stub_status_account(r, &ngx_http_stub_status_counters[0]);
+
+    sscf = ngx_http_get_module_srv_conf(r, ngx_http_stub_status_module);
+
+    if (sscf->zone) {
+        ngx_http_stub_status_account(r,
+                                 &ngx_http_stub_status_counters[sscf->zone]);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_stub_status_account(ngx_http_request_t *r,
+    ngx_http_stub_status_counters_t *c)
+{
+    ngx_uint_t                  i, n, status;
+    ngx_msec_int_t              ms;
+    ngx_http_upstream_state_t  *state;
+
+    c->requests++;
+
+    status = r->err_status ? r->err_status : r->headers_out.status;
+
+    if (status >= 100 && status < 600) {
+        c->responses[status / 100 - 1]++;
+    }
+
+    c->received += r->request_length;
+    c->sent += r->connection->sent;
+
+    if (r->upstream_states) {
+        state = r->upstream_states->elts;
+
+        for (i = 0; i < r->upstream_states->nelts; i++) {
+            if (state[i].status == 0) {
+                continue;
+            }
+
+            ms = (ngx_msec_int_t)
+                     (state[i].response_sec * 1000 + state[i].response_msec);
+            ms = ngx_max(ms, 0);
+
+            for (n = 0; n < NGX_HTTP_STUB_STATUS_BUCKETS - 1; n++) {
+                if ((ngx_msec_t) ms <= ngx_http_stub_status_bounds[n]) {
+                    break;
+                }
+            }
+
+            c->upstream_hist[n]++;
+            c->upstream_responses++;
+            c->upstream_time += ms;
+        }
+    }
+
+#if (NGX_HTTP_CACHE)
+
+    if (r->upstream
+        && r->upstream->cache_status
+        && r->upstream->cache_status <= NGX_HTTP_STUB_STATUS_CACHE)
+    {
+        c->cache[r->upstream->cache_status - 1]++;
+    }
+
+#endif
+}
+
+
+static ngx_int_t
+ngx_http_stub_status_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_stub_status_main_conf_t  *osmcf = data;
+
+    ngx_uint_t                         i;
+    ngx_str_t                         *name, *oname;
+    ngx_http_stub_status_main_conf_t  *smcf;
+
+    smcf = shm_zone->data;
+
+    smcf->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (osmcf) {
+        smcf->sh = osmcf->sh;
+
+        /*
+         * status_zone有变化时，旧的计数器不再统计，
+         * 新进程会重新分配计数器
+         */
+
+        name = smcf->zones.elts;
+        oname = osmcf->zones.elts;
+
+        for (i = 0; i < smcf->zones.nelts; i++) {
+            if (i >= osmcf->zones.nelts
+                || name[i].len != oname[i].len
+                || ngx_strncmp(name[i].data, oname[i].data, name[i].len) != 0)
+            {
+                break;
+            }
+        }
+
+        if (i != smcf->zones.nelts || i != osmcf->zones.nelts) {
+            smcf->sh->generation++;
+        }
+
+        return NGX_OK;
+    }
+
+    if (shm_zone->shm.exists) {
+        smcf->sh = smcf->shpool->data;
+
+        return NGX_OK;
+    }
+
+    smcf->sh = ngx_slab_alloc(smcf->shpool, sizeof(ngx_http_stub_status_sh_t));
+    if (smcf->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(smcf->sh, sizeof(ngx_http_stub_status_sh_t));
+
+    smcf->sh->generation = 1;
+
+    smcf->shpool->data = smcf->sh;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_stub_status_init_process(ngx_cycle_t *cycle)
+{
+    size_t                             size;
+    ngx_http_stub_status_block_t      *blk;
+    ngx_http_stub_status_main_conf_t  *smcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    smcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                               ngx_http_stub_status_module);
+
+    if (smcf == NULL || smcf->sh == NULL) {
+        return NGX_OK;
+    }
+
+    size = offsetof(ngx_http_stub_status_block_t, counters)
+           + (smcf->zones.nelts + 1) * sizeof(ngx_http_stub_status_counters_t);
+
+    ngx_shmtx_lock(&smcf->shpool->mutex);
+
+    /* 使用该slot的上一个进程已退出，同一配置下接着它的计数器统计 */
+
+    blk = smcf->sh->blocks[ngx_process_slot];
+
+    if (blk && blk->generation != smcf->sh->generation) {
+        ngx_slab_free_locked(smcf->shpool, blk);
+        blk = NULL;
+    }
+
+    if (blk == NULL) {
+        blk = ngx_slab_alloc_locked(smcf->shpool, size);
+
+        if (blk) {
+            ngx_memzero(blk, size);
+            blk->generation = smcf->sh->generation;
+        }
+
+        smcf->sh->blocks[ngx_process_slot] = blk;
+    }
+
+    ngx_shmtx_unlock(&smcf->shpool->mutex);
+
+    if (blk == NULL) {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                      "not enough memory for the status counters, "
+                      "requests of this worker will not be counted");
+        return NGX_OK;
+    }
+
+    ngx_http_stub_status_counters = blk->counters;
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_stub_status_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_stub_status_main_conf_t  *smcf;
+
+    smcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_stub_status_main_conf_t));
+    if (smcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     smcf->enable = 0;
+     *     smcf->shm_zone = NULL;
+     *     smcf->sh = NULL;
+     *     smcf->shpool = NULL;
+     */
+
+    if (ngx_array_init(&smcf->zones, cf->pool, 4, sizeof(ngx_str_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return smcf;
+}
+
+
+static void *
+ngx_http_stub_status_create_srv_conf(ngx_conf_t *cf)
+{
+    ngx_http_stub_status_srv_conf_t  *sscf;
+
+    sscf = ngx_pcalloc(cf->pool, sizeof(ngx_http_stub_status_srv_conf_t));
+    if (sscf == NULL) {
+        return NULL;
+    }
+
+    sscf->zone = NGX_CONF_UNSET_UINT;
+
+    return sscf;
+}
+
+
+static char *
+ngx_http_stub_status_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_stub_status_srv_conf_t *prev = parent;
+    ngx_http_stub_status_srv_conf_t *conf = child;
+
+    ngx_conf_merge_uint_value(conf->zone, prev->zone, 0);
+
+    return NGX_CONF_OK;
+}
+
+
 static char *ngx_http_set_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
-    ngx_http_core_loc_conf_t  *clcf;
+    ngx_http_core_loc_conf_t          *clcf;
+    ngx_http_stub_status_main_conf_t  *smcf;
+
+    smcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_stub_status_module);
+    smcf->enable = 1;
 
     clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
     clcf->handler = ngx_http_status_handler;
 
     return NGX_CONF_OK;
 }
+
+
+static char *
+ngx_http_status_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_stub_status_srv_conf_t *sscf = conf;
+
+    ngx_str_t                         *value, *name;
+    ngx_uint_t                         i;
+    ngx_http_stub_status_main_conf_t  *smcf;
+
+    if (sscf->zone != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    smcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_stub_status_module);
+
+    /* 多个server可以使用同一个status_zone */
+
+    name = smcf->zones.elts;
+
+    for (i = 0; i < smcf->zones.nelts; i++) {
+        if (name[i].len == value[1].len
+            && ngx_strncmp(name[i].data, value[1].data, value[1].len) == 0)
+        {
+            sscf->zone = i + 1;
+            return NGX_CONF_OK;
+        }
+    }
+
+    for (i = 0; i < value[1].len; i++) {
+        if (value[1].data[i] == '"' || value[1].data[i] == '\\') {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid status zone name \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    name = ngx_array_push(&smcf->zones);
+    if (name == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *name = value[1];
+
+    sscf->zone = smcf->zones.nelts;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_stub_status_init(ngx_conf_t *cf)
+{
+    size_t                             size;
+    ngx_str_t                          name;
+    ngx_int_t                          workers;
+    ngx_core_conf_t                   *ccf;
+    ngx_http_handler_pt               *h;
+    ngx_http_core_main_conf_t         *cmcf;
+    ngx_http_stub_status_main_conf_t  *smcf;
+
+    smcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_stub_status_module);
+
+    if (!smcf->enable && smcf->zones.nelts == 0) {
+        return NGX_OK;
+    }
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
+                                           ngx_core_module);
+
+    workers = (ccf->worker_processes == NGX_CONF_UNSET)
+              ? 1 : ccf->worker_processes;
+
+    /*
+     * 平滑重启时新旧worker同时存在，另外还有cache manager/loader进程，
+     * 计数器大小(及status_zone的个数)变化时zone会重新创建
+     */
+
+    size = offsetof(ngx_http_stub_status_block_t, counters)
+           + (smcf->zones.nelts + 1) * sizeof(ngx_http_stub_status_counters_t);
+
+    size = 8 * ngx_pagesize
+           + ngx_align(sizeof(ngx_http_stub_status_sh_t), ngx_pagesize)
+           + (2 * workers + 4) * size * 2;
+
+    ngx_str_set(&name, "ngx_http_stub_status");
+
+    smcf->shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                           &ngx_http_stub_status_module);
+    if (smcf->shm_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    smcf->shm_zone->init = ngx_http_stub_status_init_zone;
+    smcf->shm_zone->data = smcf;
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_LOG_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_http_stub_status_log_handler;
+
+    return NGX_OK;
+}
@@ -0,0 +1,995 @@
+
+/*
+ * Copyright (C) agent
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_CHECK_TCP          1
+#define NGX_HTTP_CHECK_HTTP         2
+
+/* the bit number is the first digit of the status code */
+
+#define NGX_HTTP_CHECK_HTTP_2XX     0x0004
+#define NGX_HTTP_CHECK_HTTP_3XX     0x0008
+#define NGX_HTTP_CHECK_HTTP_4XX     0x0010
+#define NGX_HTTP_CHECK_HTTP_5XX     0x0020
+
+#define NGX_HTTP_CHECK_BUFFER_SIZE  4096
+
+
+typedef struct {
+    ngx_uint_t                           type;
+    ngx_msec_t                           interval;
+    ngx_msec_t                           timeout;
+    ngx_uint_t                           rise;
+    ngx_uint_t                           fall;
+
+    ngx_str_t                            send;
+    ngx_uint_t                           expect_alive;
+    ngx_str_t                            expect_body;
+} ngx_http_upstream_check_srv_conf_t;
+
+
+/* 每个worker进程为每个被检查的服务器保存一个检查上下文 */
+
+typedef struct {
+    ngx_http_upstream_check_srv_conf_t  *conf;
+    ngx_http_upstream_srv_conf_t        *upstream;
+    ngx_http_upstream_rr_peers_t        *peers;
+    ngx_http_upstream_rr_peer_t         *peer;
+
+    ngx_event_t                          event;
+    ngx_peer_connection_t                pc;
+    ngx_log_t                            log;
+
+    ngx_buf_t                            send;
+    ngx_buf_t                            recv;
+
+    unsigned                             connected:1;
+} ngx_http_upstream_check_peer_t;
+
+
+static ngx_int_t ngx_http_upstream_check_init_process(ngx_cycle_t *cycle);
+static ngx_int_t ngx_http_upstream_check_add_peers(ngx_cycle_t *cycle,
+    ngx_http_upstream_srv_conf_t *uscf, ngx_http_upstream_rr_peers_t *peers);
+static void ngx_http_upstream_check_begin_handler(ngx_event_t *ev);
+static void ngx_http_upstream_check_connect(
+    ngx_http_upstream_check_peer_t *cp);
+static void ngx_http_upstream_check_send_handler(ngx_event_t *wev);
+static void ngx_http_upstream_check_recv_handler(ngx_event_t *rev);
+static void ngx_http_upstream_check_dummy_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_upstream_check_test_connect(ngx_connection_t *c);
+static ngx_int_t ngx_http_upstream_check_parse(
+    ngx_http_upstream_check_peer_t *cp, ngx_uint_t done);
+static void ngx_http_upstream_check_finish(ngx_http_upstream_check_peer_t *cp,
+    ngx_uint_t alive);
+
+static ngx_int_t ngx_http_upstream_check_status_handler(ngx_http_request_t *r);
+
+static ngx_int_t ngx_http_upstream_check_postconf(ngx_conf_t *cf);
+static void *ngx_http_upstream_check_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_check(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_upstream_check_status(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+
+
+static ngx_conf_bitmask_t  ngx_http_upstream_check_expect_alive_masks[] = {
+    { ngx_string("http_2xx"), NGX_HTTP_CHECK_HTTP_2XX },
+    { ngx_string("http_3xx"), NGX_HTTP_CHECK_HTTP_3XX },
+    { ngx_string("http_4xx"), NGX_HTTP_CHECK_HTTP_4XX },
+    { ngx_string("http_5xx"), NGX_HTTP_CHECK_HTTP_5XX },
+    { ngx_null_string, 0 }
+};
+
+
+static ngx_command_t  ngx_http_upstream_check_commands[] = {
+
+    { ngx_string("check"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_ANY,
+      ngx_http_upstream_check,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("check_http_send"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_str_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_upstream_check_srv_conf_t, send),
+      NULL },
+
+    { ngx_string("check_http_expect_alive"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_1MORE,
+      ngx_conf_set_bitmask_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_upstream_check_srv_conf_t, expect_alive),
+      &ngx_http_upstream_check_expect_alive_masks },
+
+    { ngx_string("check_http_expect_body"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_str_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_upstream_check_srv_conf_t, expect_body),
+      NULL },
+
+    { ngx_string("check_status"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_upstream_check_status,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_check_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_http_upstream_check_postconf,      /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_check_create_conf,   /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_check_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_check_module_ctx,   /* module context */
+    ngx_http_upstream_check_commands,      /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_http_upstream_check_init_process,  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_check_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                           i;
+    ngx_http_upstream_rr_peers_t        *peers;
+    ngx_http_upstream_srv_conf_t       **uscfp;
+    ngx_http_upstream_main_conf_t       *umcf;
+    ngx_http_upstream_check_srv_conf_t  *ucscf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        ucscf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                               ngx_http_upstream_check_module);
+
+        if (ucscf->type == NGX_CONF_UNSET_UINT) {
+            continue;
+        }
+
+        for (peers = uscfp[i]->peer.data; peers; peers = peers->next) {
+            if (ngx_http_upstream_check_add_peers(cycle, uscfp[i], peers)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_check_add_peers(ngx_cycle_t *cycle,
+    ngx_http_upstream_srv_conf_t *uscf, ngx_http_upstream_rr_peers_t *peers)
+{
+    ngx_uint_t                           i;
+    ngx_http_upstream_check_peer_t      *cp;
+    ngx_http_upstream_check_srv_conf_t  *ucscf;
+
+    ucscf = ngx_http_conf_upstream_srv_conf(uscf,
+                                            ngx_http_upstream_check_module);
+
+    cp = ngx_pcalloc(cycle->pool,
+                     sizeof(ngx_http_upstream_check_peer_t) * peers->number);
+    if (cp == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < peers->number; i++) {
+        cp[i].conf = ucscf;
+        cp[i].upstream = uscf;
+        cp[i].peers = peers;
+        cp[i].peer = &peers->peer[i];
+
+        cp[i].log = *cycle->log;
+        cp[i].log.action = "checking upstream";
+
+        if (ucscf->type == NGX_HTTP_CHECK_HTTP) {
+            cp[i].recv.start = ngx_palloc(cycle->pool,
+                                          NGX_HTTP_CHECK_BUFFER_SIZE);
+            if (cp[i].recv.start == NULL) {
+                return NGX_ERROR;
+            }
+
+            cp[i].recv.end = cp[i].recv.start + NGX_HTTP_CHECK_BUFFER_SIZE;
+        }
+
+        cp[i].event.handler = ngx_http_upstream_check_begin_handler;
+        cp[i].event.data = &cp[i];
+        cp[i].event.log = cycle->log;
+        cp[i].event.cancelable = 1;
+
+        /* spread the first checks of the workers over the interval */
+
+        ngx_add_timer(&cp[i].event, ngx_random() % ucscf->interval);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_check_begin_handler(ngx_event_t *ev)
+{
+    ngx_http_upstream_check_peer_t  *cp;
+
+    if (ngx_exiting || ngx_quit || ngx_terminate) {
+        return;
+    }
+
+    cp = ev->data;
+
+    ngx_add_timer(ev, cp->conf->interval);
+
+    if (cp->pc.connection) {
+        return;
+    }
+
+    /* 多个worker共享服务器状态时，一个间隔内只需检查一次 */
+
+    ngx_http_upstream_rr_peers_lock(cp->peers);
+
+    if (cp->peer->check_time
+        && (ngx_msec_int_t) (ngx_current_msec - cp->peer->check_time)
+           < (ngx_msec_int_t) cp->conf->interval / 2)
+    {
+        ngx_http_upstream_rr_peers_unlock(cp->peers);
+        return;
+    }
+
+    cp->peer->check_time = ngx_current_msec;
+
+    ngx_http_upstream_rr_peers_unlock(cp->peers);
+
+    ngx_http_upstream_check_connect(cp);
+}
+
+
+static void
+ngx_http_upstream_check_connect(ngx_http_upstream_check_peer_t *cp)
+{
+    ngx_int_t          rc;
+    ngx_connection_t  *c;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, &cp->log, 0,
+                   "http upstream check: \"%V\"", &cp->peer->name);
+
+    ngx_memzero(&cp->pc, sizeof(ngx_peer_connection_t));
+
+    cp->pc.sockaddr = cp->peer->sockaddr;
+    cp->pc.socklen = cp->peer->socklen;
+    cp->pc.name = &cp->peer->name;
+    cp->pc.get = ngx_event_get_peer;
+    cp->pc.log = &cp->log;
+    cp->pc.log_error = NGX_ERROR_ERR;
+
+    cp->connected = 0;
+
+    rc = ngx_event_connect_peer(&cp->pc);
+
+    if (rc == NGX_ERROR || rc == NGX_DECLINED || rc == NGX_BUSY) {
+        cp->pc.connection = NULL;
+        ngx_http_upstream_check_finish(cp, 0);
+        return;
+    }
+
+    /* rc == NGX_OK || rc == NGX_AGAIN */
+
+    c = cp->pc.connection;
+
+    c->data = cp;
+    c->sendfile = 0;
+
+    c->write->handler = ngx_http_upstream_check_send_handler;
+    c->read->handler = ngx_http_upstream_check_recv_handler;
+
+    cp->send.pos = cp->conf->send.data;
+    cp->send.last = cp->conf->send.data + cp->conf->send.len;
+
+    cp->recv.pos = cp->recv.start;
+    cp->recv.last = cp->recv.start;
+
+    ngx_add_timer(c->write, cp->conf->timeout);
+    ngx_add_timer(c->read, cp->conf->timeout);
+
+    if (rc == NGX_OK) {
+        ngx_http_upstream_check_send_handler(c->write);
+    }
+}
+
+
+static void
+ngx_http_upstream_check_send_handler(ngx_event_t *wev)
+{
+    ssize_t                          n;
+    ngx_connection_t                *c;
+    ngx_http_upstream_check_peer_t  *cp;
+
+    c = wev->data;
+    cp = c->data;
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, ETIMEDOUT,
+                      "upstream check of %V timed out", &cp->peer->name);
+        ngx_http_upstream_check_finish(cp, 0);
+        return;
+    }
+
+    if (!cp->connected) {
+        if (ngx_http_upstream_check_test_connect(c) != NGX_OK) {
+            ngx_http_upstream_check_finish(cp, 0);
+            return;
+        }
+
+        cp->connected = 1;
+
+        if (cp->conf->type == NGX_HTTP_CHECK_TCP) {
+            ngx_http_upstream_check_finish(cp, 1);
+            return;
+        }
+    }
+
+    while (cp->send.pos < cp->send.last) {
+
+        n = c->send(c, cp->send.pos, cp->send.last - cp->send.pos);
+
+        if (n == NGX_ERROR) {
+            ngx_http_upstream_check_finish(cp, 0);
+            return;
+        }
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+                ngx_http_upstream_check_finish(cp, 0);
+            }
+
+            return;
+        }
+
+        cp->send.pos += n;
+    }
+
+    /* the request is sent */
+
+    if (wev->timer_set) {
+        ngx_del_timer(wev);
+    }
+
+    wev->handler = ngx_http_upstream_check_dummy_handler;
+
+    if ((ngx_event_flags & NGX_USE_LEVEL_EVENT) && wev->active) {
+        if (ngx_del_event(wev, NGX_WRITE_EVENT, 0) != NGX_OK) {
+            ngx_http_upstream_check_finish(cp, 0);
+            return;
+        }
+    }
+
+    if (c->read->ready) {
+        ngx_http_upstream_check_recv_handler(c->read);
+    }
+}
+
+
+static void
+ngx_http_upstream_check_recv_handler(ngx_event_t *rev)
+{
+    ssize_t                          n;
+    ngx_int_t                        rc;
+    ngx_connection_t                *c;
+    ngx_http_upstream_check_peer_t  *cp;
+
+    c = rev->data;
+    cp = c->data;
+
+    if (rev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, ETIMEDOUT,
+                      "upstream check of %V timed out", &cp->peer->name);
+        ngx_http_upstream_check_finish(cp, 0);
+        return;
+    }
+
+    if (!cp->connected || cp->send.pos < cp->send.last) {
+
+        /* the response cannot precede the request */
+
+        if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+            ngx_http_upstream_check_finish(cp, 0);
+        }
+
+        return;
+    }
+
+    for ( ;; ) {
+
+        if (cp->recv.last == cp->recv.end) {
+            rc = ngx_http_upstream_check_parse(cp, 1);
+            break;
+        }
+
+        n = c->recv(c, cp->recv.last, cp->recv.end - cp->recv.last);
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+                ngx_http_upstream_check_finish(cp, 0);
+            }
+
+            return;
+        }
+
+        if (n == NGX_ERROR) {
+            ngx_http_upstream_check_finish(cp, 0);
+            return;
+        }
+
+        if (n == 0) {
+            rc = ngx_http_upstream_check_parse(cp, 1);
+            break;
+        }
+
+        cp->recv.last += n;
+
+        rc = ngx_http_upstream_check_parse(cp, 0);
+
+        if (rc != NGX_AGAIN) {
+            break;
+        }
+    }
+
+    ngx_http_upstream_check_finish(cp, rc == NGX_OK);
+}
+
+
+static void
+ngx_http_upstream_check_dummy_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "http upstream check dummy handler");
+}
+
+
+static ngx_int_t
+ngx_http_upstream_check_test_connect(ngx_connection_t *c)
+{
+    int        err;
+    socklen_t  len;
+
+#if (NGX_HAVE_KQUEUE)
+
+    if (ngx_event_flags & NGX_USE_KQUEUE_EVENT)  {
+        if (c->write->pending_eof) {
+            (void) ngx_connection_error(c, c->write->kq_errno,
+                                    "kevent() reported that connect() failed");
+            return NGX_ERROR;
+        }
+
+    } else
+#endif
+    {
+        err = 0;
+        len = sizeof(int);
+
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
+            == -1)
+        {
+            err = ngx_errno;
+        }
+
+        if (err) {
+            (void) ngx_connection_error(c, err, "connect() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * returns NGX_OK if the response is alive, NGX_ERROR if it is not and
+ * NGX_AGAIN if more data are needed; "done" is set when no more data
+ * will come
+ */
+
+static ngx_int_t
+ngx_http_upstream_check_parse(ngx_http_upstream_check_peer_t *cp,
+    ngx_uint_t done)
+{
+    u_char      *p, *last;
+    ngx_uint_t   status, mask;
+
+    p = cp->recv.pos;
+    last = cp->recv.last;
+
+    /* "HTTP/1.x 200" */
+
+    if (last - p < 12) {
+        return done ? NGX_ERROR : NGX_AGAIN;
+    }
+
+    if (ngx_strncmp(p, "HTTP/", 5) != 0 || p[8] != ' ') {
+        ngx_log_error(NGX_LOG_ERR, &cp->log, 0,
+                      "upstream check of %V sent invalid status line",
+                      &cp->peer->name);
+        return NGX_ERROR;
+    }
+
+    if (p[9] < '1' || p[9] > '5'
+        || p[10] < '0' || p[10] > '9'
+        || p[11] < '0' || p[11] > '9')
+    {
+        ngx_log_error(NGX_LOG_ERR, &cp->log, 0,
+                      "upstream check of %V sent invalid status code",
+                      &cp->peer->name);
+        return NGX_ERROR;
+    }
+
+    status = (p[9] - '0') * 100 + (p[10] - '0') * 10 + p[11] - '0';
+
+    mask = (ngx_uint_t) 1 << (status / 100);
+
+    if (!(cp->conf->expect_alive & mask)) {
+        ngx_log_error(NGX_LOG_ERR, &cp->log, 0,
+                      "upstream check of %V responded with status %ui",
+                      &cp->peer->name, status);
+        return NGX_ERROR;
+    }
+
+    if (cp->conf->expect_body.len == 0) {
+        return NGX_OK;
+    }
+
+    p = ngx_strnstr(p, "\r\n\r\n", last - p);
+
+    if (p == NULL) {
+        return done ? NGX_ERROR : NGX_AGAIN;
+    }
+
+    p += sizeof("\r\n\r\n") - 1;
+
+    if (ngx_strnstr(p, (char *) cp->conf->expect_body.data, last - p)) {
+        return NGX_OK;
+    }
+
+    if (!done) {
+        return NGX_AGAIN;
+    }
+
+    ngx_log_error(NGX_LOG_ERR, &cp->log, 0,
+                  "upstream check response of %V does not contain \"%V\"",
+                  &cp->peer->name, &cp->conf->expect_body);
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_http_upstream_check_finish(ngx_http_upstream_check_peer_t *cp,
+    ngx_uint_t alive)
+{
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, &cp->log, 0,
+                   "http upstream check done: \"%V\" %ui",
+                   &cp->peer->name, alive);
+
+    if (cp->pc.connection) {
+        ngx_close_connection(cp->pc.connection);
+        cp->pc.connection = NULL;
+    }
+
+    peer = cp->peer;
+
+    ngx_http_upstream_rr_peers_lock(cp->peers);
+
+    if (alive) {
+        peer->check_fall = 0;
+        peer->check_rise++;
+
+        if (peer->check_down && peer->check_rise >= cp->conf->rise) {
+            peer->check_down = 0;
+            peer->fails = 0;
+
+            ngx_log_error(NGX_LOG_NOTICE, &cp->log, 0,
+                          "upstream \"%V\" server %V is up",
+                          &cp->upstream->host, &peer->name);
+        }
+
+    } else {
+        peer->check_rise = 0;
+        peer->check_fall++;
+
+        if (!peer->check_down && peer->check_fall >= cp->conf->fall) {
+            peer->check_down = 1;
+
+            ngx_log_error(NGX_LOG_ERR, &cp->log, 0,
+                          "upstream \"%V\" server %V is down",
+                          &cp->upstream->host, &peer->name);
+        }
+    }
+
+    ngx_http_upstream_rr_peers_unlock(cp->peers);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_check_status_handler(ngx_http_request_t *r)
+{
+    size_t                               size;
+    ngx_int_t                            rc;
+    ngx_buf_t                           *b;
+    ngx_uint_t                           i, j;
+    ngx_chain_t                          out;
+    ngx_http_upstream_rr_peer_t         *peer;
+    ngx_http_upstream_rr_peers_t        *peers;
+    ngx_http_upstream_srv_conf_t       **uscfp;
+    ngx_http_upstream_main_conf_t       *umcf;
+    ngx_http_upstream_check_srv_conf_t  *ucscf;
+
+    if (r->method != NGX_HTTP_GET && r->method != NGX_HTTP_HEAD) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
+    uscfp = umcf->upstreams.elts;
+
+    size = 0;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        ucscf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                               ngx_http_upstream_check_module);
+
+        if (ucscf->type == NGX_CONF_UNSET_UINT) {
+            continue;
+        }
+
+        size += sizeof("upstream  type: interval: rise: fall:\n") - 1
+                + uscfp[i]->host.len + sizeof("http") - 1
+                + 3 * NGX_INT_T_LEN;
+
+        for (peers = uscfp[i]->peer.data; peers; peers = peers->next) {
+            for (j = 0; j < peers->number; j++) {
+                size += sizeof("     backup down rise: fall:\n") - 1
+                        + peers->peer[j].name.len + 2 * NGX_INT_T_LEN;
+            }
+        }
+    }
+
+    ngx_str_set(&r->headers_out.content_type, "text/plain");
+
+    b = ngx_create_temp_buf(r->pool, size + 1);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        ucscf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                               ngx_http_upstream_check_module);
+
+        if (ucscf->type == NGX_CONF_UNSET_UINT) {
+            continue;
+        }
+
+        b->last = ngx_sprintf(b->last,
+                              "upstream %V type:%s interval:%M "
+                              "rise:%ui fall:%ui\n",
+                              &uscfp[i]->host,
+                              ucscf->type == NGX_HTTP_CHECK_HTTP
+                                  ? "http" : "tcp",
+                              ucscf->interval, ucscf->rise, ucscf->fall);
+
+        for (peers = uscfp[i]->peer.data; peers; peers = peers->next) {
+
+            ngx_http_upstream_rr_peers_lock(peers);
+
+            for (j = 0; j < peers->number; j++) {
+                peer = &peers->peer[j];
+
+                b->last = ngx_sprintf(b->last,
+                                      "    %V%s %s rise:%ui fall:%ui\n",
+                                      &peer->name,
+                                      peers == uscfp[i]->peer.data
+                                          ? "" : " backup",
+                                      peer->check_down ? "down" : "up",
+                                      peer->check_rise, peer->check_fall);
+            }
+
+            ngx_http_upstream_rr_peers_unlock(peers);
+        }
+    }
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    if (r->headers_out.content_length_n == 0) {
+        r->header_only = 1;
+    }
+
+    b->last_buf = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_check_postconf(ngx_conf_t *cf)
+{
+    ngx_uint_t                           i;
+    ngx_http_upstream_srv_conf_t       **uscfp;
+    ngx_http_upstream_main_conf_t       *umcf;
+    ngx_http_upstream_check_srv_conf_t  *ucscf;
+
+    /*
+     * the "check_http_*" directives may follow "check" in an upstream block,
+     * so the defaults are set when the whole configuration is parsed
+     */
+
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        ucscf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                               ngx_http_upstream_check_module);
+
+        if (ucscf->type != NGX_HTTP_CHECK_HTTP) {
+            continue;
+        }
+
+        if (ucscf->send.len == 0) {
+            ngx_str_set(&ucscf->send, "GET / HTTP/1.0\r\n\r\n");
+        }
+
+        if (ucscf->expect_alive == 0) {
+            ucscf->expect_alive = NGX_HTTP_CHECK_HTTP_2XX
+                                  |NGX_HTTP_CHECK_HTTP_3XX;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_upstream_check_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_check_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_check_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->send = { 0, NULL };
+     *     conf->expect_alive = 0;
+     *     conf->expect_body = { 0, NULL };
+     */
+
+    conf->type = NGX_CONF_UNSET_UINT;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_check(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_check_srv_conf_t  *ucscf = conf;
+
+    ngx_int_t                      n;
+    ngx_str_t                     *value, s;
+    ngx_uint_t                     i;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    if (ucscf->type != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    ucscf->type = NGX_HTTP_CHECK_TCP;
+    ucscf->interval = 30000;
+    ucscf->timeout = 1000;
+    ucscf->rise = 2;
+    ucscf->fall = 5;
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "type=", 5) == 0) {
+
+            if (ngx_strcmp(&value[i].data[5], "tcp") == 0) {
+                ucscf->type = NGX_HTTP_CHECK_TCP;
+
+            } else if (ngx_strcmp(&value[i].data[5], "http") == 0) {
+                ucscf->type = NGX_HTTP_CHECK_HTTP;
+
+            } else {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = &value[i].data[9];
+
+            /* 不带单位的数值按毫秒计算 */
+
+            n = ngx_atoi(s.data, s.len);
+
+            if (n == NGX_ERROR) {
+                n = ngx_parse_time(&s, 0);
+            }
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            ucscf->interval = (ngx_msec_t) n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "timeout=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = &value[i].data[8];
+
+            /* 不带单位的数值按毫秒计算 */
+
+            n = ngx_atoi(s.data, s.len);
+
+            if (n == NGX_ERROR) {
+                n = ngx_parse_time(&s, 0);
+            }
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            ucscf->timeout = (ngx_msec_t) n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "rise=", 5) == 0) {
+
+            n = ngx_atoi(&value[i].data[5], value[i].len - 5);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            ucscf->rise = (ngx_uint_t) n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "fall=", 5) == 0) {
+
+            n = ngx_atoi(&value[i].data[5], value[i].len - 5);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            ucscf->fall = (ngx_uint_t) n;
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    if (ngx_strchr(uscf->host.data, '/')) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"check\" is not supported for this upstream");
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+static char *
+ngx_http_upstream_check_status(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_upstream_check_status_handler;
+
+    return NGX_CONF_OK;
+}
@@ -178,9 +178,9 @@ ngx_http_upstream_get_ip_hash_peer(ngx_peer_connection_t *pc, void *data)
 
             peer = &iphp->rrp.peers->peer[p];
 
-            /* ngx_lock_mutex(iphp->rrp.peers->mutex); */
+            ngx_http_upstream_rr_peers_lock(iphp->rrp.peers);
 
-            if (!peer->down) {
+            if (!peer->down && !peer->check_down) {
 
                 if (peer->max_fails == 0 || peer->fails < peer->max_fails) {
                     break;
@@ -194,7 +194,7 @@ ngx_http_upstream_get_ip_hash_peer(ngx_peer_connection_t *pc, void *data)
 
             iphp->rrp.tried[n] |= m;
 
-            /* ngx_unlock_mutex(iphp->rrp.peers->mutex); */
+            ngx_http_upstream_rr_peers_unlock(iphp->rrp.peers);
 
             pc->tries--;
         }
@@ -210,7 +210,7 @@ ngx_http_upstream_get_ip_hash_peer(ngx_peer_connection_t *pc, void *data)
     pc->socklen = peer->socklen;
     pc->name = &peer->name;
 
-    /* ngx_unlock_mutex(iphp->rrp.peers->mutex); */
+    ngx_http_upstream_rr_peers_unlock(iphp->rrp.peers);
 
     iphp->rrp.tried[n] |= m;
     iphp->hash = hash;
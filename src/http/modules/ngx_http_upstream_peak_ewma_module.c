@@ -0,0 +1,450 @@
+
+/*
+ * Copyright (C) agent
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/* 响应时间以 1/1024 毫秒为单位保存，避免使用浮点运算 */
+
+#define NGX_HTTP_UPSTREAM_EWMA_SHIFT  10
+
+
+typedef struct {
+    ngx_msec_t                         decay;
+} ngx_http_upstream_peak_ewma_conf_t;
+
+
+typedef struct {
+    /* the round robin data must be first */
+    ngx_http_upstream_rr_peer_data_t   rrp;
+
+    ngx_msec_t                         decay;
+    ngx_msec_t                         start;
+
+    ngx_event_get_peer_pt              get_rr_peer;
+    ngx_event_free_peer_pt             free_rr_peer;
+} ngx_http_upstream_ewma_peer_data_t;
+
+
+static ngx_int_t ngx_http_upstream_init_peak_ewma_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_peak_ewma_peer(
+    ngx_peer_connection_t *pc, void *data);
+static void ngx_http_upstream_free_peak_ewma_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+static void *ngx_http_upstream_peak_ewma_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_peak_ewma(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_peak_ewma_commands[] = {
+
+    { ngx_string("peak_ewma"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE1,
+      ngx_http_upstream_peak_ewma,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_peak_ewma_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_peak_ewma_create_conf, /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_peak_ewma_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_peak_ewma_module_ctx, /* module context */
+    ngx_http_upstream_peak_ewma_commands,  /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+ngx_int_t
+ngx_http_upstream_init_peak_ewma(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "init peak ewma");
+
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_http_upstream_init_peak_ewma_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_peak_ewma_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_upstream_ewma_peer_data_t  *ewp;
+    ngx_http_upstream_peak_ewma_conf_t  *pecf;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "init peak ewma peer");
+
+    pecf = ngx_http_conf_upstream_srv_conf(us,
+                                           ngx_http_upstream_peak_ewma_module);
+
+    ewp = ngx_palloc(r->pool, sizeof(ngx_http_upstream_ewma_peer_data_t));
+    if (ewp == NULL) {
+        return NGX_ERROR;
+    }
+
+    ewp->decay = pecf->decay;
+    ewp->start = 0;
+
+    r->upstream->peer.data = &ewp->rrp;
+
+    if (ngx_http_upstream_init_round_robin_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.get = ngx_http_upstream_get_peak_ewma_peer;
+    r->upstream->peer.free = ngx_http_upstream_free_peak_ewma_peer;
+
+    ewp->get_rr_peer = ngx_http_upstream_get_round_robin_peer;
+    ewp->free_rr_peer = ngx_http_upstream_free_round_robin_peer;
+
+    return NGX_OK;
+}
+
+
+/*
+ * the cost of a peer is its decayed peak response time multiplied by
+ * the number of requests in flight plus one, divided by the weight;
+ * a peer without samples yet costs just one millisecond per request
+ */
+
+static ngx_inline uint64_t
+ngx_http_upstream_peak_ewma_cost(ngx_http_upstream_rr_peer_t *peer)
+{
+    return (peer->ewma + (1 << NGX_HTTP_UPSTREAM_EWMA_SHIFT))
+           * (peer->conns + 1);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_peak_ewma_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_ewma_peer_data_t  *ewp = data;
+
+    time_t                          now;
+    uint64_t                        cost, best_cost;
+    uintptr_t                       m;
+    ngx_int_t                       rc;
+    ngx_uint_t                      i, n, p;
+    ngx_http_upstream_rr_peer_t    *peer, *best;
+    ngx_http_upstream_rr_peers_t   *peers;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get peak ewma peer, try: %ui", pc->tries);
+
+    ewp->start = ngx_current_msec;
+
+    if (ewp->rrp.peers->single) {
+        return ewp->get_rr_peer(pc, &ewp->rrp);
+    }
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    now = ngx_time();
+
+    peers = ewp->rrp.peers;
+
+    ngx_http_upstream_rr_peers_lock(peers);
+
+    best = NULL;
+    best_cost = 0;
+
+#if (NGX_SUPPRESS_WARN)
+    p = 0;
+#endif
+
+    for (i = 0; i < peers->number; i++) {
+
+        n = i / (8 * sizeof(uintptr_t));
+        m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+        if (ewp->rrp.tried[n] & m) {
+            continue;
+        }
+
+        peer = &peers->peer[i];
+
+        if (peer->down || peer->check_down) {
+            continue;
+        }
+
+        if (peer->max_fails
+            && peer->fails >= peer->max_fails
+            && now - peer->checked <= peer->fail_timeout)
+        {
+            continue;
+        }
+
+        cost = ngx_http_upstream_peak_ewma_cost(peer);
+
+        /*
+         * cost / weight < best_cost / best->weight; on ties prefer
+         * the peer with larger current_weight to spread the load
+         */
+
+        if (best == NULL
+            || cost * best->weight < best_cost * peer->weight
+            || (cost * best->weight == best_cost * peer->weight
+                && peer->current_weight > best->current_weight))
+        {
+            best = peer;
+            best_cost = cost;
+            p = i;
+        }
+    }
+
+    if (best == NULL) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get peak ewma peer, no peer found");
+
+        goto failed;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get peak ewma peer, current: %ui ewma: %uL conns: %ui",
+                   p, best->ewma >> NGX_HTTP_UPSTREAM_EWMA_SHIFT, best->conns);
+
+    if (--best->current_weight <= 0) {
+        best->current_weight = best->weight;
+    }
+
+    if (best->max_fails && best->fails >= best->max_fails) {
+        best->checked = now;
+    }
+
+    ewp->rrp.current = p;
+
+    n = p / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
+
+    ewp->rrp.tried[n] |= m;
+    best->conns++;
+
+    pc->sockaddr = best->sockaddr;
+    pc->socklen = best->socklen;
+    pc->name = &best->name;
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    if (pc->tries == 1 && peers->next) {
+        pc->tries += peers->next->number;
+    }
+
+    return NGX_OK;
+
+failed:
+
+    if (peers->next) {
+
+        ngx_http_upstream_rr_peers_unlock(peers);
+
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get peak ewma peer, backup servers");
+
+        ewp->rrp.peers = peers->next;
+        pc->tries = ewp->rrp.peers->number;
+
+        n = ewp->rrp.peers->number / (8 * sizeof(uintptr_t)) + 1;
+        for (i = 0; i < n; i++) {
+             ewp->rrp.tried[i] = 0;
+        }
+
+        rc = ngx_http_upstream_get_peak_ewma_peer(pc, ewp);
+
+        if (rc != NGX_BUSY) {
+            return rc;
+        }
+
+        ngx_http_upstream_rr_peers_lock(peers);
+    }
+
+    /* all peers failed, mark them as live for quick recovery */
+
+    for (i = 0; i < peers->number; i++) {
+        peers->peer[i].fails = 0;
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    pc->name = peers->name;
+
+    return NGX_BUSY;
+}
+
+
+static void
+ngx_http_upstream_free_peak_ewma_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state)
+{
+    ngx_http_upstream_ewma_peer_data_t  *ewp = data;
+
+    uint64_t                      sample;
+    ngx_msec_t                    now, elapsed;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free peak ewma peer %ui %ui", pc->tries, state);
+
+    if (ewp->rrp.peers->single) {
+        ewp->free_rr_peer(pc, &ewp->rrp, state);
+        return;
+    }
+
+    if (state == 0 && pc->tries == 0) {
+        return;
+    }
+
+    peer = &ewp->rrp.peers->peer[ewp->rrp.current];
+
+    now = ngx_current_msec;
+
+    sample = (uint64_t) (now - ewp->start) << NGX_HTTP_UPSTREAM_EWMA_SHIFT;
+
+    ngx_http_upstream_rr_peers_lock(ewp->rrp.peers);
+
+    peer->conns--;
+
+    if (sample > peer->ewma) {
+
+        /* peak: a slower response is taken into account at once */
+
+        peer->ewma = sample;
+
+    } else if (!(state & NGX_PEER_FAILED)) {
+
+        /*
+         * faster responses decay the average with weight
+         * decay / (decay + elapsed), a rational approximation
+         * of exp(-elapsed / decay)
+         */
+
+        elapsed = now - peer->ewma_stamp;
+
+        peer->ewma = (peer->ewma * ewp->decay + sample * elapsed)
+                   / (ewp->decay + elapsed);
+    }
+
+    peer->ewma_stamp = now;
+
+    ngx_http_upstream_rr_peers_unlock(ewp->rrp.peers);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free peak ewma peer, ewma: %uL conns: %ui",
+                   peer->ewma >> NGX_HTTP_UPSTREAM_EWMA_SHIFT, peer->conns);
+
+    ewp->free_rr_peer(pc, &ewp->rrp, state);
+}
+
+
+static void *
+ngx_http_upstream_peak_ewma_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_peak_ewma_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool,
+                       sizeof(ngx_http_upstream_peak_ewma_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    conf->decay = NGX_CONF_UNSET_MSEC;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_peak_ewma(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_peak_ewma_conf_t  *pecf = conf;
+
+    ngx_str_t                     *value, s;
+    ngx_int_t                      decay;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    if (pecf->decay != NGX_CONF_UNSET_MSEC) {
+        return "is duplicate";
+    }
+
+    pecf->decay = 10000;
+
+    if (cf->args->nelts == 2) {
+        value = cf->args->elts;
+
+        if (ngx_strncmp(value[1].data, "decay=", 6) != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+
+        s.len = value[1].len - 6;
+        s.data = &value[1].data[6];
+
+        decay = ngx_parse_time(&s, 0);
+
+        if (decay == NGX_ERROR || decay == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid decay \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+
+        pecf->decay = (ngx_msec_t) decay;
+    }
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    if (uscf->peer.init_upstream) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "load balancing method redefined");
+    }
+
+    uscf->peer.init_upstream = ngx_http_upstream_init_peak_ewma;
+
+    uscf->flags = NGX_HTTP_UPSTREAM_CREATE
+                  |NGX_HTTP_UPSTREAM_WEIGHT
+                  |NGX_HTTP_UPSTREAM_MAX_FAILS
+                  |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
+                  |NGX_HTTP_UPSTREAM_DOWN
+                  |NGX_HTTP_UPSTREAM_BACKUP;
+
+    return NGX_CONF_OK;
+}
@@ -37,6 +37,15 @@ static ngx_int_t ngx_http_init_locations(ngx_conf_t *cf,
     ngx_http_core_srv_conf_t *cscf, ngx_http_core_loc_conf_t *pclcf);
 static ngx_int_t ngx_http_init_static_location_trees(ngx_conf_t *cf,
     ngx_http_core_loc_conf_t *pclcf);
+#if (NGX_PCRE)
+static ngx_int_t ngx_http_init_regex_location_groups(ngx_conf_t *cf,
+    ngx_http_core_loc_conf_t *pclcf, ngx_uint_t n);
+#ifdef PCRE_EXTRA_MARK
+static ngx_uint_t ngx_http_regex_location_combinable(ngx_str_t *name);
+static ngx_regex_t *ngx_http_regex_location_combine(ngx_conf_t *cf,
+    ngx_http_core_loc_conf_t **clcfp, ngx_uint_t n, ngx_uint_t filter);
+#endif
+#endif
 static ngx_int_t ngx_http_cmp_locations(const ngx_queue_t *one,
     const ngx_queue_t *two);
 static ngx_int_t ngx_http_join_exact_locations(ngx_conf_t *cf,
@@ -440,7 +449,7 @@ ngx_http_init_headers_in_hash(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
         return NGX_ERROR;
     }
 
-    return NGX_OK;
+    return ngx_http_init_known_headers_in(cf);
 }
 
 
@@ -816,6 +825,10 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
         *clcfp = NULL;
 
         ngx_queue_split(locations, regex, &tail);
+
+        if (ngx_http_init_regex_location_groups(cf, pclcf, r) != NGX_OK) {
+            return NGX_ERROR;
+        }
     }
 
 #endif
@@ -824,6 +837,241 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
 }
 
 
+#if (NGX_PCRE)
+
+#define NGX_HTTP_REGEX_GROUP_SIZE  64
+
+
+static ngx_int_t
+ngx_http_init_regex_location_groups(ngx_conf_t *cf,
+    ngx_http_core_loc_conf_t *pclcf, ngx_uint_t n)
+{
+    ngx_uint_t                        i, k;
+    ngx_http_core_loc_conf_t        **clcfp;
+    ngx_http_regex_location_group_t  *rg;
+
+    rg = ngx_pcalloc(cf->pool,
+                     (n + 1) * sizeof(ngx_http_regex_location_group_t));
+    if (rg == NULL) {
+        return NGX_ERROR;
+    }
+
+    pclcf->regex_groups = rg;
+    clcfp = pclcf->regex_locations;
+
+    for (i = 0; i < n; i += k) {
+
+        rg->locations = &clcfp[i];
+
+#ifdef PCRE_EXTRA_MARK
+
+        for (k = 0; i + k < n && k < NGX_HTTP_REGEX_GROUP_SIZE; k++) {
+            if (!ngx_http_regex_location_combinable(&clcfp[i + k]->name)) {
+                break;
+            }
+        }
+
+        if (k > 1) {
+            rg->filter = ngx_http_regex_location_combine(cf, &clcfp[i], k, 1);
+            rg->regex = ngx_http_regex_location_combine(cf, &clcfp[i], k, 0);
+
+        } else {
+            k = 1;
+        }
+
+#else
+        k = 1;
+#endif
+
+        rg->nlocations = k;
+        rg++;
+    }
+
+    return NGX_OK;
+}
+
+
+#ifdef PCRE_EXTRA_MARK
+
+/*
+ * a regex cannot be combined if its meaning depends on the capture numbers,
+ * or if it can consume the rest of the combined pattern or control its
+ * backtracking: backreferences, subroutine calls, \Q without \E, extended
+ * mode comments and backtracking verbs
+ */
+
+static ngx_uint_t
+ngx_http_regex_location_combinable(ngx_str_t *name)
+{
+    u_char  *p, *q, *last;
+
+    last = name->data + name->len;
+
+    for (p = name->data; p < last; p++) {
+
+        if (*p == '\\') {
+
+            if (++p == last) {
+                return 0;
+            }
+
+            if ((*p >= '1' && *p <= '9')
+                || *p == 'g' || *p == 'k' || *p == 'Q')
+            {
+                return 0;
+            }
+
+            continue;
+        }
+
+        if (*p != '(' || p + 1 == last) {
+            continue;
+        }
+
+        if (p[1] == '*') {
+            return 0;
+        }
+
+        if (p[1] != '?' || p + 2 == last) {
+            continue;
+        }
+
+        q = p + 2;
+
+        if (*q == 'R' || *q == '&' || (*q >= '0' && *q <= '9')) {
+            return 0;
+        }
+
+        if (q + 1 < last) {
+
+            if ((*q == '+' || *q == '-') && q[1] >= '0' && q[1] <= '9') {
+                return 0;
+            }
+
+            if (*q == 'P' && (q[1] == '=' || q[1] == '>')) {
+                return 0;
+            }
+        }
+
+        /* option letters */
+
+        for ( /* void */ ; q < last; q++) {
+
+            if (*q == 'x') {
+                return 0;
+            }
+
+            if (!((*q >= 'a' && *q <= 'z')
+                  || (*q >= 'A' && *q <= 'Z') || *q == '-'))
+            {
+                break;
+            }
+        }
+    }
+
+    return 1;
+}
+
+
+/*
+ * the combined regex is anchored and every alternative may skip any prefix
+ * of the URI, so the alternatives are tried in the order of locations:
+ *
+ *     (?J)^(?:(?s:.*?)(?:re0)(*MARK:0)|(?s:.*?)(?i:re1)(*MARK:1)|...)
+ *
+ * the mark names the first location which matches anywhere in the URI;
+ * skipping a prefix is expensive without JIT, so a group is first tested
+ * by a plain unanchored alternation which tells only whether any location
+ * of the group matches:
+ *
+ *     (?J)(?:(?:re0)|(?i:re1)|...)
+ */
+
+static ngx_regex_t *
+ngx_http_regex_location_combine(ngx_conf_t *cf,
+    ngx_http_core_loc_conf_t **clcfp, ngx_uint_t n, ngx_uint_t filter)
+{
+    size_t               len;
+    u_char              *p;
+    ngx_uint_t           i;
+    ngx_regex_compile_t  rc;
+    u_char               errstr[NGX_MAX_CONF_ERRSTR];
+
+    len = sizeof("(?J)^(?:)");
+
+    for (i = 0; i < n; i++) {
+        len += sizeof("(?s:.*?)(?i:)(*MARK:)|") - 1 + NGX_INT_T_LEN
+               + clcfp[i]->name.len;
+    }
+
+    p = ngx_pnalloc(cf->temp_pool, len);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    ngx_memzero(&rc, sizeof(ngx_regex_compile_t));
+
+    rc.pattern.data = p;
+
+    if (filter) {
+        p = ngx_cpymem(p, "(?J)(?:", sizeof("(?J)(?:") - 1);
+
+    } else {
+        p = ngx_cpymem(p, "(?J)^(?:", sizeof("(?J)^(?:") - 1);
+    }
+
+    for (i = 0; i < n; i++) {
+
+        if (i) {
+            *p++ = '|';
+        }
+
+        if (filter) {
+            p = ngx_sprintf(p, "(?%s:%V)",
+                            clcfp[i]->regex_caseless ? "i" : "",
+                            &clcfp[i]->name);
+            continue;
+        }
+
+        /*
+         * every alternative skips a prefix, even if the regex starts with "^":
+         * the "^" may anchor only one branch of a top-level alternation
+         */
+
+        p = ngx_cpymem(p, "(?s:.*?)", sizeof("(?s:.*?)") - 1);
+
+        p = ngx_sprintf(p, "(?%s:%V)(*MARK:%ui)",
+                        clcfp[i]->regex_caseless ? "i" : "",
+                        &clcfp[i]->name, i);
+    }
+
+    *p++ = ')';
+
+    rc.pattern.len = p - rc.pattern.data;
+
+    *p = '\0';
+
+    rc.pool = cf->pool;
+    rc.err.len = NGX_MAX_CONF_ERRSTR;
+    rc.err.data = errstr;
+
+    if (ngx_regex_compile(&rc) != NGX_OK) {
+
+        /* e.g. the pattern is too large, the locations are tested one by one */
+
+        ngx_log_error(NGX_LOG_INFO, cf->log, 0,
+                      "regex locations are not combined: %V", &rc.err);
+        return NULL;
+    }
+
+    return rc.regex;
+}
+
+#endif
+
+#endif
+
+
 static ngx_int_t
 ngx_http_init_static_location_trees(ngx_conf_t *cf,
     ngx_http_core_loc_conf_t *pclcf)
@@ -1748,6 +1996,10 @@ ngx_http_init_listening(ngx_conf_t *cf, ngx_http_conf_port_t *port)
             break;
         }
 
+        if (ngx_clone_listening(cf, ls) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
         addr++;
         last--;
     }
@@ -1822,6 +2074,10 @@ ngx_http_add_listening(ngx_conf_t *cf, ngx_http_conf_addr_t *addr)
     ls->setfib = addr->opt.setfib;
 #endif
 
+#if (NGX_HAVE_REUSEPORT)
+    ls->reuseport = addr->opt.reuseport;
+#endif
+
     return ls;
 }
 
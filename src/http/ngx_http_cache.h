@@ -19,10 +19,19 @@
 #define NGX_HTTP_CACHE_EXPIRED       3
 #define NGX_HTTP_CACHE_STALE         4
 #define NGX_HTTP_CACHE_UPDATING      5
-#define NGX_HTTP_CACHE_HIT           6
-#define NGX_HTTP_CACHE_SCARCE        7
+#define NGX_HTTP_CACHE_REVALIDATED   6
+#define NGX_HTTP_CACHE_HIT           7
+#define NGX_HTTP_CACHE_SCARCE        8
 
 #define NGX_HTTP_CACHE_KEY_LEN       16
+/* 更长的ETag不保存，这样的响应重新验证时不发送If-None-Match */
+#define NGX_HTTP_CACHE_ETAG_LEN      42
+
+#define NGX_HTTP_CACHE_VERSION       1
+
+#define NGX_HTTP_FILE_CACHE_LRU      0
+#define NGX_HTTP_FILE_CACHE_SLRU     1
+#define NGX_HTTP_FILE_CACHE_TINYLFU  2
 
 
 typedef struct {
@@ -45,7 +54,9 @@ typedef struct {
     unsigned                         exists:1;
     unsigned                         updating:1;
     unsigned                         deleting:1;
-                                     /* 11 unused bits */
+    unsigned                         snapshot:1;
+    unsigned                         hot:1;
+                                     /* 9 unused bits */
 
     ngx_file_uniq_t                  uniq;
     time_t                           expire;
@@ -66,12 +77,15 @@ struct ngx_http_cache_s {
     time_t                           last_modified;
     time_t                           date;
 
+    ngx_str_t                        etag;
+
     size_t                           header_start;
     size_t                           body_start;
     off_t                            length;
     off_t                            fs_size;
 
     ngx_uint_t                       min_uses;
+    ngx_uint_t                       uses;
     ngx_uint_t                       error;
     ngx_uint_t                       valid_msec;
 
@@ -85,6 +99,10 @@ struct ngx_http_cache_s {
 
     ngx_event_t                      wait_event;
 
+#if (NGX_THREAD_POOL)
+    ngx_thread_task_t               *thread_task;
+#endif
+
     unsigned                         lock:1;
     unsigned                         waiting:1;
 
@@ -92,10 +110,13 @@ struct ngx_http_cache_s {
     unsigned                         updating:1;
     unsigned                         exists:1;
     unsigned                         temp_file:1;
+    unsigned                         memory:1;
+    unsigned                         background:1;
 };
 
 
 typedef struct {
+    ngx_uint_t                       version;
     time_t                           valid_sec;
     time_t                           last_modified;
     time_t                           date;
@@ -103,6 +124,8 @@ typedef struct {
     u_short                          valid_msec;
     u_short                          header_start;
     u_short                          body_start;
+    u_char                           etag_len;
+    u_char                           etag[NGX_HTTP_CACHE_ETAG_LEN];
 } ngx_http_file_cache_header_t;
 
 
@@ -110,12 +133,45 @@ typedef struct {
     ngx_rbtree_t                     rbtree;
     ngx_rbtree_node_t                sentinel;
     ngx_queue_t                      queue;
+    ngx_queue_t                      hot;
     ngx_atomic_t                     cold;
     ngx_atomic_t                     loading;
     off_t                            size;
+    off_t                            hot_size;
+
+    u_char                          *sketch;
+    ngx_uint_t                       sketch_mask;
+    ngx_uint_t                       sketch_additions;
+
+    ngx_uint_t                       lookups;
+    ngx_uint_t                       hits;
+    ngx_uint_t                       rejected;
+    ngx_uint_t                       evicted;
 } ngx_http_file_cache_sh_t;
 
 
+/* the layout up to the key is the same as of ngx_http_file_cache_node_t */
+
+typedef struct {
+    ngx_rbtree_node_t                node;
+    ngx_queue_t                      queue;
+
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN
+                                         - sizeof(ngx_rbtree_key_t)];
+
+    size_t                           len;
+    u_char                           data[1];
+} ngx_http_file_cache_memory_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                     rbtree;
+    ngx_rbtree_node_t                sentinel;
+    ngx_queue_t                      queue;
+    size_t                           size;
+} ngx_http_file_cache_memory_sh_t;
+
+
 struct ngx_http_file_cache_s {
     ngx_http_file_cache_sh_t        *sh;
     ngx_slab_pool_t                 *shpool;
@@ -127,13 +183,25 @@ struct ngx_http_file_cache_s {
 
     time_t                           inactive;
 
+    ngx_uint_t                       policy;
+
     ngx_uint_t                       files;
     ngx_uint_t                       loader_files;
     ngx_msec_t                       last;
     ngx_msec_t                       loader_sleep;
     ngx_msec_t                       loader_threshold;
 
+    ngx_str_t                        snapshot;
+    time_t                           snapshot_interval;
+    time_t                           snapshot_next;
+
+    ngx_http_file_cache_memory_sh_t *memory;
+    ngx_slab_pool_t                 *memory_shpool;
+    size_t                           memory_max_object;
+    ngx_uint_t                       memory_min_uses;
+
     ngx_shm_zone_t                  *shm_zone;
+    ngx_shm_zone_t                  *memory_zone;
 };
 
 
@@ -143,9 +211,11 @@ void ngx_http_file_cache_create_key(ngx_http_request_t *r);
 ngx_int_t ngx_http_file_cache_open(ngx_http_request_t *r);
 void ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf);
 void ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf);
+void ngx_http_file_cache_update_header(ngx_http_request_t *r);
 ngx_int_t ngx_http_cache_send(ngx_http_request_t *);
 void ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf);
 time_t ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status);
+ngx_http_file_cache_t *ngx_http_file_cache_zone(ngx_shm_zone_t *shm_zone);
 
 char *ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -154,6 +224,7 @@ char *ngx_http_file_cache_valid_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
 
 
 extern ngx_str_t  ngx_http_cache_status[];
+extern ngx_str_t  ngx_http_file_cache_policies[];
 
 
 #endif /* _NGX_HTTP_CACHE_H_INCLUDED_ */
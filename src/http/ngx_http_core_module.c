@@ -26,6 +26,7 @@ static ngx_int_t ngx_http_core_find_static_location(ngx_http_request_t *r,
     ngx_http_location_tree_node_t *node);
 
 static ngx_int_t ngx_http_core_preconfiguration(ngx_conf_t *cf);
+static ngx_int_t ngx_http_core_init_process(ngx_cycle_t *cycle);
 static void *ngx_http_core_create_main_conf(ngx_conf_t *cf);
 static char *ngx_http_core_init_main_conf(ngx_conf_t *cf, void *conf);
 static void *ngx_http_core_create_srv_conf(ngx_conf_t *cf);
@@ -54,6 +55,10 @@ static char *ngx_http_core_server_name(ngx_conf_t *cf, ngx_command_t *cmd,
 static char *ngx_http_core_root(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_http_core_limit_except(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+#if (NGX_HAVE_FILE_AIO || NGX_THREAD_POOL)
+static char *ngx_http_core_set_aio(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+#endif
 static char *ngx_http_core_directio(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_core_error_page(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -111,19 +116,6 @@ static ngx_conf_enum_t  ngx_http_core_request_body_in_file[] = {
 };
 
 
-#if (NGX_HAVE_FILE_AIO)
-
-static ngx_conf_enum_t  ngx_http_core_aio[] = {
-    { ngx_string("off"), NGX_HTTP_AIO_OFF  },
-    { ngx_string("on"), NGX_HTTP_AIO_ON },
-#if (NGX_HAVE_AIO_SENDFILE)
-    { ngx_string("sendfile"), NGX_HTTP_AIO_SENDFILE },
-#endif
-    { ngx_null_string, 0 }
-};
-
-#endif
-
 
 static ngx_conf_enum_t  ngx_http_core_satisfy[] = {
     { ngx_string("all"), NGX_HTTP_SATISFY_ALL },
@@ -207,6 +199,13 @@ static ngx_command_t  ngx_http_core_commands[] = {
       offsetof(ngx_http_core_main_conf_t, variables_hash_bucket_size),
       NULL },
 
+    { ngx_string("request_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_core_main_conf_t, request_cache),
+      NULL },
+
     { ngx_string("server_names_hash_max_size"),
       NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_num_slot,
@@ -420,14 +419,14 @@ static ngx_command_t  ngx_http_core_commands[] = {
       offsetof(ngx_http_core_loc_conf_t, sendfile_max_chunk),
       NULL },
 
-#if (NGX_HAVE_FILE_AIO)
+#if (NGX_HAVE_FILE_AIO || NGX_THREAD_POOL)
 
     { ngx_string("aio"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
-      ngx_conf_set_enum_slot,
+      ngx_http_core_set_aio,
       NGX_HTTP_LOC_CONF_OFFSET,
-      offsetof(ngx_http_core_loc_conf_t, aio),
-      &ngx_http_core_aio },
+      0,
+      NULL },
 
 #endif
 
@@ -805,7 +804,7 @@ ngx_module_t  ngx_http_core_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_core_init_process,            /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -1542,9 +1541,13 @@ ngx_http_core_find_location(ngx_http_request_t *r)
     ngx_int_t                  rc;
     ngx_http_core_loc_conf_t  *pclcf;
 #if (NGX_PCRE)
-    ngx_int_t                  n;
-    ngx_uint_t                 noregex;
-    ngx_http_core_loc_conf_t  *clcf, **clcfp;
+    ngx_int_t                         n;
+    ngx_uint_t                        noregex;
+    ngx_http_core_loc_conf_t         *clcf, **clcfp, **last;
+    ngx_http_regex_location_group_t  *rg;
+#ifdef PCRE_EXTRA_MARK
+    u_char                           *mark;
+#endif
 
     noregex = 0;
 #endif
@@ -1576,28 +1579,92 @@ ngx_http_core_find_location(ngx_http_request_t *r)
 
     if (noregex == 0 && pclcf->regex_locations) {
 
-        for (clcfp = pclcf->regex_locations; *clcfp; clcfp++) {
+        for (rg = pclcf->regex_groups; rg->nlocations; rg++) {
 
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                           "test location: ~ \"%V\"", &(*clcfp)->name);
+            clcfp = rg->locations;
+            last = clcfp + rg->nlocations;
 
-            n = ngx_http_regex_exec(r, (*clcfp)->regex, &r->uri);
+#ifdef PCRE_EXTRA_MARK
 
-            if (n == NGX_OK) {
-                r->loc_conf = (*clcfp)->loc_conf;
+            if (rg->filter) {
 
-                /* look up nested locations */
+                /* 先判断该组中是否有location匹配 */
 
-                rc = ngx_http_core_find_location(r);
+                n = ngx_regex_exec(rg->filter, &r->uri, NULL, 0);
+
+                if (n == NGX_REGEX_NO_MATCHED) {
+                    continue;
+                }
 
-                return (rc == NGX_ERROR) ? rc : NGX_OK;
+                if (n < 0) {
+                    ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                                  ngx_regex_exec_n " failed: %i on \"%V\" "
+                                  "using combined regex of \"%V\"",
+                                  n, &r->uri, &(*clcfp)->name);
+                    return NGX_ERROR;
+                }
             }
 
-            if (n == NGX_DECLINED) {
-                continue;
+            if (rg->regex) {
+
+                /* 一次匹配找出该组中第一个匹配的location */
+
+                n = ngx_regex_exec_mark(rg->regex, &r->uri, &mark);
+
+                if (n == NGX_REGEX_NO_MATCHED) {
+
+                    if (rg->filter == NULL) {
+                        continue;
+                    }
+
+                    /* 与过滤结果不一致时逐个测试该组的location */
+
+                    mark = NULL;
+
+                } else if (n < 0) {
+                    ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                                  ngx_regex_exec_n " failed: %i on \"%V\" "
+                                  "using combined regex of \"%V\"",
+                                  n, &r->uri, &(*clcfp)->name);
+                    return NGX_ERROR;
+                }
+
+                if (mark) {
+                    n = ngx_atoi(mark, ngx_strlen(mark));
+
+                    if (n >= 0 && n < (ngx_int_t) rg->nlocations) {
+                        clcfp += n;
+                    }
+                }
             }
 
-            return NGX_ERROR;
+#endif
+
+            /* the match is repeated with the location regex for captures */
+
+            for ( /* void */ ; clcfp < last; clcfp++) {
+
+                ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                               "test location: ~ \"%V\"", &(*clcfp)->name);
+
+                n = ngx_http_regex_exec(r, (*clcfp)->regex, &r->uri);
+
+                if (n == NGX_OK) {
+                    r->loc_conf = (*clcfp)->loc_conf;
+
+                    /* look up nested locations */
+
+                    rc = ngx_http_core_find_location(r);
+
+                    return (rc == NGX_ERROR) ? rc : NGX_OK;
+                }
+
+                if (n == NGX_DECLINED) {
+                    continue;
+                }
+
+                return NGX_ERROR;
+            }
         }
     }
 #endif
@@ -1915,6 +1982,11 @@ ngx_http_output_filter(ngx_http_request_t *r, ngx_chain_t *in)
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
                    "http output filter \"%V?%V\"", &r->uri, &r->args);
 
+    if (r->background) {
+        /* 后台子请求的输出不发给客户端 */
+        return NGX_OK;
+    }
+
     rc = ngx_http_top_body_filter(r, in);
 
     if (rc == NGX_ERROR) {
@@ -2441,6 +2513,7 @@ ngx_http_subrequest(ngx_http_request_t *r,
 
     sr->subrequest_in_memory = (flags & NGX_HTTP_SUBREQUEST_IN_MEMORY) != 0;
     sr->waited = (flags & NGX_HTTP_SUBREQUEST_WAITED) != 0;
+    sr->background = (flags & NGX_HTTP_SUBREQUEST_BACKGROUND) != 0;
 
     sr->unparsed_uri = r->unparsed_uri;
     sr->method_name = ngx_http_core_get_method;
@@ -2454,29 +2527,31 @@ ngx_http_subrequest(ngx_http_request_t *r,
     sr->read_event_handler = ngx_http_request_empty_handler;
     sr->write_event_handler = ngx_http_handler;
 
-    if (c->data == r && r->postponed == NULL) {
-        c->data = sr;
-    }
-
     sr->variables = r->variables;
 
     sr->log_handler = r->log_handler;
 
-    pr = ngx_palloc(r->pool, sizeof(ngx_http_postponed_request_t));
-    if (pr == NULL) {
-        return NGX_ERROR;
-    }
+    if (!sr->background) {
+        if (c->data == r && r->postponed == NULL) {
+            c->data = sr;
+        }
+
+        pr = ngx_palloc(r->pool, sizeof(ngx_http_postponed_request_t));
+        if (pr == NULL) {
+            return NGX_ERROR;
+        }
 
-    pr->request = sr;
-    pr->out = NULL;
-    pr->next = NULL;
+        pr->request = sr;
+        pr->out = NULL;
+        pr->next = NULL;
 
-    if (r->postponed) {
-        for (p = r->postponed; p->next; p = p->next) { /* void */ }
-        p->next = pr;
+        if (r->postponed) {
+            for (p = r->postponed; p->next; p = p->next) { /* void */ }
+            p->next = pr;
 
-    } else {
-        r->postponed = pr;
+        } else {
+            r->postponed = pr;
+        }
     }
 
     sr->internal = 1;
@@ -3062,6 +3137,7 @@ ngx_http_core_regex_location(ngx_conf_t *cf, ngx_http_core_loc_conf_t *clcf,
     }
 
     clcf->name = *regex;
+    clcf->regex_caseless = rc.options ? 1 : 0;
 
     return NGX_OK;
 
@@ -3182,6 +3258,22 @@ ngx_http_core_preconfiguration(ngx_conf_t *cf)
     return ngx_http_variables_add_core_vars(cf);
 }
 
+
+static ngx_int_t
+ngx_http_core_init_process(ngx_cycle_t *cycle)
+{
+    ngx_http_core_main_conf_t  *cmcf;
+
+    cmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_core_module);
+
+    if (cmcf) {
+        ngx_http_request_cache.pools.max = cmcf->request_cache;
+        ngx_http_request_cache.max = cmcf->request_cache;
+    }
+
+    return NGX_OK;
+}
+
 //create_main_conf()
 static void *
 ngx_http_core_create_main_conf(ngx_conf_t *cf)
@@ -3206,6 +3298,8 @@ ngx_http_core_create_main_conf(ngx_conf_t *cf)
     cmcf->variables_hash_max_size = NGX_CONF_UNSET_UINT;
     cmcf->variables_hash_bucket_size = NGX_CONF_UNSET_UINT;
 
+    cmcf->request_cache = NGX_CONF_UNSET_UINT;
+
     return cmcf;
 }
 
@@ -3235,6 +3329,10 @@ ngx_http_core_init_main_conf(ngx_conf_t *cf, void *conf)
         cmcf->variables_hash_bucket_size = 64;
     }
 
+    if (cmcf->request_cache == NGX_CONF_UNSET_UINT) {
+        cmcf->request_cache = 256;
+    }
+
     cmcf->variables_hash_bucket_size =
                ngx_align(cmcf->variables_hash_bucket_size, ngx_cacheline_size);
 
@@ -3395,8 +3493,11 @@ ngx_http_core_create_loc_conf(ngx_conf_t *cf)
     clcf->internal = NGX_CONF_UNSET;
     clcf->sendfile = NGX_CONF_UNSET;
     clcf->sendfile_max_chunk = NGX_CONF_UNSET_SIZE;
-#if (NGX_HAVE_FILE_AIO)
+#if (NGX_HAVE_FILE_AIO || NGX_THREAD_POOL)
     clcf->aio = NGX_CONF_UNSET;
+#endif
+#if (NGX_THREAD_POOL)
+    clcf->thread_pool = NGX_CONF_UNSET_PTR;
 #endif
     clcf->read_ahead = NGX_CONF_UNSET_SIZE;
     clcf->directio = NGX_CONF_UNSET;
@@ -3613,8 +3714,11 @@ ngx_http_core_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->sendfile, prev->sendfile, 0);
     ngx_conf_merge_size_value(conf->sendfile_max_chunk,
                               prev->sendfile_max_chunk, 0);
-#if (NGX_HAVE_FILE_AIO)
+#if (NGX_HAVE_FILE_AIO || NGX_THREAD_POOL)
     ngx_conf_merge_value(conf->aio, prev->aio, NGX_HTTP_AIO_OFF);
+#endif
+#if (NGX_THREAD_POOL)
+    ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
 #endif
     ngx_conf_merge_size_value(conf->read_ahead, prev->read_ahead, 0);
     ngx_conf_merge_off_value(conf->directio, prev->directio,
@@ -3889,6 +3993,19 @@ ngx_http_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strcmp(value[n].data, "reuseport") == 0) {
+#if (NGX_HAVE_REUSEPORT)
+            lsopt.reuseport = 1;
+            lsopt.set = 1;
+            lsopt.bind = 1;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "reuseport is not supported "
+                               "on this platform, ignored");
+#endif
+            continue;
+        }
+
         if (ngx_strncmp(value[n].data, "ipv6only=o", 10) == 0) {
 #if (NGX_HAVE_INET6 && defined IPV6_V6ONLY)
             struct sockaddr  *sa;
@@ -4365,6 +4482,81 @@ ngx_http_core_limit_except(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+#if (NGX_HAVE_FILE_AIO || NGX_THREAD_POOL)
+
+static char *
+ngx_http_core_set_aio(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t *clcf = conf;
+
+    ngx_str_t  *value;
+#if (NGX_THREAD_POOL)
+    ngx_str_t   name;
+#endif
+
+    if (clcf->aio != NGX_CONF_UNSET) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        clcf->aio = NGX_HTTP_AIO_OFF;
+        return NGX_CONF_OK;
+    }
+
+#if (NGX_HAVE_FILE_AIO)
+
+    if (ngx_strcmp(value[1].data, "on") == 0) {
+        clcf->aio = NGX_HTTP_AIO_ON;
+        return NGX_CONF_OK;
+    }
+
+#if (NGX_HAVE_AIO_SENDFILE)
+
+    if (ngx_strcmp(value[1].data, "sendfile") == 0) {
+        clcf->aio = NGX_HTTP_AIO_SENDFILE;
+        return NGX_CONF_OK;
+    }
+
+#endif
+
+#endif
+
+#if (NGX_THREAD_POOL)
+
+    /* aio threads[=pool]：在线程池中读取文件 */
+
+    if (ngx_strncmp(value[1].data, "threads", 7) == 0
+        && (value[1].len == 7 || value[1].data[7] == '='))
+    {
+        clcf->aio = NGX_HTTP_AIO_THREADS;
+
+        if (value[1].len > 8) {
+            name.len = value[1].len - 8;
+            name.data = value[1].data + 8;
+
+            clcf->thread_pool = ngx_thread_pool_add(cf, &name);
+
+        } else {
+            clcf->thread_pool = ngx_thread_pool_add(cf, NULL);
+        }
+
+        if (clcf->thread_pool == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        return NGX_CONF_OK;
+    }
+
+#endif
+
+    return "invalid value";
+}
+
+#endif
+
+
 static char *
 ngx_http_core_directio(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -13,6 +13,10 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#if (NGX_THREAD_POOL)
+#include <ngx_thread_pool.h>
+#endif
+
 
 #define NGX_HTTP_GZIP_PROXIED_OFF       0x0002
 #define NGX_HTTP_GZIP_PROXIED_EXPIRED   0x0004
@@ -28,6 +32,7 @@
 #define NGX_HTTP_AIO_OFF                0
 #define NGX_HTTP_AIO_ON                 1
 #define NGX_HTTP_AIO_SENDFILE           2
+#define NGX_HTTP_AIO_THREADS            3
 
 
 #define NGX_HTTP_SATISFY_ALL            0
@@ -50,6 +55,8 @@
 
 
 typedef struct ngx_http_location_tree_node_s  ngx_http_location_tree_node_t;
+typedef struct ngx_http_regex_location_group_s
+    ngx_http_regex_location_group_t;
 typedef struct ngx_http_core_loc_conf_s  ngx_http_core_loc_conf_t;
 
 
@@ -79,6 +86,9 @@ typedef struct {
     unsigned                   ipv6only:2;
 #endif
     unsigned                   so_keepalive:2;
+#if (NGX_HAVE_REUSEPORT)
+    unsigned                   reuseport:1;
+#endif
 
     int                        backlog;
     int                        rcvbuf;
@@ -174,6 +184,8 @@ typedef struct {
 
     ngx_uint_t                 try_files;       /* unsigned  try_files:1 */
 
+    ngx_uint_t                 request_cache;
+
     ngx_http_phase_t           phases[NGX_HTTP_LOG_PHASE + 1];/*在初始化时帮助HTTP框架添加处理方法，初始化完毕后，该数组是无用的*/
 } ngx_http_core_main_conf_t;
 
@@ -329,6 +341,7 @@ struct ngx_http_core_loc_conf_s {
     unsigned      noregex:1;/*前缀匹配,uri以'^~'开头*/
 
     unsigned      auto_redirect:1;
+    unsigned      regex_caseless:1;
 #if (NGX_HTTP_GZIP)
     unsigned      gzip_disable_msie6:2;
 #if (NGX_HTTP_DEGRADATION)
@@ -339,6 +352,7 @@ struct ngx_http_core_loc_conf_s {
     ngx_http_location_tree_node_t   *static_locations;/*静态二叉树*/
 #if (NGX_PCRE)
     ngx_http_core_loc_conf_t       **regex_locations;
+    ngx_http_regex_location_group_t *regex_groups;
 #endif
 
     /* pointer to the modules' loc_conf */
@@ -396,8 +410,11 @@ struct ngx_http_core_loc_conf_s {
                                            /* client_body_in_singe_buffer */
     ngx_flag_t    internal;                /* internal */
     ngx_flag_t    sendfile;                /* sendfile */
-#if (NGX_HAVE_FILE_AIO)
+#if (NGX_HAVE_FILE_AIO || NGX_THREAD_POOL)
     ngx_flag_t    aio;                     /* aio */
+#endif
+#if (NGX_THREAD_POOL)
+    ngx_thread_pool_t  *thread_pool;       /* aio threads=pool */
 #endif
     ngx_flag_t    tcp_nopush;              /* tcp_nopush */
     ngx_flag_t    tcp_nodelay;             /* tcp_nodelay */
@@ -462,6 +479,24 @@ typedef struct {
     ngx_queue_t                      list;
 } ngx_http_location_queue_t;
 
+#if (NGX_PCRE)
+
+/*
+ * consecutive regex locations are tested by one combined regex which
+ * marks the first location matched; "regex" is NULL if the locations
+ * of the group are tested one by one
+ */
+
+struct ngx_http_regex_location_group_s {
+    ngx_regex_t                     *filter;
+    ngx_regex_t                     *regex;
+    ngx_http_core_loc_conf_t       **locations;
+    ngx_uint_t                       nlocations;
+};
+
+#endif
+
+
 /*location平衡二叉查找树*/
 struct ngx_http_location_tree_node_s {
     ngx_http_location_tree_node_t   *left;
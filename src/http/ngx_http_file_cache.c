@@ -11,6 +11,29 @@
 #include <ngx_md5.h>
 
 
+#define NGX_HTTP_FILE_CACHE_SNAPSHOT_VERSION  1
+#define NGX_HTTP_FILE_CACHE_SNAPSHOT_BATCH    4096
+
+
+typedef struct {
+    u_char                           magic[8];
+    uint32_t                         version;
+    uint32_t                         bsize;
+    uint32_t                         levels;
+    uint32_t                         crc32;
+    uint64_t                         count;
+    uint64_t                         time;
+} ngx_http_file_cache_snapshot_header_t;
+
+
+typedef struct {
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN];
+    uint32_t                         expire;
+    uint32_t                         fs_size;
+    uint32_t                         uses;
+} ngx_http_file_cache_snapshot_rec_t;
+
+
 static ngx_int_t ngx_http_file_cache_lock(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev);
@@ -21,6 +44,11 @@ static ssize_t ngx_http_file_cache_aio_read(ngx_http_request_t *r,
 #if (NGX_HAVE_FILE_AIO)
 static void ngx_http_cache_aio_event_handler(ngx_event_t *ev);
 #endif
+#if (NGX_THREAD_POOL)
+static ngx_int_t ngx_http_cache_thread_handler(ngx_thread_task_t *task,
+    ngx_file_t *file);
+static void ngx_http_cache_thread_event_handler(ngx_event_t *ev);
+#endif
 static ngx_int_t ngx_http_file_cache_exists(ngx_http_file_cache_t *cache,
     ngx_http_cache_t *c);
 static ngx_int_t ngx_http_file_cache_name(ngx_http_request_t *r,
@@ -45,6 +73,40 @@ static ngx_int_t ngx_http_file_cache_add(ngx_http_file_cache_t *cache,
     ngx_http_cache_t *c);
 static ngx_int_t ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
+static ngx_http_file_cache_node_t *
+    ngx_http_file_cache_after(ngx_http_file_cache_t *cache, u_char *key);
+static ngx_http_file_cache_node_t *
+    ngx_http_file_cache_next(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
+static ngx_int_t ngx_http_file_cache_snapshot_load(
+    ngx_http_file_cache_t *cache, ngx_log_t *log);
+static int ngx_libc_cdecl ngx_http_file_cache_snapshot_cmp(const void *one,
+    const void *two);
+static void ngx_http_file_cache_snapshot_write(ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_snapshot_purge(ngx_http_file_cache_t *cache);
+static ngx_int_t ngx_http_file_cache_memory_get(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_memory_admit(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static ngx_http_file_cache_memory_node_t *
+    ngx_http_file_cache_memory_lookup(ngx_http_file_cache_t *cache,
+    u_char *key);
+static void ngx_http_file_cache_memory_delete(ngx_http_file_cache_t *cache,
+    u_char *key);
+static void ngx_http_file_cache_link(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, ngx_uint_t promote);
+static void ngx_http_file_cache_unlink(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
+static ngx_http_file_cache_node_t *
+    ngx_http_file_cache_oldest(ngx_http_file_cache_t *cache);
+static ngx_int_t ngx_http_file_cache_admit(ngx_http_file_cache_t *cache,
+    u_char *key);
+static ngx_int_t ngx_http_file_cache_sketch_init(ngx_shm_zone_t *shm_zone,
+    ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_sketch_add(ngx_http_file_cache_t *cache,
+    u_char *key);
+static ngx_uint_t ngx_http_file_cache_sketch_estimate(
+    ngx_http_file_cache_t *cache, u_char *key);
 
 
 ngx_str_t  ngx_http_cache_status[] = {
@@ -53,12 +115,24 @@ ngx_str_t  ngx_http_cache_status[] = {
     ngx_string("EXPIRED"),
     ngx_string("STALE"),
     ngx_string("UPDATING"),
+    ngx_string("REVALIDATED"),
     ngx_string("HIT")
 };
 
 
+ngx_str_t  ngx_http_file_cache_policies[] = {
+    ngx_string("lru"),
+    ngx_string("slru"),
+    ngx_string("tinylfu"),
+    ngx_null_string
+};
+
+
 static u_char  ngx_http_file_cache_key[] = { LF, 'K', 'E', 'Y', ':', ' ' };
 
+static u_char  ngx_http_file_cache_snapshot_magic[] =
+    { 'N', 'G', 'X', 'C', 'I', 'D', 'X', LF };
+
 
 static ngx_int_t
 ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
@@ -102,6 +176,12 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
             cache->path->loader = NULL;
         }
 
+        if (cache->policy == NGX_HTTP_FILE_CACHE_TINYLFU
+            && cache->sh->sketch == NULL)
+        {
+            return ngx_http_file_cache_sketch_init(shm_zone, cache);
+        }
+
         return NGX_OK;
     }
 
@@ -125,10 +205,18 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
                     ngx_http_file_cache_rbtree_insert_value);
 
     ngx_queue_init(&cache->sh->queue);
+    ngx_queue_init(&cache->sh->hot);
 
     cache->sh->cold = 1;
     cache->sh->loading = 0;
     cache->sh->size = 0;
+    cache->sh->hot_size = 0;
+
+    cache->sh->sketch = NULL;
+    cache->sh->lookups = 0;
+    cache->sh->hits = 0;
+    cache->sh->rejected = 0;
+    cache->sh->evicted = 0;
 
     cache->bsize = ngx_fs_bsize(cache->path->name.data);
 
@@ -144,6 +232,70 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
     ngx_sprintf(cache->shpool->log_ctx, " in cache keys zone \"%V\"%Z",
                 &shm_zone->shm.name);
 
+    if (cache->policy == NGX_HTTP_FILE_CACHE_TINYLFU
+        && ngx_http_file_cache_sketch_init(shm_zone, cache) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (cache->snapshot.len) {
+        (void) ngx_http_file_cache_snapshot_load(cache, shm_zone->shm.log);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_memory_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_file_cache_t  *ocache = data;
+
+    size_t                  len;
+    ngx_http_file_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->memory = ocache->memory;
+        cache->memory_shpool = ocache->memory_shpool;
+
+        return NGX_OK;
+    }
+
+    cache->memory_shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->memory = cache->memory_shpool->data;
+
+        return NGX_OK;
+    }
+
+    cache->memory = ngx_slab_alloc(cache->memory_shpool,
+                                   sizeof(ngx_http_file_cache_memory_sh_t));
+    if (cache->memory == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->memory_shpool->data = cache->memory;
+
+    ngx_rbtree_init(&cache->memory->rbtree, &cache->memory->sentinel,
+                    ngx_http_file_cache_rbtree_insert_value);
+
+    ngx_queue_init(&cache->memory->queue);
+
+    cache->memory->size = 0;
+
+    len = sizeof(" in cache memory zone \"\"") + shm_zone->shm.name.len;
+
+    cache->memory_shpool->log_ctx = ngx_slab_alloc(cache->memory_shpool, len);
+    if (cache->memory_shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->memory_shpool->log_ctx, " in cache memory zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
     return NGX_OK;
 }
 
@@ -319,6 +471,19 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         goto done;
     }
 
+    if (c->exists && cache->memory) {
+
+        rc = ngx_http_file_cache_memory_get(r, c);
+
+        if (rc == NGX_OK) {
+            return ngx_http_file_cache_read(r, c);
+        }
+
+        if (rc == NGX_ERROR) {
+            return rc;
+        }
+    }
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     ngx_memzero(&of, sizeof(ngx_open_file_info_t));
@@ -484,10 +649,15 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
     ngx_http_file_cache_t         *cache;
     ngx_http_file_cache_header_t  *h;
 
-    n = ngx_http_file_cache_aio_read(r, c);
+    if (c->memory) {
+        n = c->buf->last - c->buf->pos;
 
-    if (n < 0) {
-        return n;
+    } else {
+        n = ngx_http_file_cache_aio_read(r, c);
+
+        if (n < 0) {
+            return n;
+        }
     }
 
     if ((size_t) n < c->header_start) {
@@ -498,6 +668,12 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     h = (ngx_http_file_cache_header_t *) c->buf->pos;
 
+    if (h->version != NGX_HTTP_CACHE_VERSION) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "cache file \"%s\" version mismatch", c->file.name.data);
+        return NGX_DECLINED;
+    }
+
     if (h->crc32 != c->crc32) {
         ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
                       "cache file \"%s\" has md5 collision", c->file.name.data);
@@ -511,7 +687,7 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
         return NGX_DECLINED;
     }
 
-    c->buf->last += n;
+    c->buf->last = c->buf->pos + n;
 
     c->valid_sec = h->valid_sec;
     c->last_modified = h->last_modified;
@@ -519,6 +695,8 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
     c->valid_msec = h->valid_msec;
     c->header_start = h->header_start;
     c->body_start = h->body_start;
+    c->etag.len = h->etag_len;
+    c->etag.data = h->etag;
 
     r->cached = 1;
 
@@ -565,6 +743,10 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
         return rc;
     }
 
+    if (cache->memory && !c->memory) {
+        ngx_http_file_cache_memory_admit(r, c);
+    }
+
     return NGX_OK;
 }
 
@@ -572,17 +754,34 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 static ssize_t
 ngx_http_file_cache_aio_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-#if (NGX_HAVE_FILE_AIO)
+#if (NGX_HAVE_FILE_AIO || NGX_THREAD_POOL)
     ssize_t                    n;
     ngx_http_core_loc_conf_t  *clcf;
 
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+#endif
+
+#if (NGX_THREAD_POOL)
+
+    if (clcf->aio == NGX_HTTP_AIO_THREADS) {
+        c->file.thread_handler = ngx_http_cache_thread_handler;
+        c->file.thread_ctx = r;
+
+        n = ngx_thread_read(&c->thread_task, &c->file, c->buf->pos,
+                            c->body_start, 0, r->pool);
+
+        return n;
+    }
+
+#endif
+
+#if (NGX_HAVE_FILE_AIO)
+
     if (!ngx_file_aio) {
         goto noaio;
     }
 
-    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
-
-    if (!clcf->aio) {
+    if (clcf->aio != NGX_HTTP_AIO_ON && clcf->aio != NGX_HTTP_AIO_SENDFILE) {
         goto noaio;
     }
 
@@ -628,162 +827,448 @@ ngx_http_cache_aio_event_handler(ngx_event_t *ev)
 #endif
 
 
+#if (NGX_THREAD_POOL)
+
 static ngx_int_t
-ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
+ngx_http_cache_thread_handler(ngx_thread_task_t *task, ngx_file_t *file)
 {
-    ngx_int_t                    rc;
-    ngx_http_file_cache_node_t  *fcn;
+    ngx_http_request_t        *r;
+    ngx_http_core_loc_conf_t  *clcf;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    r = file->thread_ctx;
 
-    fcn = c->node;
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
-    if (fcn == NULL) {
-        fcn = ngx_http_file_cache_lookup(cache, c->key);
-    }
+    task->event.data = r;
+    task->event.handler = ngx_http_cache_thread_event_handler;
 
-    if (fcn) {
-        ngx_queue_remove(&fcn->queue);
+    if (ngx_thread_task_post(clcf->thread_pool, task) != NGX_OK) {
+        return NGX_ERROR;
+    }
 
-        if (c->node == NULL) {
-            fcn->uses++;
-            fcn->count++;
-        }
+    r->main->blocked++;
+    r->aio = 1;
 
-        if (fcn->error) {
+    return NGX_OK;
+}
 
-            if (fcn->valid_sec < ngx_time()) {
-                goto renew;
-            }
 
-            rc = NGX_OK;
+static void
+ngx_http_cache_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_http_request_t  *r;
 
-            goto done;
-        }
+    r = ev->data;
 
-        if (fcn->exists || fcn->uses >= c->min_uses) {
+    r->main->blocked--;
+    r->aio = 0;
 
-            c->exists = fcn->exists;
-            if (fcn->body_start) {
-                c->body_start = fcn->body_start;
-            }
+    r->connection->write->handler(r->connection->write);
+}
 
-            rc = NGX_OK;
+#endif
 
-            goto done;
-        }
 
-        rc = NGX_AGAIN;
+static ngx_int_t
+ngx_http_file_cache_memory_get(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    ngx_http_file_cache_t              *cache;
+    ngx_http_file_cache_memory_node_t  *mn;
 
-        goto done;
-    }
+    cache = c->file_cache;
 
-    fcn = ngx_slab_alloc_locked(cache->shpool,
-                                sizeof(ngx_http_file_cache_node_t));
-    if (fcn == NULL) {
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_lock(&cache->memory_shpool->mutex);
 
-        (void) ngx_http_file_cache_forced_expire(cache);
+    mn = ngx_http_file_cache_memory_lookup(cache, c->key);
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+    if (mn == NULL) {
+        ngx_shmtx_unlock(&cache->memory_shpool->mutex);
+        return NGX_DECLINED;
+    }
 
-        fcn = ngx_slab_alloc_locked(cache->shpool,
-                                    sizeof(ngx_http_file_cache_node_t));
-        if (fcn == NULL) {
-            rc = NGX_ERROR;
-            goto failed;
-        }
+    c->buf = ngx_create_temp_buf(r->pool, mn->len);
+    if (c->buf == NULL) {
+        ngx_shmtx_unlock(&cache->memory_shpool->mutex);
+        return NGX_ERROR;
     }
 
-    ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+    /*
+     * the object is copied to the request pool, so the entry may be
+     * evicted or replaced while the response is being sent
+     */
 
-    ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
-               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+    c->buf->last = ngx_cpymem(c->buf->pos, mn->data, mn->len);
+    c->length = mn->len;
 
-    ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+    ngx_queue_remove(&mn->queue);
+    ngx_queue_insert_head(&cache->memory->queue, &mn->queue);
 
-    fcn->uses = 1;
-    fcn->count = 1;
-    fcn->updating = 0;
-    fcn->deleting = 0;
+    ngx_shmtx_unlock(&cache->memory_shpool->mutex);
 
-renew:
+    c->memory = 1;
 
-    rc = NGX_DECLINED;
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache memory hit: %O", c->length);
 
-    fcn->valid_msec = 0;
-    fcn->error = 0;
-    fcn->exists = 0;
-    fcn->valid_sec = 0;
-    fcn->uniq = 0;
-    fcn->body_start = 0;
-    fcn->fs_size = 0;
+    return NGX_OK;
+}
 
-done:
 
-    fcn->expire = ngx_time() + cache->inactive;
+static void
+ngx_http_file_cache_memory_admit(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    size_t                              size;
+    ssize_t                             n;
+    ngx_buf_t                          *b;
+    ngx_uint_t                          tries;
+    ngx_file_info_t                     fi;
+    ngx_http_file_cache_t              *cache;
+    ngx_http_file_cache_memory_node_t  *mn;
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+    cache = c->file_cache;
 
-    c->uniq = fcn->uniq;
-    c->error = fcn->error;
-    c->node = fcn;
+    if (c->uses < cache->memory_min_uses
+        || c->length > (off_t) cache->memory_max_object)
+    {
+        return;
+    }
 
-failed:
+    b = ngx_create_temp_buf(r->pool, (size_t) c->length);
+    if (b == NULL) {
+        return;
+    }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    n = ngx_read_file(&c->file, b->pos, (size_t) c->length, 0);
 
-    return rc;
-}
+    if (n != c->length) {
+        return;
+    }
 
+    b->last += n;
 
-static ngx_int_t
-ngx_http_file_cache_name(ngx_http_request_t *r, ngx_path_t *path)
-{
-    u_char            *p;
-    ngx_http_cache_t  *c;
+    size = offsetof(ngx_http_file_cache_memory_node_t, data) + n;
 
-    c = r->cache;
+    ngx_shmtx_lock(&cache->memory_shpool->mutex);
 
-    if (c->file.name.len) {
-        return NGX_OK;
+    if (ngx_http_file_cache_memory_lookup(cache, c->key)) {
+        goto done;
     }
 
-    c->file.name.len = path->name.len + 1 + path->len
-                       + 2 * NGX_HTTP_CACHE_KEY_LEN;
+    /*
+     * the file is tested under the mutex: ngx_http_file_cache_update()
+     * deletes the entry after the file has been renamed, so either
+     * the replaced file is seen here, or the entry added will be deleted
+     */
 
-    c->file.name.data = ngx_pnalloc(r->pool, c->file.name.len + 1);
-    if (c->file.name.data == NULL) {
-        return NGX_ERROR;
+    if (ngx_file_info(c->file.name.data, &fi) == NGX_FILE_ERROR
+        || ngx_file_uniq(&fi) != c->uniq)
+    {
+        goto done;
     }
 
-    ngx_memcpy(c->file.name.data, path->name.data, path->name.len);
+    for (tries = 0; /* void */ ; tries++) {
 
-    p = c->file.name.data + path->name.len + 1 + path->len;
-    p = ngx_hex_dump(p, c->key, NGX_HTTP_CACHE_KEY_LEN);
-    *p = '\0';
+        mn = ngx_slab_alloc_locked(cache->memory_shpool, size);
 
-    ngx_create_hashed_filename(path, c->file.name.data, c->file.name.len);
+        if (mn) {
+            break;
+        }
+
+        if (tries == 64 || ngx_queue_empty(&cache->memory->queue)) {
+            goto done;
+        }
+
+        /* 内存层有自己的 LRU 队列, 与磁盘上的淘汰无关 */
+
+        mn = ngx_queue_data(ngx_queue_last(&cache->memory->queue),
+                            ngx_http_file_cache_memory_node_t, queue);
+
+        cache->memory->size -= mn->len;
+
+        ngx_queue_remove(&mn->queue);
+        ngx_rbtree_delete(&cache->memory->rbtree, &mn->node);
+        ngx_slab_free_locked(cache->memory_shpool, mn);
+    }
+
+    ngx_memcpy((u_char *) &mn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+
+    ngx_memcpy(mn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+    mn->len = n;
+    ngx_memcpy(mn->data, b->pos, n);
+
+    ngx_rbtree_insert(&cache->memory->rbtree, &mn->node);
+    ngx_queue_insert_head(&cache->memory->queue, &mn->queue);
+
+    cache->memory->size += n;
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "cache file: \"%s\"", c->file.name.data);
+                   "http file cache memory admit: %z", n);
 
-    return NGX_OK;
+done:
+
+    ngx_shmtx_unlock(&cache->memory_shpool->mutex);
+
+    /* the response is sent from memory as well */
+
+    c->buf = b;
+    c->memory = 1;
 }
 
 
-static ngx_http_file_cache_node_t *
-ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key)
+static ngx_http_file_cache_memory_node_t *
+ngx_http_file_cache_memory_lookup(ngx_http_file_cache_t *cache, u_char *key)
 {
-    ngx_int_t                    rc;
-    ngx_rbtree_key_t             node_key;
-    ngx_rbtree_node_t           *node, *sentinel;
-    ngx_http_file_cache_node_t  *fcn;
+    ngx_int_t                           rc;
+    ngx_rbtree_key_t                    node_key;
+    ngx_rbtree_node_t                  *node, *sentinel;
+    ngx_http_file_cache_memory_node_t  *mn;
 
     ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
 
-    node = cache->sh->rbtree.root;
-    sentinel = cache->sh->rbtree.sentinel;
+    node = cache->memory->rbtree.root;
+    sentinel = cache->memory->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (node_key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* node_key == node->key */
+
+        mn = (ngx_http_file_cache_memory_node_t *) node;
+
+        rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], mn->key,
+                        NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        if (rc == 0) {
+            return mn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    /* not found */
+
+    return NULL;
+}
+
+
+static void
+ngx_http_file_cache_memory_delete(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_http_file_cache_memory_node_t  *mn;
+
+    ngx_shmtx_lock(&cache->memory_shpool->mutex);
+
+    mn = ngx_http_file_cache_memory_lookup(cache, key);
+
+    if (mn) {
+        cache->memory->size -= mn->len;
+
+        ngx_queue_remove(&mn->queue);
+        ngx_rbtree_delete(&cache->memory->rbtree, &mn->node);
+        ngx_slab_free_locked(cache->memory_shpool, mn);
+    }
+
+    ngx_shmtx_unlock(&cache->memory_shpool->mutex);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
+{
+    ngx_int_t                    rc;
+    ngx_http_file_cache_node_t  *fcn;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    fcn = c->node;
+
+    if (fcn == NULL) {
+        fcn = ngx_http_file_cache_lookup(cache, c->key);
+
+        cache->sh->lookups++;
+
+        if (fcn && fcn->exists) {
+            cache->sh->hits++;
+        }
+
+        if (cache->policy == NGX_HTTP_FILE_CACHE_TINYLFU) {
+            ngx_http_file_cache_sketch_add(cache, c->key);
+        }
+    }
+
+    if (fcn) {
+        ngx_http_file_cache_unlink(cache, fcn);
+
+        if (c->node == NULL) {
+            fcn->uses++;
+            fcn->count++;
+        }
+
+        if (fcn->error) {
+
+            if (fcn->valid_sec < ngx_time()) {
+                goto renew;
+            }
+
+            rc = NGX_OK;
+
+            goto done;
+        }
+
+        if (fcn->exists || fcn->uses >= c->min_uses) {
+
+            if (!fcn->exists
+                && c->node == NULL
+                && ngx_http_file_cache_admit(cache, c->key) != NGX_OK)
+            {
+                rc = NGX_AGAIN;
+                goto done;
+            }
+
+            c->exists = fcn->exists;
+            if (fcn->body_start) {
+                c->body_start = fcn->body_start;
+            }
+
+            rc = NGX_OK;
+
+            goto done;
+        }
+
+        rc = NGX_AGAIN;
+
+        goto done;
+    }
+
+    /* 未被接纳的对象不在keys zone中占用节点 */
+
+    if (c->min_uses == 1
+        && ngx_http_file_cache_admit(cache, c->key) != NGX_OK)
+    {
+        rc = NGX_AGAIN;
+        goto failed;
+    }
+
+    fcn = ngx_slab_alloc_locked(cache->shpool,
+                                sizeof(ngx_http_file_cache_node_t));
+    if (fcn == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        (void) ngx_http_file_cache_forced_expire(cache);
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        fcn = ngx_slab_alloc_locked(cache->shpool,
+                                    sizeof(ngx_http_file_cache_node_t));
+        if (fcn == NULL) {
+            rc = NGX_ERROR;
+            goto failed;
+        }
+    }
+
+    ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+
+    ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+    ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+
+    fcn->uses = 1;
+    fcn->count = 1;
+    fcn->updating = 0;
+    fcn->deleting = 0;
+    fcn->hot = 0;
+
+renew:
+
+    rc = NGX_DECLINED;
+
+    fcn->valid_msec = 0;
+    fcn->error = 0;
+    fcn->exists = 0;
+    fcn->snapshot = 0;
+    fcn->valid_sec = 0;
+    fcn->uniq = 0;
+    fcn->body_start = 0;
+    fcn->fs_size = 0;
+
+done:
+
+    fcn->expire = ngx_time() + cache->inactive;
+
+    ngx_http_file_cache_link(cache, fcn, fcn->exists);
+
+    c->uniq = fcn->uniq;
+    c->uses = fcn->uses;
+    c->error = fcn->error;
+    c->node = fcn;
+
+failed:
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_name(ngx_http_request_t *r, ngx_path_t *path)
+{
+    u_char            *p;
+    ngx_http_cache_t  *c;
+
+    c = r->cache;
+
+    if (c->file.name.len) {
+        return NGX_OK;
+    }
+
+    c->file.name.len = path->name.len + 1 + path->len
+                       + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    c->file.name.data = ngx_pnalloc(r->pool, c->file.name.len + 1);
+    if (c->file.name.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(c->file.name.data, path->name.data, path->name.len);
+
+    p = c->file.name.data + path->name.len + 1 + path->len;
+    p = ngx_hex_dump(p, c->key, NGX_HTTP_CACHE_KEY_LEN);
+    *p = '\0';
+
+    ngx_create_hashed_filename(path, c->file.name.data, c->file.name.len);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "cache file: \"%s\"", c->file.name.data);
+
+    return NGX_OK;
+}
+
+
+static ngx_http_file_cache_node_t *
+ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_int_t                    rc;
+    ngx_rbtree_key_t             node_key;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_http_file_cache_node_t  *fcn;
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -875,6 +1360,9 @@ ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
 
     c = r->cache;
 
+    ngx_memzero(h, sizeof(ngx_http_file_cache_header_t));
+
+    h->version = NGX_HTTP_CACHE_VERSION;
     h->valid_sec = c->valid_sec;
     h->last_modified = c->last_modified;
     h->date = c->date;
@@ -883,6 +1371,16 @@ ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
     h->header_start = (u_short) c->header_start;
     h->body_start = (u_short) c->body_start;
 
+    if (c->etag.len <= NGX_HTTP_CACHE_ETAG_LEN) {
+        h->etag_len = (u_char) c->etag.len;
+        ngx_memcpy(h->etag, c->etag.data, c->etag.len);
+
+    } else {
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache etag too long: %uz, not stored: "
+                       "\"%V\"", c->etag.len, &c->etag);
+    }
+
     p = buf + sizeof(ngx_http_file_cache_header_t);
 
     p = ngx_cpymem(p, ngx_http_file_cache_key, sizeof(ngx_http_file_cache_key));
@@ -937,6 +1435,10 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 
     rc = ngx_ext_rename_file(&tf->file.name, &c->file.name, &ext);
 
+    if (cache->memory) {
+        ngx_http_file_cache_memory_delete(cache, c->key);
+    }
+
     if (rc == NGX_OK) {
 
         if (ngx_fd_info(tf->file.fd, &fi) == NGX_FILE_ERROR) {
@@ -958,10 +1460,16 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
     c->node->body_start = c->body_start;
 
     cache->sh->size += fs_size - c->node->fs_size;
+
+    if (c->node->hot) {
+        cache->sh->hot_size += fs_size - c->node->fs_size;
+    }
+
     c->node->fs_size = fs_size;
 
     if (rc == NGX_OK) {
         c->node->exists = 1;
+        c->node->snapshot = 0;
     }
 
     c->node->updating = 0;
@@ -970,43 +1478,184 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 }
 
 
-ngx_int_t
-ngx_http_cache_send(ngx_http_request_t *r)
+void
+ngx_http_file_cache_update_header(ngx_http_request_t *r)
 {
-    ngx_int_t          rc;
-    ngx_buf_t         *b;
-    ngx_chain_t        out;
-    ngx_http_cache_t  *c;
+    ssize_t                        n;
+    ngx_err_t                      err;
+    ngx_uint_t                     level;
+    ngx_file_t                     file;
+    ngx_file_info_t                fi;
+    ngx_http_cache_t              *c;
+    ngx_http_file_cache_t         *cache;
+    ngx_http_file_cache_header_t   h;
 
     c = r->cache;
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache send: %s", c->file.name.data);
+    if (c->updated) {
+        return;
+    }
 
-    if (r != r->main && c->length - c->body_start == 0) {
-        return ngx_http_send_header(r);
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache update header");
+
+    cache = c->file_cache;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = c->file.name;
+    file.log = r->connection->log;
+
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_RDWR, NGX_FILE_OPEN, 0);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
+
+        /* 缓存文件可能已被manager删除 */
+
+        level = (err == NGX_ENOENT) ? NGX_LOG_INFO : NGX_LOG_CRIT;
+
+        ngx_log_error(level, r->connection->log, err,
+                      ngx_open_file_n " \"%s\" failed", file.name.data);
+        goto done;
     }
 
-    /* we need to allocate all before the header would be sent */
+    /* make sure the cache file was not replaced since it was opened */
 
-    b = ngx_pcalloc(r->pool, sizeof(ngx_buf_t));
-    if (b == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", file.name.data);
+        goto close;
     }
 
-    b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
-    if (b->file == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    if (ngx_file_uniq(&fi) != c->uniq || ngx_file_size(&fi) != c->length) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "http file cache \"%s\" changed", file.name.data);
+        goto close;
     }
 
-    rc = ngx_http_send_header(r);
+    n = ngx_read_file(&file, (u_char *) &h,
+                      sizeof(ngx_http_file_cache_header_t), 0);
 
-    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
-        return rc;
+    if (n == NGX_ERROR) {
+        goto close;
     }
 
-    b->file_pos = c->body_start;
-    b->file_last = c->length;
+    if ((size_t) n != sizeof(ngx_http_file_cache_header_t)) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      ngx_read_file_n " read only %z of %uz from \"%s\"",
+                      n, sizeof(ngx_http_file_cache_header_t),
+                      file.name.data);
+        goto close;
+    }
+
+    if (h.version != NGX_HTTP_CACHE_VERSION
+        || h.crc32 != c->crc32
+        || h.last_modified != c->last_modified
+        || h.header_start != c->header_start
+        || h.body_start != c->body_start)
+    {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "http file cache \"%s\" content changed",
+                      file.name.data);
+        goto close;
+    }
+
+    /* only the validity changes, the body is kept as is */
+
+    h.valid_sec = c->valid_sec;
+    h.valid_msec = (u_short) c->valid_msec;
+    h.date = c->date;
+
+    (void) ngx_write_file(&file, (u_char *) &h,
+                          sizeof(ngx_http_file_cache_header_t), 0);
+
+close:
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+
+done:
+
+    if (cache->memory) {
+        ngx_http_file_cache_memory_delete(cache, c->key);
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    c->node->count--;
+    c->node->valid_sec = c->valid_sec;
+    c->node->valid_msec = c->valid_msec;
+    c->node->updating = 0;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    c->updated = 1;
+    c->updating = 0;
+}
+
+
+ngx_int_t
+ngx_http_cache_send(ngx_http_request_t *r)
+{
+    ngx_int_t          rc;
+    ngx_buf_t         *b;
+    ngx_chain_t        out;
+    ngx_http_cache_t  *c;
+
+    c = r->cache;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache send: %s", c->file.name.data);
+
+    if (r != r->main && c->length - c->body_start == 0) {
+        return ngx_http_send_header(r);
+    }
+
+    /* we need to allocate all before the header would be sent */
+
+    b = ngx_pcalloc(r->pool, sizeof(ngx_buf_t));
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (c->memory) {
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+
+        /* 整个缓存文件都在 c->buf 中 */
+
+        b->pos = c->buf->pos + c->body_start;
+        b->last = c->buf->pos + c->length;
+
+        b->memory = (c->length - c->body_start) ? 1: 0;
+        b->last_buf = (r == r->main) ? 1: 0;
+        b->last_in_chain = 1;
+
+        out.buf = b;
+        out.next = NULL;
+
+        return ngx_http_output_filter(r, &out);
+    }
+
+    b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+    if (b->file == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    b->file_pos = c->body_start;
+    b->file_last = c->length;
 
     b->in_file = (c->length - c->body_start) ? 1: 0;
     b->last_buf = (r == r->main) ? 1: 0;
@@ -1056,7 +1705,7 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
         }
 
     } else if (!fcn->exists && fcn->count == 0 && c->min_uses == 1) {
-        ngx_queue_remove(&fcn->queue);
+        ngx_http_file_cache_unlink(cache, fcn);
         ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
         ngx_slab_free_locked(cache->shpool, fcn);
         c->node = NULL;
@@ -1099,7 +1748,7 @@ ngx_http_file_cache_cleanup(void *data)
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
                    "http file cache cleanup");
 
-    if (c->updating) {
+    if (c->updating && !c->background) {
         ngx_log_error(NGX_LOG_ALERT, c->file.log, 0,
                       "stalled cache updating, error:%ui", c->error);
     }
@@ -1116,7 +1765,7 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
     time_t                       wait;
     ngx_uint_t                   tries;
     ngx_path_t                  *path;
-    ngx_queue_t                 *q;
+    ngx_queue_t                 *q, *queue;
     ngx_http_file_cache_node_t  *fcn;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
@@ -1137,32 +1786,46 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
 
     ngx_shmtx_lock(&cache->shpool->mutex);
 
-    for (q = ngx_queue_last(&cache->sh->queue);
-         q != ngx_queue_sentinel(&cache->sh->queue);
-         q = ngx_queue_prev(q))
-    {
-        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+    /* 先淘汰试用段，再淘汰受保护段，LRU时受保护段总是空的 */
 
-        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                  "http file cache forced expire: #%d %d %02xd%02xd%02xd%02xd",
-                  fcn->count, fcn->exists,
-                  fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
+    queue = &cache->sh->queue;
 
-        if (fcn->count == 0) {
-            ngx_http_file_cache_delete(cache, q, name);
-            wait = 0;
+    for ( ;; ) {
 
-        } else {
-            if (--tries) {
-                continue;
+        for (q = ngx_queue_last(queue);
+             q != ngx_queue_sentinel(queue);
+             q = ngx_queue_prev(q))
+        {
+            fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+            ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                           "http file cache forced expire: #%d %d "
+                           "%02xd%02xd%02xd%02xd",
+                           fcn->count, fcn->exists,
+                           fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
+
+            if (fcn->count == 0) {
+                cache->sh->evicted++;
+                ngx_http_file_cache_delete(cache, q, name);
+                wait = 0;
+                goto done;
             }
 
-            wait = 1;
+            if (--tries == 0) {
+                wait = 1;
+                goto done;
+            }
+        }
+
+        if (queue == &cache->sh->hot) {
+            break;
         }
 
-        break;
+        queue = &cache->sh->hot;
     }
 
+done:
+
     ngx_shmtx_unlock(&cache->shpool->mutex);
 
     ngx_free(name);
@@ -1201,14 +1864,14 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
 
     for ( ;; ) {
 
-        if (ngx_queue_empty(&cache->sh->queue)) {
+        fcn = ngx_http_file_cache_oldest(cache);
+
+        if (fcn == NULL) {
             wait = 10;
             break;
         }
 
-        q = ngx_queue_last(&cache->sh->queue);
-
-        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+        q = &fcn->queue;
 
         wait = fcn->expire - now;
 
@@ -1243,7 +1906,7 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
          * we prefer to just move them to the top of the inactive queue
          */
 
-        ngx_queue_remove(q);
+        ngx_http_file_cache_unlink(cache, fcn);
         fcn->expire = ngx_time() + cache->inactive;
         ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
 
@@ -1268,6 +1931,7 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
     size_t                       len;
     ngx_path_t                  *path;
     ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[NGX_HTTP_CACHE_KEY_LEN];
 
     fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
 
@@ -1297,26 +1961,296 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
                           ngx_delete_file_n " \"%s\" failed", name);
         }
 
+        if (cache->memory) {
+            ngx_memcpy(key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+            ngx_http_file_cache_memory_delete(cache, key);
+        }
+
         ngx_shmtx_lock(&cache->shpool->mutex);
         fcn->count--;
         fcn->deleting = 0;
     }
 
     if (fcn->count == 0) {
-        ngx_queue_remove(q);
+        ngx_http_file_cache_unlink(cache, fcn);
         ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
         ngx_slab_free_locked(cache->shpool, fcn);
     }
 }
 
 
+/*
+ * LRU只使用sh->queue；SLRU和TinyLFU把再次命中的节点放入受保护段sh->hot，
+ * 受保护段超过max_size的4/5时，最久未用的节点按到期时间降回试用段
+ */
+
+static void
+ngx_http_file_cache_link(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, ngx_uint_t promote)
+{
+    ngx_queue_t                 *q;
+    ngx_http_file_cache_node_t  *old, *node;
+
+    if (!promote || cache->policy == NGX_HTTP_FILE_CACHE_LRU) {
+        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+        return;
+    }
+
+    fcn->hot = 1;
+    cache->sh->hot_size += fcn->fs_size;
+
+    ngx_queue_insert_head(&cache->sh->hot, &fcn->queue);
+
+    while (cache->sh->hot_size > cache->max_size / 5 * 4) {
+
+        q = ngx_queue_last(&cache->sh->hot);
+
+        if (q == &fcn->queue) {
+            break;
+        }
+
+        old = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+        ngx_http_file_cache_unlink(cache, old);
+
+        /*
+         * the demoted node keeps its expire time, so it is placed by it:
+         * ngx_http_file_cache_expire() stops at the first tail node that
+         * has not expired yet; the demoted nodes are usually the oldest
+         * ones, so the queue is searched from the tail
+         */
+
+        for (q = ngx_queue_last(&cache->sh->queue);
+             q != ngx_queue_sentinel(&cache->sh->queue);
+             q = ngx_queue_prev(q))
+        {
+            node = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+            if (node->expire >= old->expire) {
+                break;
+            }
+        }
+
+        ngx_queue_insert_after(q, &old->queue);
+    }
+}
+
+
+static void
+ngx_http_file_cache_unlink(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    ngx_queue_remove(&fcn->queue);
+
+    if (fcn->hot) {
+        cache->sh->hot_size -= fcn->fs_size;
+        fcn->hot = 0;
+    }
+}
+
+
+/* 两个段的队尾中最早到期的节点 */
+
+static ngx_http_file_cache_node_t *
+ngx_http_file_cache_oldest(ngx_http_file_cache_t *cache)
+{
+    ngx_http_file_cache_node_t  *fcn, *hot;
+
+    fcn = NULL;
+    hot = NULL;
+
+    if (!ngx_queue_empty(&cache->sh->queue)) {
+        fcn = ngx_queue_data(ngx_queue_last(&cache->sh->queue),
+                             ngx_http_file_cache_node_t, queue);
+    }
+
+    if (!ngx_queue_empty(&cache->sh->hot)) {
+        hot = ngx_queue_data(ngx_queue_last(&cache->sh->hot),
+                             ngx_http_file_cache_node_t, queue);
+    }
+
+    if (fcn == NULL || (hot && hot->expire < fcn->expire)) {
+        return hot;
+    }
+
+    return fcn;
+}
+
+
+/*
+ * TinyLFU: 缓存接近max_size时，新对象的访问频率必须高于
+ * 下一个将被淘汰的对象才会被存储
+ */
+
+static ngx_int_t
+ngx_http_file_cache_admit(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_queue_t                 *q;
+    ngx_http_file_cache_node_t  *fcn;
+    u_char                       victim[NGX_HTTP_CACHE_KEY_LEN];
+
+    if (cache->policy != NGX_HTTP_FILE_CACHE_TINYLFU
+        || cache->sh->sketch == NULL
+        || cache->sh->size < cache->max_size - cache->max_size / 20)
+    {
+        return NGX_OK;
+    }
+
+    if (!ngx_queue_empty(&cache->sh->queue)) {
+        q = ngx_queue_last(&cache->sh->queue);
+
+    } else if (!ngx_queue_empty(&cache->sh->hot)) {
+        q = ngx_queue_last(&cache->sh->hot);
+
+    } else {
+        return NGX_OK;
+    }
+
+    fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+    ngx_memcpy(victim, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+    ngx_memcpy(&victim[sizeof(ngx_rbtree_key_t)], fcn->key,
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+    if (ngx_http_file_cache_sketch_estimate(cache, key)
+        > ngx_http_file_cache_sketch_estimate(cache, victim))
+    {
+        return NGX_OK;
+    }
+
+    cache->sh->rejected++;
+
+    return NGX_DECLINED;
+}
+
+
+/*
+ * count-min sketch: 4行4位饱和计数器(每个占一个字节)，每行宽度为2的幂，
+ * 由keys zone大小决定；累计增加10倍宽度次后所有计数器减半
+ */
+
+#define NGX_HTTP_FILE_CACHE_SKETCH_DEPTH  4
+#define NGX_HTTP_FILE_CACHE_SKETCH_MAX    15
+
+
+static ngx_int_t
+ngx_http_file_cache_sketch_init(ngx_shm_zone_t *shm_zone,
+    ngx_http_file_cache_t *cache)
+{
+    size_t  width;
+
+    width = 1024;
+
+    while (width * 2 <= shm_zone->shm.size / 128) {
+        width *= 2;
+    }
+
+    cache->sh->sketch = ngx_slab_alloc(cache->shpool,
+                                  NGX_HTTP_FILE_CACHE_SKETCH_DEPTH * width);
+    if (cache->sh->sketch == NULL) {
+        ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                      "cache \"%V\" is too small for the tinylfu policy",
+                      &shm_zone->shm.name);
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(cache->sh->sketch, NGX_HTTP_FILE_CACHE_SKETCH_DEPTH * width);
+
+    cache->sh->sketch_mask = width - 1;
+    cache->sh->sketch_additions = 0;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_sketch_add(ngx_http_file_cache_t *cache, u_char *key)
+{
+    u_char      *p;
+    uint32_t     hash;
+    uint64_t    *w, *last;
+    ngx_uint_t   i, width;
+
+    if (cache->sh->sketch == NULL) {
+        return;
+    }
+
+    width = cache->sh->sketch_mask + 1;
+
+    /* 键是MD5，每行直接取其中的32位作为散列值 */
+
+    for (i = 0; i < NGX_HTTP_FILE_CACHE_SKETCH_DEPTH; i++) {
+        ngx_memcpy(&hash, key + i * sizeof(uint32_t), sizeof(uint32_t));
+
+        p = cache->sh->sketch + i * width + (hash & cache->sh->sketch_mask);
+
+        if (*p < NGX_HTTP_FILE_CACHE_SKETCH_MAX) {
+            (*p)++;
+        }
+    }
+
+    if (++cache->sh->sketch_additions < 10 * width) {
+        return;
+    }
+
+    w = (uint64_t *) cache->sh->sketch;
+    last = w + NGX_HTTP_FILE_CACHE_SKETCH_DEPTH * width / sizeof(uint64_t);
+
+    while (w < last) {
+        *w = (*w >> 1) & 0x7f7f7f7f7f7f7f7fULL;
+        w++;
+    }
+
+    cache->sh->sketch_additions /= 2;
+}
+
+
+static ngx_uint_t
+ngx_http_file_cache_sketch_estimate(ngx_http_file_cache_t *cache,
+    u_char *key)
+{
+    uint32_t    hash;
+    ngx_uint_t  i, n, min, width;
+
+    width = cache->sh->sketch_mask + 1;
+    min = NGX_HTTP_FILE_CACHE_SKETCH_MAX;
+
+    for (i = 0; i < NGX_HTTP_FILE_CACHE_SKETCH_DEPTH; i++) {
+        ngx_memcpy(&hash, key + i * sizeof(uint32_t), sizeof(uint32_t));
+
+        n = cache->sh->sketch[i * width + (hash & cache->sh->sketch_mask)];
+
+        if (n < min) {
+            min = n;
+        }
+    }
+
+    return min;
+}
+
+
 static time_t
 ngx_http_file_cache_manager(void *data)
 {
     ngx_http_file_cache_t  *cache = data;
 
     off_t   size;
-    time_t  next, wait;
+    time_t  now, next, wait;
+
+    if (cache->snapshot.len) {
+        now = ngx_time();
+
+        if (cache->snapshot_next == 0) {
+            cache->snapshot_next = now + cache->snapshot_interval;
+
+        } else if (now >= cache->snapshot_next && !cache->sh->cold) {
+            ngx_http_file_cache_snapshot_write(cache);
+            cache->snapshot_next = ngx_time() + cache->snapshot_interval;
+        }
+    }
 
     next = ngx_http_file_cache_expire(cache);
 
@@ -1333,228 +2267,781 @@ ngx_http_file_cache_manager(void *data)
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
                        "http file cache size: %O", size);
 
-        if (size < cache->max_size) {
-            return next;
-        }
+        if (size < cache->max_size) {
+            return next;
+        }
+
+        wait = ngx_http_file_cache_forced_expire(cache);
+
+        if (wait > 0) {
+            return wait;
+        }
+
+        if (ngx_quit || ngx_terminate) {
+            return next;
+        }
+    }
+}
+
+
+static void
+ngx_http_file_cache_loader(void *data)
+{
+    ngx_http_file_cache_t  *cache = data;
+
+    ngx_tree_ctx_t  tree;
+
+    if (!cache->sh->cold || cache->sh->loading) {
+        return;
+    }
+
+    if (!ngx_atomic_cmp_set(&cache->sh->loading, 0, ngx_pid)) {
+        return;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache loader");
+
+    tree.init_handler = NULL;
+    tree.file_handler = ngx_http_file_cache_manage_file;
+    tree.pre_tree_handler = ngx_http_file_cache_noop;
+    tree.post_tree_handler = ngx_http_file_cache_noop;
+    tree.spec_handler = ngx_http_file_cache_delete_file;
+    tree.data = cache;
+    tree.alloc = 0;
+    tree.log = ngx_cycle->log;
+
+    cache->last = ngx_current_msec;
+    cache->files = 0;
+
+    if (ngx_walk_tree(&tree, &cache->path->name) == NGX_ABORT) {
+        cache->sh->loading = 0;
+        return;
+    }
+
+    if (cache->snapshot.len) {
+        ngx_http_file_cache_snapshot_purge(cache);
+    }
+
+    cache->sh->cold = 0;
+    cache->sh->loading = 0;
+
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                  "http file cache: %V %.3fM, bsize: %uz",
+                  &cache->path->name,
+                  ((double) cache->sh->size * cache->bsize) / (1024 * 1024),
+                  cache->bsize);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_msec_t              elapsed;
+    ngx_http_file_cache_t  *cache;
+
+    cache = ctx->data;
+
+    if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
+        (void) ngx_http_file_cache_delete_file(ctx, path);
+    }
+
+    if (++cache->files >= cache->loader_files) {
+        ngx_http_file_cache_loader_sleep(cache);
+
+    } else {
+        ngx_time_update();
+
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache loader time elapsed: %M", elapsed);
+
+        if (elapsed >= cache->loader_threshold) {
+            ngx_http_file_cache_loader_sleep(cache);
+        }
+    }
+
+    return (ngx_quit || ngx_terminate) ? NGX_ABORT : NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache)
+{
+    ngx_msleep(cache->loader_sleep);
+
+    ngx_time_update();
+
+    cache->last = ngx_current_msec;
+    cache->files = 0;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
+{
+    u_char                 *p;
+    ngx_int_t               n;
+    ngx_uint_t              i;
+    ngx_http_cache_t        c;
+    ngx_http_file_cache_t  *cache;
+
+    if (name->len < 2 * NGX_HTTP_CACHE_KEY_LEN) {
+        return NGX_ERROR;
+    }
+
+    if (ctx->size < (off_t) sizeof(ngx_http_file_cache_header_t)) {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, 0,
+                      "cache file \"%s\" is too small", name->data);
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&c, sizeof(ngx_http_cache_t));
+    cache = ctx->data;
+
+    c.length = ctx->size;
+    c.fs_size = (ctx->fs_size + cache->bsize - 1) / cache->bsize;
+
+    p = &name->data[name->len - 2 * NGX_HTTP_CACHE_KEY_LEN];
+
+    for (i = 0; i < NGX_HTTP_CACHE_KEY_LEN; i++) {
+        n = ngx_hextoi(p, 2);
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        p += 2;
+
+        c.key[i] = (u_char) n;
+    }
+
+    return ngx_http_file_cache_add(cache, &c);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
+{
+    ngx_http_file_cache_node_t  *fcn;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    fcn = ngx_http_file_cache_lookup(cache, c->key);
+
+    if (fcn == NULL) {
+
+        fcn = ngx_slab_alloc_locked(cache->shpool,
+                                    sizeof(ngx_http_file_cache_node_t));
+        if (fcn == NULL) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+
+        ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+
+        fcn->uses = 1;
+        fcn->count = 0;
+        fcn->valid_msec = 0;
+        fcn->error = 0;
+        fcn->exists = 1;
+        fcn->updating = 0;
+        fcn->deleting = 0;
+        fcn->snapshot = 0;
+        fcn->hot = 0;
+        fcn->uniq = 0;
+        fcn->valid_sec = 0;
+        fcn->body_start = 0;
+        fcn->fs_size = c->fs_size;
+
+        cache->sh->size += c->fs_size;
+
+    } else if (fcn->snapshot) {
+
+        /* 快照中的节点只确认文件存在, 不改变它在队列中的位置 */
+
+        fcn->snapshot = 0;
+
+        cache->sh->size += c->fs_size - fcn->fs_size;
+
+        if (fcn->hot) {
+            cache->sh->hot_size += c->fs_size - fcn->fs_size;
+        }
+
+        fcn->fs_size = c->fs_size;
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        return NGX_OK;
+
+    } else {
+        ngx_http_file_cache_unlink(cache, fcn);
+    }
+
+    fcn->expire = ngx_time() + cache->inactive;
+
+    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->log, 0,
+                   "http file cache delete: \"%s\"", path->data);
+
+    if (ngx_delete_file(path->data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", path->data);
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * returns the first node with the key greater than "key",
+ * or the first node of the tree if "key" is NULL
+ */
+
+static ngx_http_file_cache_node_t *
+ngx_http_file_cache_after(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_int_t                    rc;
+    ngx_rbtree_key_t             node_key;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_http_file_cache_node_t  *fcn, *found;
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    if (key == NULL) {
+        if (node == sentinel) {
+            return NULL;
+        }
+
+        return (ngx_http_file_cache_node_t *) ngx_rbtree_min(node, sentinel);
+    }
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    found = NULL;
+
+    while (node != sentinel) {
+
+        fcn = (ngx_http_file_cache_node_t *) node;
+
+        if (node->key != node_key) {
+            rc = (node->key > node_key) ? 1 : -1;
+
+        } else {
+            rc = ngx_memcmp(fcn->key, &key[sizeof(ngx_rbtree_key_t)],
+                            NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+        }
+
+        if (rc > 0) {
+            found = fcn;
+            node = node->left;
+
+        } else {
+            node = node->right;
+        }
+    }
+
+    return found;
+}
+
+
+static ngx_http_file_cache_node_t *
+ngx_http_file_cache_next(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    ngx_rbtree_node_t  *node, *parent, *sentinel;
+
+    node = &fcn->node;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    if (node->right != sentinel) {
+        return (ngx_http_file_cache_node_t *)
+                   ngx_rbtree_min(node->right, sentinel);
+    }
+
+    for ( ;; ) {
+        parent = node->parent;
+
+        if (node == cache->sh->rbtree.root) {
+            return NULL;
+        }
+
+        if (node == parent->left) {
+            return (ngx_http_file_cache_node_t *) parent;
+        }
+
+        node = parent;
+    }
+}
+
+
+/*
+ * the snapshot is loaded into a new keys zone only, the loaded nodes
+ * are marked and the cache stays cold, so the loader still walks the
+ * cache directory: it confirms the marked nodes, adds the files created
+ * after the snapshot was saved and then removes the marked nodes left
+ */
+
+static ngx_int_t
+ngx_http_file_cache_snapshot_load(ngx_http_file_cache_t *cache,
+    ngx_log_t *log)
+{
+    off_t                                   offset;
+    size_t                                  size;
+    ssize_t                                 n;
+    time_t                                  shift;
+    uint32_t                                crc;
+    uint64_t                                i, loaded;
+    ngx_err_t                               err;
+    ngx_file_t                              file;
+    ngx_file_info_t                         fi;
+    ngx_http_file_cache_node_t             *fcn;
+    ngx_http_file_cache_snapshot_rec_t     *rec;
+    ngx_http_file_cache_snapshot_header_t   h;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = cache->snapshot;
+    file.log = log;
+
+    file.fd = ngx_open_file(cache->snapshot.data, NGX_FILE_RDONLY,
+                            NGX_FILE_OPEN, 0);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
+
+        if (err != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, log, err,
+                          ngx_open_file_n " \"%s\" failed",
+                          cache->snapshot.data);
+        }
+
+        return NGX_DECLINED;
+    }
+
+    rec = NULL;
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", cache->snapshot.data);
+        goto failed;
+    }
+
+    n = ngx_read_file(&file, (u_char *) &h, sizeof(h), 0);
+
+    if (n == NGX_ERROR) {
+        goto failed;
+    }
+
+    if ((size_t) n != sizeof(h)
+        || ngx_memcmp(h.magic, ngx_http_file_cache_snapshot_magic, 8) != 0
+        || h.version != NGX_HTTP_FILE_CACHE_SNAPSHOT_VERSION
+        || h.bsize != cache->bsize
+        || h.levels != (uint32_t) (cache->path->level[0]
+                                   | cache->path->level[1] << 8
+                                   | cache->path->level[2] << 16)
+        || h.count > (uint64_t) ngx_file_size(&fi) / sizeof(*rec)
+        || (uint64_t) ngx_file_size(&fi) != sizeof(h) + h.count * sizeof(*rec))
+    {
+        goto invalid;
+    }
+
+    size = (size_t) h.count * sizeof(*rec);
+
+    if (size) {
+        rec = ngx_alloc(size, log);
+        if (rec == NULL) {
+            goto failed;
+        }
+
+        for (offset = 0; (size_t) offset < size; offset += n) {
+            n = ngx_read_file(&file, (u_char *) rec + offset,
+                              ngx_min(size - (size_t) offset,
+                                      16 * 1024 * 1024),
+                              sizeof(h) + offset);
+
+            if (n == NGX_ERROR) {
+                goto failed;
+            }
+
+            if (n == 0) {
+                goto invalid;
+            }
+        }
+    }
+
+    ngx_crc32_init(crc);
+    ngx_crc32_update(&crc, (u_char *) rec, size);
+    ngx_crc32_final(crc);
+
+    if (crc != h.crc32) {
+        goto invalid;
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", cache->snapshot.data);
+    }
+
+    /* 按过期时间排序后依次插入队列头, 恢复 LRU 的顺序 */
+
+    ngx_qsort(rec, (size_t) h.count, sizeof(*rec),
+              ngx_http_file_cache_snapshot_cmp);
+
+    /* the time the server was down is not counted as inactivity */
+
+    shift = ngx_time() - (time_t) h.time;
+
+    if (shift < 0) {
+        shift = 0;
+    }
+
+    loaded = 0;
+
+    for (i = 0; i < h.count; i++) {
+
+        if (ngx_http_file_cache_lookup(cache, rec[i].key)) {
+            continue;
+        }
+
+        fcn = ngx_slab_alloc(cache->shpool,
+                             sizeof(ngx_http_file_cache_node_t));
+        if (fcn == NULL) {
+            ngx_log_error(NGX_LOG_WARN, log, 0,
+                          "cache snapshot \"%V\" does not fit "
+                          "in the keys zone", &cache->snapshot);
+            break;
+        }
+
+        ngx_memcpy((u_char *) &fcn->node.key, rec[i].key,
+                   sizeof(ngx_rbtree_key_t));
+
+        ngx_memcpy(fcn->key, &rec[i].key[sizeof(ngx_rbtree_key_t)],
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+
+        fcn->uses = ngx_min(rec[i].uses, 1023);
+        fcn->count = 0;
+        fcn->valid_msec = 0;
+        fcn->error = 0;
+        fcn->exists = 1;
+        fcn->updating = 0;
+        fcn->deleting = 0;
+        fcn->snapshot = 1;
+        fcn->hot = 0;
+        fcn->uniq = 0;
+        fcn->valid_sec = 0;
+        fcn->body_start = 0;
+        fcn->fs_size = rec[i].fs_size;
+        fcn->expire = (time_t) rec[i].expire + shift;
+
+        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+
+        cache->sh->size += fcn->fs_size;
+
+        loaded++;
+    }
+
+    ngx_free(rec);
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "http file cache: %V %uL of %uL entries loaded "
+                  "from snapshot \"%V\"",
+                  &cache->path->name, loaded, h.count, &cache->snapshot);
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_WARN, log, 0,
+                  "cache snapshot \"%V\" is invalid and ignored",
+                  &cache->snapshot);
 
-        wait = ngx_http_file_cache_forced_expire(cache);
+failed:
 
-        if (wait > 0) {
-            return wait;
-        }
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", cache->snapshot.data);
+    }
 
-        if (ngx_quit || ngx_terminate) {
-            return next;
-        }
+    if (rec) {
+        ngx_free(rec);
     }
+
+    return NGX_DECLINED;
 }
 
 
-static void
-ngx_http_file_cache_loader(void *data)
+static int ngx_libc_cdecl
+ngx_http_file_cache_snapshot_cmp(const void *one, const void *two)
 {
-    ngx_http_file_cache_t  *cache = data;
+    ngx_http_file_cache_snapshot_rec_t  *first, *second;
 
-    ngx_tree_ctx_t  tree;
+    first = (ngx_http_file_cache_snapshot_rec_t *) one;
+    second = (ngx_http_file_cache_snapshot_rec_t *) two;
 
-    if (!cache->sh->cold || cache->sh->loading) {
-        return;
+    if (first->expire == second->expire) {
+        return 0;
     }
 
-    if (!ngx_atomic_cmp_set(&cache->sh->loading, 0, ngx_pid)) {
-        return;
-    }
+    return (first->expire < second->expire) ? -1 : 1;
+}
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache loader");
 
-    tree.init_handler = NULL;
-    tree.file_handler = ngx_http_file_cache_manage_file;
-    tree.pre_tree_handler = ngx_http_file_cache_noop;
-    tree.post_tree_handler = ngx_http_file_cache_noop;
-    tree.spec_handler = ngx_http_file_cache_delete_file;
-    tree.data = cache;
-    tree.alloc = 0;
-    tree.log = ngx_cycle->log;
+/*
+ * the keys zone is walked in the key order in batches, so the zone mutex
+ * is never held for long; the snapshot is written to a temporary file
+ * which then replaces the previous snapshot
+ */
 
-    cache->last = ngx_current_msec;
-    cache->files = 0;
+static void
+ngx_http_file_cache_snapshot_write(ngx_http_file_cache_t *cache)
+{
+    off_t                                   offset;
+    size_t                                  n;
+    uint32_t                                crc;
+    uint64_t                                count;
+    ngx_uint_t                              i, first, last;
+    ngx_file_t                              file;
+    ngx_http_file_cache_node_t             *fcn;
+    ngx_http_file_cache_snapshot_rec_t     *rec, *r;
+    ngx_http_file_cache_snapshot_header_t   h;
+    u_char                                  key[NGX_HTTP_CACHE_KEY_LEN];
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache snapshot: \"%V\"", &cache->snapshot);
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name.len = cache->snapshot.len + sizeof(".tmp") - 1;
+    file.log = ngx_cycle->log;
+
+    file.name.data = ngx_alloc(file.name.len + 1, ngx_cycle->log);
+    if (file.name.data == NULL) {
+        return;
+    }
 
-    if (ngx_walk_tree(&tree, &cache->path->name) == NGX_ABORT) {
-        cache->sh->loading = 0;
+    ngx_sprintf(file.name.data, "%V.tmp%Z", &cache->snapshot);
+
+    rec = ngx_alloc(NGX_HTTP_FILE_CACHE_SNAPSHOT_BATCH * sizeof(*rec),
+                    ngx_cycle->log);
+    if (rec == NULL) {
+        ngx_free(file.name.data);
         return;
     }
 
-    cache->sh->cold = 0;
-    cache->sh->loading = 0;
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_WRONLY,
+                            NGX_FILE_TRUNCATE, NGX_FILE_DEFAULT_ACCESS);
 
-    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
-                  "http file cache: %V %.3fM, bsize: %uz",
-                  &cache->path->name,
-                  ((double) cache->sh->size * cache->bsize) / (1024 * 1024),
-                  cache->bsize);
-}
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", file.name.data);
+        goto done;
+    }
 
+    ngx_crc32_init(crc);
 
-static ngx_int_t
-ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
-{
-    return NGX_OK;
-}
+    count = 0;
+    offset = sizeof(h);
+    first = 1;
 
+    do {
+        ngx_shmtx_lock(&cache->shpool->mutex);
 
-static ngx_int_t
-ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
-{
-    ngx_msec_t              elapsed;
-    ngx_http_file_cache_t  *cache;
+        fcn = ngx_http_file_cache_after(cache, first ? NULL : key);
+        first = 0;
 
-    cache = ctx->data;
+        r = rec;
 
-    if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
-        (void) ngx_http_file_cache_delete_file(ctx, path);
-    }
+        for (i = 0;
+             fcn && i < NGX_HTTP_FILE_CACHE_SNAPSHOT_BATCH;
+             fcn = ngx_http_file_cache_next(cache, fcn), i++)
+        {
+            ngx_memcpy(key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-    if (++cache->files >= cache->loader_files) {
-        ngx_http_file_cache_loader_sleep(cache);
+            if (!fcn->exists || fcn->deleting) {
+                continue;
+            }
 
-    } else {
-        ngx_time_update();
+            ngx_memcpy(r->key, key, NGX_HTTP_CACHE_KEY_LEN);
+            r->expire = (uint32_t) fcn->expire;
+            r->fs_size = (uint32_t) fcn->fs_size;
+            r->uses = fcn->uses;
+            r++;
+        }
 
-        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+        last = (fcn == NULL);
 
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache loader time elapsed: %M", elapsed);
+        ngx_shmtx_unlock(&cache->shpool->mutex);
 
-        if (elapsed >= cache->loader_threshold) {
-            ngx_http_file_cache_loader_sleep(cache);
-        }
-    }
+        n = (r - rec) * sizeof(*rec);
 
-    return (ngx_quit || ngx_terminate) ? NGX_ABORT : NGX_OK;
-}
+        if (n) {
+            if (ngx_write_file(&file, (u_char *) rec, n, offset) == NGX_ERROR) {
+                goto failed;
+            }
 
+            ngx_crc32_update(&crc, (u_char *) rec, n);
 
-static void
-ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache)
-{
-    ngx_msleep(cache->loader_sleep);
+            offset += n;
+            count += r - rec;
+        }
 
-    ngx_time_update();
+        if (ngx_quit || ngx_terminate) {
+            goto failed;
+        }
 
-    cache->last = ngx_current_msec;
-    cache->files = 0;
-}
+    } while (!last);
 
+    ngx_crc32_final(crc);
 
-static ngx_int_t
-ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
-{
-    u_char                 *p;
-    ngx_int_t               n;
-    ngx_uint_t              i;
-    ngx_http_cache_t        c;
-    ngx_http_file_cache_t  *cache;
+    ngx_memcpy(h.magic, ngx_http_file_cache_snapshot_magic, 8);
+    h.version = NGX_HTTP_FILE_CACHE_SNAPSHOT_VERSION;
+    h.bsize = (uint32_t) cache->bsize;
+    h.levels = cache->path->level[0]
+               | cache->path->level[1] << 8
+               | cache->path->level[2] << 16;
+    h.crc32 = crc;
+    h.count = count;
+    h.time = ngx_time();
 
-    if (name->len < 2 * NGX_HTTP_CACHE_KEY_LEN) {
-        return NGX_ERROR;
+    if (ngx_write_file(&file, (u_char *) &h, sizeof(h), 0) == NGX_ERROR) {
+        goto failed;
     }
 
-    if (ctx->size < (off_t) sizeof(ngx_http_file_cache_header_t)) {
-        ngx_log_error(NGX_LOG_CRIT, ctx->log, 0,
-                      "cache file \"%s\" is too small", name->data);
-        return NGX_ERROR;
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
     }
 
-    ngx_memzero(&c, sizeof(ngx_http_cache_t));
-    cache = ctx->data;
+    file.fd = NGX_INVALID_FILE;
 
-    c.length = ctx->size;
-    c.fs_size = (ctx->fs_size + cache->bsize - 1) / cache->bsize;
+    if (ngx_rename_file(file.name.data, cache->snapshot.data)
+        == NGX_FILE_ERROR)
+    {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%V\" failed",
+                      file.name.data, &cache->snapshot);
+        goto failed;
+    }
 
-    p = &name->data[name->len - 2 * NGX_HTTP_CACHE_KEY_LEN];
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache snapshot: %uL entries", count);
 
-    for (i = 0; i < NGX_HTTP_CACHE_KEY_LEN; i++) {
-        n = ngx_hextoi(p, 2);
+    goto done;
 
-        if (n == NGX_ERROR) {
-            return NGX_ERROR;
-        }
+failed:
 
-        p += 2;
+    if (file.fd != NGX_INVALID_FILE
+        && ngx_close_file(file.fd) == NGX_FILE_ERROR)
+    {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
 
-        c.key[i] = (u_char) n;
+    if (ngx_delete_file(file.name.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", file.name.data);
     }
 
-    return ngx_http_file_cache_add(cache, &c);
+done:
+
+    ngx_free(rec);
+    ngx_free(file.name.data);
 }
 
 
-static ngx_int_t
-ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
+static void
+ngx_http_file_cache_snapshot_purge(ngx_http_file_cache_t *cache)
 {
-    ngx_http_file_cache_node_t  *fcn;
+    ngx_uint_t                   i, first, purged;
+    ngx_http_file_cache_node_t  *fcn, *next;
+    u_char                       key[NGX_HTTP_CACHE_KEY_LEN];
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    purged = 0;
+    first = 1;
 
-    fcn = ngx_http_file_cache_lookup(cache, c->key);
+    do {
+        ngx_shmtx_lock(&cache->shpool->mutex);
 
-    if (fcn == NULL) {
+        fcn = ngx_http_file_cache_after(cache, first ? NULL : key);
+        first = 0;
 
-        fcn = ngx_slab_alloc_locked(cache->shpool,
-                                    sizeof(ngx_http_file_cache_node_t));
-        if (fcn == NULL) {
-            ngx_shmtx_unlock(&cache->shpool->mutex);
-            return NGX_ERROR;
-        }
+        for (i = 0; fcn && i < NGX_HTTP_FILE_CACHE_SNAPSHOT_BATCH; i++) {
 
-        ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-        ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
-                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+            next = ngx_http_file_cache_next(cache, fcn);
 
-        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+            if (fcn->snapshot) {
 
-        fcn->uses = 1;
-        fcn->count = 0;
-        fcn->valid_msec = 0;
-        fcn->error = 0;
-        fcn->exists = 1;
-        fcn->updating = 0;
-        fcn->deleting = 0;
-        fcn->uniq = 0;
-        fcn->valid_sec = 0;
-        fcn->body_start = 0;
-        fcn->fs_size = c->fs_size;
+                /* 目录中已经没有这个文件了 */
 
-        cache->sh->size += c->fs_size;
+                fcn->snapshot = 0;
 
-    } else {
-        ngx_queue_remove(&fcn->queue);
-    }
+                if (fcn->count == 0) {
+                    cache->sh->size -= fcn->fs_size;
 
-    fcn->expire = ngx_time() + cache->inactive;
+                    ngx_http_file_cache_unlink(cache, fcn);
+                    ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
+                    ngx_slab_free_locked(cache->shpool, fcn);
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+                    purged++;
+                }
+            }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+            fcn = next;
+        }
 
-    return NGX_OK;
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    } while (fcn);
+
+    if (purged) {
+        ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                      "http file cache: %V %ui snapshot entries "
+                      "without files removed", &cache->path->name, purged);
+    }
 }
 
 
-static ngx_int_t
-ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+ngx_http_file_cache_t *
+ngx_http_file_cache_zone(ngx_shm_zone_t *shm_zone)
 {
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->log, 0,
-                   "http file cache delete: \"%s\"", path->data);
-
-    if (ngx_delete_file(path->data) == NGX_FILE_ERROR) {
-        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
-                      ngx_delete_file_n " \"%s\" failed", path->data);
+    if (shm_zone->init != ngx_http_file_cache_init) {
+        return NULL;
     }
 
-    return NGX_OK;
+    return shm_zone->data;
 }
 
 
@@ -1589,12 +3076,12 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     off_t                   max_size;
     u_char                 *last, *p;
-    time_t                  inactive;
-    ssize_t                 size;
+    time_t                  inactive, snapshot_interval;
+    ssize_t                 size, memory, memory_max_object;
     ngx_str_t               s, name, *value;
-    ngx_int_t               loader_files;
+    ngx_int_t               loader_files, memory_min_uses;
     ngx_msec_t              loader_sleep, loader_threshold;
-    ngx_uint_t              i, n;
+    ngx_uint_t              i, n, policy;
     ngx_http_file_cache_t  *cache;
 
     cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_file_cache_t));
@@ -1611,6 +3098,11 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     loader_files = 100;
     loader_sleep = 50;
     loader_threshold = 200;
+    snapshot_interval = 300;
+    memory = 0;
+    memory_max_object = 64 * 1024;
+    memory_min_uses = 2;
+    policy = NGX_HTTP_FILE_CACHE_LRU;
 
     name.len = 0;
     size = 0;
@@ -1766,6 +3258,98 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "snapshot=", 9) == 0) {
+
+            cache->snapshot.len = value[i].len - 9;
+            cache->snapshot.data = value[i].data + 9;
+
+            if (ngx_conf_full_name(cf->cycle, &cache->snapshot, 0) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "snapshot_interval=", 18) == 0) {
+
+            s.len = value[i].len - 18;
+            s.data = value[i].data + 18;
+
+            snapshot_interval = ngx_parse_time(&s, 1);
+            if (snapshot_interval == (time_t) NGX_ERROR
+                || snapshot_interval == 0)
+            {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid snapshot_interval value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "memory=", 7) == 0) {
+
+            s.len = value[i].len - 7;
+            s.data = value[i].data + 7;
+
+            memory = ngx_parse_size(&s);
+            if (memory < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid memory size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "memory_max_object=", 18) == 0) {
+
+            s.len = value[i].len - 18;
+            s.data = value[i].data + 18;
+
+            memory_max_object = ngx_parse_size(&s);
+            if (memory_max_object == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid memory_max_object value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "memory_min_uses=", 16) == 0) {
+
+            memory_min_uses = ngx_atoi(value[i].data + 16, value[i].len - 16);
+            if (memory_min_uses == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid memory_min_uses value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "policy=", 7) == 0) {
+
+            for (n = 0; ngx_http_file_cache_policies[n].len; n++) {
+                if (ngx_strcmp(value[i].data + 7,
+                               ngx_http_file_cache_policies[n].data)
+                    == 0)
+                {
+                    policy = n;
+                    break;
+                }
+            }
+
+            if (ngx_http_file_cache_policies[n].len) {
+                continue;
+            }
+
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid policy \"%V\"", &value[i]);
+            return NGX_CONF_ERROR;
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
@@ -1778,6 +3362,14 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    if (policy == NGX_HTTP_FILE_CACHE_TINYLFU
+        && max_size == NGX_MAX_OFF_T_VALUE)
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"policy=tinylfu\" requires \"max_size\"");
+        return NGX_CONF_ERROR;
+    }
+
     cache->path->manager = ngx_http_file_cache_manager;
     cache->path->loader = ngx_http_file_cache_loader;
     cache->path->data = cache;
@@ -1786,6 +3378,7 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     cache->loader_files = loader_files;
     cache->loader_sleep = loader_sleep;
     cache->loader_threshold = loader_threshold;
+    cache->snapshot_interval = snapshot_interval;
 
     if (ngx_add_path(cf, &cache->path) != NGX_OK) {
         return NGX_CONF_ERROR;
@@ -1808,6 +3401,29 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     cache->inactive = inactive;
     cache->max_size = max_size;
+    cache->policy = policy;
+
+    if (memory) {
+        s.len = name.len + sizeof(":memory") - 1;
+
+        s.data = ngx_pnalloc(cf->pool, s.len);
+        if (s.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_sprintf(s.data, "%V:memory", &name);
+
+        cache->memory_zone = ngx_shared_memory_add(cf, &s, memory, cmd->post);
+        if (cache->memory_zone == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cache->memory_zone->init = ngx_http_file_cache_memory_init;
+        cache->memory_zone->data = cache;
+
+        cache->memory_max_object = memory_max_object;
+        cache->memory_min_uses = memory_min_uses;
+    }
 
     return NGX_CONF_OK;
 }
@@ -9,6 +9,10 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#if (NGX_HAVE_SSE2)
+#include <emmintrin.h>
+#endif
+
 
 static uint32_t  usual[] = {
     0xffffdbfe, /* 1111 1111 1111 1111  1101 1011 1111 1110 */
@@ -33,6 +37,135 @@ static uint32_t  usual[] = {
 };
 
 
+#if (NGX_HAVE_SSE2)
+
+/*
+ * returns the first of ' ', CR, LF, '\0' or "c" in the buffer, 16 bytes
+ * are tested at once; a tail shorter than 16 bytes is left to the caller
+ * and the position where the scan has stopped is returned
+ */
+
+static ngx_inline u_char *
+ngx_http_parse_skip(u_char *p, u_char *last, u_char c)
+{
+    unsigned  m;
+    __m128i   v, sp, cr, lf, ch;
+
+    sp = _mm_set1_epi8(' ');
+    cr = _mm_set1_epi8(CR);
+    lf = _mm_set1_epi8(LF);
+    ch = _mm_set1_epi8((char) c);
+
+    while (last - p >= 16) {
+        v = _mm_loadu_si128((__m128i *) p);
+
+        m = _mm_movemask_epi8(
+                _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(v, sp),
+                                 _mm_cmpeq_epi8(v, cr)),
+                    _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, lf),
+                                              _mm_cmpeq_epi8(v, ch)),
+                                 _mm_cmpeq_epi8(v, _mm_setzero_si128()))));
+
+        if (m) {
+            return p + __builtin_ctz(m);
+        }
+
+        p += 16;
+    }
+
+    return p;
+}
+
+
+/*
+ * copies the run of bytes that does not change the state of
+ * ngx_http_parse_complex_uri() in sw_usual: the "usual" characters,
+ * "+", "." and "/" followed by one of them; r->plus_in_uri and
+ * r->uri_ext are updated as the state machine would have done
+ */
+
+static ngx_inline u_char *
+ngx_http_parse_copy_usual(ngx_http_request_t *r, u_char **up, u_char *p,
+    u_char *last)
+{
+    u_char    *u;
+    unsigned   hard, sl, dt, pl, n, run, ls;
+    __m128i    v;
+
+    u = *up;
+
+    while (last - p >= 16) {
+        v = _mm_loadu_si128((__m128i *) p);
+
+        hard = _mm_movemask_epi8(
+                   _mm_or_si128(
+                       _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('%')),
+                                    _mm_cmpeq_epi8(v, _mm_set1_epi8('?'))),
+#if (NGX_WIN32)
+                       _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\')),
+                                    _mm_cmpeq_epi8(v, _mm_set1_epi8('#')))));
+#else
+                       _mm_cmpeq_epi8(v, _mm_set1_epi8('#'))));
+#endif
+
+        sl = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+        dt = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('.')));
+        pl = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('+')));
+
+        /*
+         * "/" 后面是普通字符时状态会回到 sw_usual, 可以直接复制;
+         * 块内最后一个 "/" 看不到下一个字符, 留给状态机
+         */
+
+        hard |= sl & ~(~((hard | sl | dt) >> 1) & 0x7fff);
+
+        n = hard ? (unsigned) __builtin_ctz(hard) : 16;
+
+        if (n == 0) {
+            break;
+        }
+
+        run = (n == 16) ? 0xffff : (1u << n) - 1;
+
+        if (pl & run) {
+            r->plus_in_uri = 1;
+        }
+
+        sl &= run;
+        dt &= run;
+
+        if (sl) {
+            ls = 31 - __builtin_clz(sl);
+            dt &= ~((2u << ls) - 1);
+            r->uri_ext = NULL;
+        }
+
+        if (dt) {
+            r->uri_ext = u + (31 - __builtin_clz(dt)) + 1;
+        }
+
+        if (n < 16) {
+            /* 只有整块都能复制时才整块写, 否则可能越过 r->uri.data 的结尾 */
+            u = ngx_cpymem(u, p, n);
+            p += n;
+            break;
+        }
+
+        _mm_storeu_si128((__m128i *) u, v);
+
+        u += 16;
+        p += 16;
+    }
+
+    *up = u;
+
+    return p;
+}
+
+#endif
+
+
 #if (NGX_HAVE_LITTLE_ENDIAN && NGX_HAVE_NONALIGNED)
 
 #define ngx_str3_cmp(m, c0, c1, c2, c3)                                       \
@@ -616,6 +749,10 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         case sw_uri:
 
             if (usual[ch >> 5] & (1 << (ch & 0x1f))) {
+#if (NGX_HAVE_SSE2)
+                /* 参数中只有这几个字符会改变状态 */
+                p = ngx_http_parse_skip(p + 1, b->last, '#') - 1;
+#endif
                 break;
             }
 
@@ -987,6 +1124,12 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
                 goto done;
             case '\0':
                 return NGX_HTTP_PARSE_INVALID_HEADER;
+            default:
+#if (NGX_HAVE_SSE2)
+                /* skip long values such as cookies at once */
+                p = ngx_http_parse_skip(p + 1, b->last, ' ') - 1;
+#endif
+                break;
             }
             break;
 
@@ -1110,6 +1253,9 @@ ngx_http_parse_complex_uri(ngx_http_request_t *r, ngx_uint_t merge_slashes)
 
             if (usual[ch >> 5] & (1 << (ch & 0x1f))) {
                 *u++ = ch;
+#if (NGX_HAVE_SSE2)
+                p = ngx_http_parse_copy_usual(r, &u, p, r->uri_end);
+#endif
                 ch = *p++;
                 break;
             }
@@ -1798,3 +1944,260 @@ ngx_http_split_args(ngx_http_request_t *r, ngx_str_t *uri, ngx_str_t *args)
         args->len = 0;
     }
 }
+
+
+ngx_int_t
+ngx_http_parse_chunked(ngx_http_request_t *r, ngx_buf_t *b,
+    ngx_http_chunked_t *ctx)
+{
+    u_char     *pos, ch, c;
+    ngx_int_t   rc;
+    enum {
+        sw_chunk_start = 0,
+        sw_chunk_size,
+        sw_chunk_extension,
+        sw_chunk_extension_almost_done,
+        sw_chunk_data,
+        sw_after_data,
+        sw_after_data_almost_done,
+        sw_last_chunk_extension,
+        sw_last_chunk_extension_almost_done,
+        sw_trailer,
+        sw_trailer_almost_done,
+        sw_trailer_header,
+        sw_trailer_header_almost_done
+    } state;
+
+    state = ctx->state;
+
+    if (state == sw_chunk_data && ctx->size == 0) {
+        state = sw_after_data;
+    }
+
+    rc = NGX_AGAIN;
+
+    for (pos = b->pos; pos < b->last; pos++) {
+
+        ch = *pos;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http chunked byte: %02Xd s:%d", ch, state);
+
+        switch (state) {
+
+        case sw_chunk_start:
+            if (ch >= '0' && ch <= '9') {
+                state = sw_chunk_size;
+                ctx->size = ch - '0';
+                break;
+            }
+
+            c = (u_char) (ch | 0x20);
+
+            if (c >= 'a' && c <= 'f') {
+                state = sw_chunk_size;
+                ctx->size = c - 'a' + 10;
+                break;
+            }
+
+            goto invalid;
+
+        case sw_chunk_size:
+            if (ctx->size > NGX_MAX_OFF_T_VALUE / 16) {
+                goto invalid;
+            }
+
+            if (ch >= '0' && ch <= '9') {
+                ctx->size = ctx->size * 16 + (ch - '0');
+                break;
+            }
+
+            c = (u_char) (ch | 0x20);
+
+            if (c >= 'a' && c <= 'f') {
+                ctx->size = ctx->size * 16 + (c - 'a' + 10);
+                break;
+            }
+
+            if (ctx->size == 0) {
+
+                switch (ch) {
+                case CR:
+                    state = sw_last_chunk_extension_almost_done;
+                    break;
+                case LF:
+                    state = sw_trailer;
+                    break;
+                case ';':
+                case ' ':
+                case '\t':
+                    state = sw_last_chunk_extension;
+                    break;
+                default:
+                    goto invalid;
+                }
+
+                break;
+            }
+
+            switch (ch) {
+            case CR:
+                state = sw_chunk_extension_almost_done;
+                break;
+            case LF:
+                state = sw_chunk_data;
+                break;
+            case ';':
+            case ' ':
+            case '\t':
+                state = sw_chunk_extension;
+                break;
+            default:
+                goto invalid;
+            }
+
+            break;
+
+        case sw_chunk_extension:
+            switch (ch) {
+            case CR:
+                state = sw_chunk_extension_almost_done;
+                break;
+            case LF:
+                state = sw_chunk_data;
+            }
+            break;
+
+        case sw_chunk_extension_almost_done:
+            if (ch == LF) {
+                state = sw_chunk_data;
+                break;
+            }
+            goto invalid;
+
+        case sw_chunk_data:
+            rc = NGX_OK;
+            goto data;
+
+        case sw_after_data:
+            switch (ch) {
+            case CR:
+                state = sw_after_data_almost_done;
+                break;
+            case LF:
+                state = sw_chunk_start;
+            }
+            break;
+
+        case sw_after_data_almost_done:
+            if (ch == LF) {
+                state = sw_chunk_start;
+                break;
+            }
+            goto invalid;
+
+        case sw_last_chunk_extension:
+            switch (ch) {
+            case CR:
+                state = sw_last_chunk_extension_almost_done;
+                break;
+            case LF:
+                state = sw_trailer;
+            }
+            break;
+
+        case sw_last_chunk_extension_almost_done:
+            if (ch == LF) {
+                state = sw_trailer;
+                break;
+            }
+            goto invalid;
+
+        case sw_trailer:
+            switch (ch) {
+            case CR:
+                state = sw_trailer_almost_done;
+                break;
+            case LF:
+                goto done;
+            default:
+                state = sw_trailer_header;
+            }
+            break;
+
+        case sw_trailer_almost_done:
+            if (ch == LF) {
+                goto done;
+            }
+            goto invalid;
+
+        case sw_trailer_header:
+            switch (ch) {
+            case CR:
+                state = sw_trailer_header_almost_done;
+                break;
+            case LF:
+                state = sw_trailer;
+            }
+            break;
+
+        case sw_trailer_header_almost_done:
+            if (ch == LF) {
+                state = sw_trailer;
+                break;
+            }
+            goto invalid;
+
+        }
+    }
+
+data:
+
+    ctx->state = state;
+    b->pos = pos;
+
+    switch (state) {
+
+    case sw_chunk_start:
+        ctx->length = 3 /* "0" LF LF */;
+        break;
+    case sw_chunk_size:
+        ctx->length = 2 /* LF LF */
+                      + (ctx->size ? ctx->size + 4 /* LF "0" LF LF */ : 0);
+        break;
+    case sw_chunk_extension:
+    case sw_chunk_extension_almost_done:
+        ctx->length = 1 /* LF */ + ctx->size + 4 /* LF "0" LF LF */;
+        break;
+    case sw_chunk_data:
+        ctx->length = ctx->size + 4 /* LF "0" LF LF */;
+        break;
+    case sw_after_data:
+    case sw_after_data_almost_done:
+        ctx->length = 4 /* LF "0" LF LF */;
+        break;
+    case sw_last_chunk_extension:
+    case sw_last_chunk_extension_almost_done:
+        ctx->length = 2 /* LF LF */;
+        break;
+    case sw_trailer:
+    case sw_trailer_almost_done:
+        ctx->length = 1 /* LF */;
+        break;
+    case sw_trailer_header:
+    case sw_trailer_header_almost_done:
+        ctx->length = 2 /* LF LF */;
+        break;
+
+    }
+
+    return rc;
+
+done:
+
+    return NGX_DONE;
+
+invalid:
+
+    return NGX_ERROR;
+}
@@ -53,6 +53,7 @@ static ngx_int_t
 ngx_http_postpone_filter(ngx_http_request_t *r, ngx_chain_t *in)
 {
     ngx_connection_t              *c;
+    ngx_http_request_t            *sr;
     ngx_http_postponed_request_t  *pr;
 
     c = r->connection;
@@ -101,9 +102,14 @@ ngx_http_postpone_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
             r->postponed = pr->next;
 
-            c->data = pr->request;
+            sr = pr->request;
 
-            return ngx_http_post_request(pr->request, NULL);
+            (void) ngx_pfree_size(r->pool, pr,
+                                  sizeof(ngx_http_postponed_request_t));
+
+            c->data = sr;
+
+            return ngx_http_post_request(sr, NULL);
         }
 
         if (pr->out == NULL) {
@@ -123,6 +129,8 @@ ngx_http_postpone_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
         r->postponed = pr->next;
 
+        (void) ngx_pfree_size(r->pool, pr, sizeof(ngx_http_postponed_request_t));
+
     } while (r->postponed);
 
     return NGX_OK;
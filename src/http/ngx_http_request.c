@@ -30,6 +30,10 @@ static ngx_int_t ngx_http_process_user_agent(ngx_http_request_t *r,
 static ngx_int_t ngx_http_process_cookie(ngx_http_request_t *r,
     ngx_table_elt_t *h, ngx_uint_t offset);
 
+static ngx_uint_t ngx_http_known_header_in(u_char *name, size_t len);
+static ngx_http_header_t *ngx_http_find_header_in(ngx_http_request_t *r,
+    ngx_table_elt_t *h);
+
 static ngx_int_t ngx_http_process_request_header(ngx_http_request_t *r);
 static void ngx_http_process_request(ngx_http_request_t *r);
 static ssize_t ngx_http_validate_host(ngx_http_request_t *r, u_char **host,
@@ -52,6 +56,10 @@ static void ngx_http_lingering_close_handler(ngx_event_t *ev);
 static ngx_int_t ngx_http_post_action(ngx_http_request_t *r);
 static void ngx_http_close_request(ngx_http_request_t *r, ngx_int_t error);
 static void ngx_http_free_request(ngx_http_request_t *r, ngx_int_t error);
+static ngx_http_request_t *ngx_http_alloc_request(ngx_connection_t *c);
+static ngx_int_t ngx_http_free_request_memory(ngx_connection_t *c,
+    ngx_http_request_t *r);
+static void ngx_http_request_cache_cleanup(void *data);
 static void ngx_http_log_request(ngx_http_request_t *r);
 static void ngx_http_close_connection(ngx_connection_t *c);
 
@@ -65,6 +73,9 @@ static void ngx_http_ssl_handshake_handler(ngx_connection_t *c);
 #endif
 
 
+ngx_http_request_cache_t  ngx_http_request_cache;
+
+
 static char *ngx_http_client_errors[] = {
 
     /* NGX_HTTP_PARSE_INVALID_METHOD */
@@ -178,6 +189,257 @@ ngx_http_header_t  ngx_http_headers_in[] = {
     { ngx_null_string, 0, NULL }
 };
 
+
+/* 已知请求头在 ngx_http_known_headers_in[] 中的位置 */
+
+#define NGX_HTTP_HI_HOST                  0
+#define NGX_HTTP_HI_CONNECTION            1
+#define NGX_HTTP_HI_IF_MODIFIED_SINCE     2
+#define NGX_HTTP_HI_IF_UNMODIFIED_SINCE   3
+#define NGX_HTTP_HI_USER_AGENT            4
+#define NGX_HTTP_HI_REFERER               5
+#define NGX_HTTP_HI_CONTENT_LENGTH        6
+#define NGX_HTTP_HI_CONTENT_TYPE          7
+#define NGX_HTTP_HI_RANGE                 8
+#define NGX_HTTP_HI_IF_RANGE              9
+#define NGX_HTTP_HI_TRANSFER_ENCODING     10
+#define NGX_HTTP_HI_EXPECT                11
+#define NGX_HTTP_HI_ACCEPT_ENCODING       12
+#define NGX_HTTP_HI_VIA                   13
+#define NGX_HTTP_HI_AUTHORIZATION         14
+#define NGX_HTTP_HI_KEEP_ALIVE            15
+#define NGX_HTTP_HI_X_FORWARDED_FOR       16
+#define NGX_HTTP_HI_X_REAL_IP             17
+#define NGX_HTTP_HI_ACCEPT                18
+#define NGX_HTTP_HI_ACCEPT_LANGUAGE       19
+#define NGX_HTTP_HI_DEPTH                 20
+#define NGX_HTTP_HI_DESTINATION           21
+#define NGX_HTTP_HI_OVERWRITE             22
+#define NGX_HTTP_HI_DATE                  23
+#define NGX_HTTP_HI_COOKIE                24
+#define NGX_HTTP_HI_LAST                  25
+#define NGX_HTTP_HI_UNKNOWN               NGX_HTTP_HI_LAST
+
+
+static ngx_http_header_t  *ngx_http_known_headers_in[NGX_HTTP_HI_LAST];
+static ngx_uint_t          ngx_http_known_headers_in_all;
+
+
+/*
+ * the well-known headers are recognized by their length and a character
+ * that differs between the names of the same length, the name is then
+ * compared with ngx_memcmp() of a constant length, which compilers expand
+ * into a few word comparisons
+ */
+
+#define ngx_http_known_header_cmp(s, n)                                       \
+    if (ngx_memcmp(name, s, sizeof(s) - 1) == 0) {                            \
+        return n;                                                             \
+    }
+
+static ngx_uint_t
+ngx_http_known_header_in(u_char *name, size_t len)
+{
+    switch (len) {
+
+    case 3:
+        ngx_http_known_header_cmp("via", NGX_HTTP_HI_VIA);
+        break;
+
+    case 4:
+        switch (name[0]) {
+        case 'h':
+            ngx_http_known_header_cmp("host", NGX_HTTP_HI_HOST);
+            break;
+        case 'd':
+            ngx_http_known_header_cmp("date", NGX_HTTP_HI_DATE);
+            break;
+        }
+        break;
+
+    case 5:
+        switch (name[0]) {
+        case 'r':
+            ngx_http_known_header_cmp("range", NGX_HTTP_HI_RANGE);
+            break;
+        case 'd':
+            ngx_http_known_header_cmp("depth", NGX_HTTP_HI_DEPTH);
+            break;
+        }
+        break;
+
+    case 6:
+        switch (name[0]) {
+        case 'c':
+            ngx_http_known_header_cmp("cookie", NGX_HTTP_HI_COOKIE);
+            break;
+        case 'a':
+            ngx_http_known_header_cmp("accept", NGX_HTTP_HI_ACCEPT);
+            break;
+        case 'e':
+            ngx_http_known_header_cmp("expect", NGX_HTTP_HI_EXPECT);
+            break;
+        }
+        break;
+
+    case 7:
+        ngx_http_known_header_cmp("referer", NGX_HTTP_HI_REFERER);
+        break;
+
+    case 8:
+        ngx_http_known_header_cmp("if-range", NGX_HTTP_HI_IF_RANGE);
+        break;
+
+    case 9:
+        switch (name[0]) {
+        case 'x':
+            ngx_http_known_header_cmp("x-real-ip", NGX_HTTP_HI_X_REAL_IP);
+            break;
+        case 'o':
+            ngx_http_known_header_cmp("overwrite", NGX_HTTP_HI_OVERWRITE);
+            break;
+        }
+        break;
+
+    case 10:
+        switch (name[0]) {
+        case 'u':
+            ngx_http_known_header_cmp("user-agent", NGX_HTTP_HI_USER_AGENT);
+            break;
+        case 'c':
+            ngx_http_known_header_cmp("connection", NGX_HTTP_HI_CONNECTION);
+            break;
+        case 'k':
+            ngx_http_known_header_cmp("keep-alive", NGX_HTTP_HI_KEEP_ALIVE);
+            break;
+        }
+        break;
+
+    case 11:
+        ngx_http_known_header_cmp("destination", NGX_HTTP_HI_DESTINATION);
+        break;
+
+    case 12:
+        ngx_http_known_header_cmp("content-type", NGX_HTTP_HI_CONTENT_TYPE);
+        break;
+
+    case 13:
+        ngx_http_known_header_cmp("authorization", NGX_HTTP_HI_AUTHORIZATION);
+        break;
+
+    case 14:
+        ngx_http_known_header_cmp("content-length",
+                                  NGX_HTTP_HI_CONTENT_LENGTH);
+        break;
+
+    case 15:
+        switch (name[7]) {
+        case 'e':
+            ngx_http_known_header_cmp("accept-encoding",
+                                      NGX_HTTP_HI_ACCEPT_ENCODING);
+            break;
+        case 'l':
+            ngx_http_known_header_cmp("accept-language",
+                                      NGX_HTTP_HI_ACCEPT_LANGUAGE);
+            break;
+        case 'r':
+            ngx_http_known_header_cmp("x-forwarded-for",
+                                      NGX_HTTP_HI_X_FORWARDED_FOR);
+            break;
+        }
+        break;
+
+    case 17:
+        switch (name[0]) {
+        case 'i':
+            ngx_http_known_header_cmp("if-modified-since",
+                                      NGX_HTTP_HI_IF_MODIFIED_SINCE);
+            break;
+        case 't':
+            ngx_http_known_header_cmp("transfer-encoding",
+                                      NGX_HTTP_HI_TRANSFER_ENCODING);
+            break;
+        }
+        break;
+
+    case 19:
+        ngx_http_known_header_cmp("if-unmodified-since",
+                                  NGX_HTTP_HI_IF_UNMODIFIED_SINCE);
+        break;
+    }
+
+    return NGX_HTTP_HI_UNKNOWN;
+}
+
+
+ngx_int_t
+ngx_http_init_known_headers_in(ngx_conf_t *cf)
+{
+    u_char             *name;
+    ngx_uint_t          n;
+    ngx_http_header_t  *header;
+
+    ngx_http_known_headers_in_all = 1;
+
+    for (header = ngx_http_headers_in; header->name.len; header++) {
+
+        name = ngx_pnalloc(cf->temp_pool, header->name.len);
+        if (name == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_strlow(name, header->name.data, header->name.len);
+
+        n = ngx_http_known_header_in(name, header->name.len);
+
+        if (n == NGX_HTTP_HI_UNKNOWN) {
+
+#if (NGX_DEBUG)
+            ngx_log_error(NGX_LOG_ALERT, cf->log, 0,
+                          "header \"%V\" is missed in known headers, "
+                          "falling back to the headers hash",
+                          &header->name);
+#endif
+
+            /* a header missed in the switch is found in the hash */
+
+            ngx_http_known_headers_in_all = 0;
+            continue;
+        }
+
+        ngx_http_known_headers_in[n] = header;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_http_header_t *
+ngx_http_find_header_in(ngx_http_request_t *r, ngx_table_elt_t *h)
+{
+    ngx_uint_t                  n;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    n = ngx_http_known_header_in(h->lowcase_key, h->key.len);
+
+    if (n != NGX_HTTP_HI_UNKNOWN) {
+
+        /* NULL if the header is not compiled in */
+
+        return ngx_http_known_headers_in[n];
+    }
+
+    if (ngx_http_known_headers_in_all) {
+        return NULL;
+    }
+
+    cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+
+    return ngx_hash_find(&cmcf->headers_in_hash, h->hash,
+                         h->lowcase_key, h->key.len);
+}
+
+
 /**
  * @brief 建立连接后，该函数作为监听对象的handler，由事件框架回调
  * @param c
@@ -210,7 +472,7 @@ ngx_http_init_connection(ngx_connection_t *c)
     c->write->handler = ngx_http_empty_handler;/*不做任何工作*/
 
 #if (NGX_STAT_STUB)
-    (void) ngx_atomic_fetch_add(ngx_stat_reading, 1);
+    ngx_stat->reading++;
 #endif
 
     if (rev->ready) {/*套接字上已缓存客户端发来的数据*/
@@ -231,7 +493,7 @@ ngx_http_init_connection(ngx_connection_t *c)
 	/*将读事件加入epoll中*/
     if (ngx_handle_read_event(rev, 0) != NGX_OK) {
 #if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_reading, -1);
+        ngx_stat->reading--;
 #endif
         ngx_http_close_connection(c);
         return;
@@ -253,6 +515,7 @@ ngx_http_init_request(ngx_event_t *rev)
     ngx_http_port_t            *port;
     ngx_http_in_addr_t         *addr;
     ngx_http_log_ctx_t         *ctx;
+    ngx_pool_cleanup_t         *cln;
     ngx_http_addr_conf_t       *addr_conf;
     ngx_http_connection_t      *hc;
     ngx_http_core_srv_conf_t   *cscf;
@@ -264,7 +527,7 @@ ngx_http_init_request(ngx_event_t *rev)
 #endif
 
 #if (NGX_STAT_STUB)
-    (void) ngx_atomic_fetch_add(ngx_stat_reading, -1);
+    ngx_stat->reading--;
 #endif
 
     c = rev->data;/*与事件相关的TCP连接对象*/
@@ -286,6 +549,17 @@ ngx_http_init_request(ngx_event_t *rev)
             ngx_http_close_connection(c);
             return;
         }
+
+        if (ngx_http_request_cache.max) {
+            cln = ngx_pool_cleanup_add(c->pool, 0);
+            if (cln == NULL) {
+                ngx_http_close_connection(c);
+                return;
+            }
+
+            cln->handler = ngx_http_request_cache_cleanup;
+            cln->data = hc;
+        }
     }
 
     r = hc->request;/*与HTTP连接对象相关的请求对象*/
@@ -300,7 +574,7 @@ ngx_http_init_request(ngx_event_t *rev)
         }
 
     } else {
-        r = ngx_pcalloc(c->pool, sizeof(ngx_http_request_t));
+        r = ngx_http_alloc_request(c);
         if (r == NULL) {
             ngx_http_close_connection(c);
             return;
@@ -458,7 +732,8 @@ ngx_http_init_request(ngx_event_t *rev)
         r->header_in = c->buffer;
     }
 	//构造请求的内存池
-    r->pool = ngx_create_pool(cscf->request_pool_size, c->log);
+    r->pool = ngx_create_cached_pool(&ngx_http_request_cache.pools,
+                                     cscf->request_pool_size, c->log);
     if (r->pool == NULL) {
         ngx_http_close_connection(c);
         return;
@@ -519,9 +794,9 @@ ngx_http_init_request(ngx_event_t *rev)
     r->log_handler = ngx_http_log_error_handler;
 
 #if (NGX_STAT_STUB)
-    (void) ngx_atomic_fetch_add(ngx_stat_reading, 1);
+    ngx_stat->reading++;
     r->stat_reading = 1;
-    (void) ngx_atomic_fetch_add(ngx_stat_requests, 1);
+    ngx_stat->requests++;
 #endif
 
     rev->handler(rev);
@@ -1096,8 +1371,7 @@ ngx_http_process_request_headers(ngx_event_t *rev)
                 ngx_strlow(h->lowcase_key, h->key.data, h->key.len);
             }
 
-            hh = ngx_hash_find(&cmcf->headers_in_hash, h->hash,
-                               h->lowcase_key, h->key.len);
+            hh = ngx_http_find_header_in(r, h);
 
             if (hh && hh->handler(r, h, hh->offset) != NGX_OK) {
                 return;
@@ -1572,14 +1846,6 @@ ngx_http_process_request_header(ngx_http_request_t *r)
         }
     }
 
-    if (r->method & NGX_HTTP_PUT && r->headers_in.content_length_n == -1) {
-        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
-                  "client sent %V method without \"Content-Length\" header",
-                  &r->method_name);
-        ngx_http_finalize_request(r, NGX_HTTP_LENGTH_REQUIRED);
-        return NGX_ERROR;
-    }
-
     if (r->method & NGX_HTTP_TRACE) {
         ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
                       "client sent TRACE method");
@@ -1587,12 +1853,35 @@ ngx_http_process_request_header(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
-    if (r->headers_in.transfer_encoding
-        && ngx_strcasestrn(r->headers_in.transfer_encoding->value.data,
-                           "chunked", 7 - 1))
+    if (r->headers_in.transfer_encoding) {
+        if (r->headers_in.transfer_encoding->value.len == 7
+            && ngx_strncasecmp(r->headers_in.transfer_encoding->value.data,
+                               (u_char *) "chunked", 7) == 0)
+        {
+            /* 分块编码的包体，长度只有在读完后才能知道 */
+            r->headers_in.content_length = NULL;
+            r->headers_in.content_length_n = -1;
+            r->headers_in.chunked = 1;
+
+        } else if (r->headers_in.transfer_encoding->value.len != 8
+            || ngx_strncasecmp(r->headers_in.transfer_encoding->value.data,
+                               (u_char *) "identity", 8) != 0)
+        {
+            ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                          "client sent unknown \"Transfer-Encoding\": \"%V\"",
+                          &r->headers_in.transfer_encoding->value);
+            ngx_http_finalize_request(r, NGX_HTTP_NOT_IMPLEMENTED);
+            return NGX_ERROR;
+        }
+    }
+
+    if (r->method & NGX_HTTP_PUT
+        && r->headers_in.content_length_n == -1
+        && !r->headers_in.chunked)
     {
         ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
-                      "client sent \"Transfer-Encoding: chunked\" header");
+                  "client sent %V method without \"Content-Length\" header",
+                  &r->method_name);
         ngx_http_finalize_request(r, NGX_HTTP_LENGTH_REQUIRED);
         return NGX_ERROR;
     }
@@ -1676,9 +1965,9 @@ ngx_http_process_request(ngx_http_request_t *r)
     }
 
 #if (NGX_STAT_STUB)
-    (void) ngx_atomic_fetch_add(ngx_stat_reading, -1);
+    ngx_stat->reading--;
     r->stat_reading = 0;
-    (void) ngx_atomic_fetch_add(ngx_stat_writing, 1);
+    ngx_stat->writing++;
     r->stat_writing = 1;
 #endif
 	/*重新设置连接的读写请求处理函数，以便后续的请求处理*/
@@ -1877,6 +2166,7 @@ ngx_http_run_posted_requests(ngx_connection_t *c)
 {
     ngx_http_request_t         *r;
     ngx_http_log_ctx_t         *ctx;
+    ngx_http_ephemeral_t       *e;
     ngx_http_posted_request_t  *pr;
 
     for ( ;; ) {
@@ -1896,6 +2186,13 @@ ngx_http_run_posted_requests(ngx_connection_t *c)
 
         r = pr->request;
 
+        e = ngx_http_ephemeral(r->main);
+
+        if (pr != &e->terminal_posted_request) {
+            (void) ngx_pfree_size(r->pool, pr,
+                                  sizeof(ngx_http_posted_request_t));
+        }
+
         ctx = c->log->data;
         ctx->current_request = r;
 
@@ -2028,6 +2325,34 @@ ngx_http_finalize_request(ngx_http_request_t *r, ngx_int_t rc)
 
         pr = r->parent;
 
+        if (r->background) {
+
+            /* 后台子请求不在父请求的postponed链表中, 直接结束 */
+
+            r->main->subrequests++;
+
+            if (!r->logged) {
+
+                clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+                if (clcf->log_subrequest) {
+                    ngx_http_log_request(r);
+                }
+
+                r->logged = 1;
+
+            } else {
+                ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                              "subrequest: \"%V?%V\" logged again",
+                              &r->uri, &r->args);
+            }
+
+            r->done = 1;
+
+            ngx_http_finalize_connection(r);
+            return;
+        }
+
         if (r == c->data) {
 
             r->main->count--;
@@ -2207,6 +2532,14 @@ ngx_http_finalize_connection(ngx_http_request_t *r)
         return;
     }
 
+    r = r->main;
+
+    if (r->reading_body) {
+        /* 包体还没有读完，连接不能再复用 */
+        r->keepalive = 0;
+        r->lingering_close = 1;
+    }
+
     if (!ngx_terminate
          && !ngx_exiting
          && r->keepalive
@@ -2541,7 +2874,7 @@ ngx_http_set_keepalive(ngx_http_request_t *r)
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "pipelined request");
 
 #if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_reading, 1);
+        ngx_stat->reading++;
 #endif
 
         hc->pipeline = 1;
@@ -2562,7 +2895,7 @@ ngx_http_set_keepalive(ngx_http_request_t *r)
      * are freed too.
      */
 
-    if (ngx_pfree(c->pool, r) == NGX_OK) {
+    if (ngx_http_free_request_memory(c, r) == NGX_OK) {
         hc->request = NULL;
     }
 
@@ -2585,9 +2918,16 @@ ngx_http_set_keepalive(ngx_http_request_t *r)
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0, "hc free: %p %d",
                    hc->free, hc->nfree);
 
+    /*
+     * the large header buffers are allocated on each request that needs
+     * them, so their ngx_buf_t's are returned to the c->pool too
+     */
+
     if (hc->free) {
         for (i = 0; i < hc->nfree; i++) {
-            ngx_pfree(c->pool, hc->free[i]->start);
+            f = hc->free[i];
+            (void) ngx_pfree_size(c->pool, f->start, f->end - f->start);
+            (void) ngx_pfree_size(c->pool, f, sizeof(ngx_buf_t));
             hc->free[i] = NULL;
         }
 
@@ -2599,7 +2939,9 @@ ngx_http_set_keepalive(ngx_http_request_t *r)
 
     if (hc->busy) {
         for (i = 0; i < hc->nbusy; i++) {
-            ngx_pfree(c->pool, hc->busy[i]->start);
+            f = hc->busy[i];
+            (void) ngx_pfree_size(c->pool, f->start, f->end - f->start);
+            (void) ngx_pfree_size(c->pool, f, sizeof(ngx_buf_t));
             hc->busy[i] = NULL;
         }
 
@@ -2772,7 +3114,7 @@ ngx_http_keepalive_handler(ngx_event_t *rev)
     b->last += n;
 
 #if (NGX_STAT_STUB)
-    (void) ngx_atomic_fetch_add(ngx_stat_reading, 1);
+    ngx_stat->reading++;
 #endif
 
     c->log->handler = ngx_http_log_error;
@@ -3028,11 +3370,11 @@ ngx_http_free_request(ngx_http_request_t *r, ngx_int_t rc)
 #if (NGX_STAT_STUB)
 
     if (r->stat_reading) {
-        (void) ngx_atomic_fetch_add(ngx_stat_reading, -1);
+        ngx_stat->reading--;
     }
 
     if (r->stat_writing) {
-        (void) ngx_atomic_fetch_add(ngx_stat_writing, -1);
+        ngx_stat->writing--;
     }
 
 #endif
@@ -3071,7 +3413,77 @@ ngx_http_free_request(ngx_http_request_t *r, ngx_int_t rc)
 
     r->connection->destroyed = 1;
 
-    ngx_destroy_pool(r->pool);
+    ngx_destroy_cached_pool(&ngx_http_request_cache.pools, r->pool);
+}
+
+
+/*
+ * the ngx_http_request_t's are allocated outside of the c->pool when
+ * they are cached, and are returned to the cache when a keepalive
+ * connection becomes idle or is closed
+ */
+
+static ngx_http_request_t *
+ngx_http_alloc_request(ngx_connection_t *c)
+{
+    ngx_http_request_t  *r;
+
+    if (ngx_http_request_cache.max == 0) {
+        return ngx_pcalloc(c->pool, sizeof(ngx_http_request_t));
+    }
+
+    r = ngx_http_request_cache.free;
+
+    if (r) {
+        ngx_http_request_cache.free = r->main;
+        ngx_http_request_cache.nfree--;
+        ngx_http_request_cache.hits++;
+
+    } else {
+        ngx_http_request_cache.misses++;
+
+        r = ngx_alloc(sizeof(ngx_http_request_t), c->log);
+        if (r == NULL) {
+            return NULL;
+        }
+    }
+
+    ngx_memzero(r, sizeof(ngx_http_request_t));
+
+    return r;
+}
+
+
+static ngx_int_t
+ngx_http_free_request_memory(ngx_connection_t *c, ngx_http_request_t *r)
+{
+    if (ngx_http_request_cache.max == 0) {
+        return ngx_pfree(c->pool, r);
+    }
+
+    if (ngx_http_request_cache.nfree >= ngx_http_request_cache.max) {
+        ngx_free(r);
+        return NGX_OK;
+    }
+
+    r->main = ngx_http_request_cache.free;
+    ngx_http_request_cache.free = r;
+    ngx_http_request_cache.nfree++;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_request_cache_cleanup(void *data)
+{
+    ngx_http_connection_t  *hc = data;
+
+    if (hc->request) {
+        (void) ngx_http_free_request_memory(hc->request->connection,
+                                            hc->request);
+        hc->request = NULL;
+    }
 }
 
 
@@ -3113,7 +3525,7 @@ ngx_http_close_connection(ngx_connection_t *c)
 #endif
 
 #if (NGX_STAT_STUB)
-    (void) ngx_atomic_fetch_add(ngx_stat_active, -1);
+    ngx_stat->active--;
 #endif
 
     c->destroyed = 1;
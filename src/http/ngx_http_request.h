@@ -62,6 +62,7 @@
 #define NGX_HTTP_SUBREQUEST_IN_MEMORY      2
 #define NGX_HTTP_SUBREQUEST_WAITED         4
 #define NGX_HTTP_LOG_UNSAFE                8
+#define NGX_HTTP_SUBREQUEST_BACKGROUND     16
 
 
 #define NGX_HTTP_OK                        200
@@ -223,6 +224,7 @@ typedef struct {
     time_t                            keep_alive_n;
 	/*连接类型,取值范围为0,NGX_HTTP_CONNECTION_CLOSE,NGX_HTTP_CONNECTION_KEEP_ALIVE*/
     unsigned                          connection_type:2;
+    unsigned                          chunked:1;   /* Transfer-Encoding: chunked */
 	/* 根据浏览器传来的useragent头部，来判断浏览器的类型*/
     unsigned                          msie:1;
     unsigned                          msie6:1;
@@ -266,6 +268,8 @@ typedef struct {
     ngx_array_t                       cache_control;
 	/*内容长度*/
     off_t                             content_length_n;
+    /* 响应体在完整实体中的起始偏移, 由slice模块设置 */
+    off_t                             content_offset;
     time_t                            date_time;
     time_t                            last_modified_time;
 } ngx_http_headers_out_t;/* 响应头部 */
@@ -280,6 +284,9 @@ typedef struct {
     ngx_buf_t                        *buf;
     off_t                             rest;/*根据content-length和已经接收的长度，计算剩余还需接收的长度*/
     ngx_chain_t                      *to_write;
+    ngx_chain_t                      *free;
+    ngx_chain_t                      *busy;
+    ngx_http_chunked_t               *chunked;/*分块编码包体的解析状态*/
     ngx_http_client_body_handler_pt   post_handler;/*包体接收完毕后的回调函数*/
 } ngx_http_request_body_t;
 
@@ -297,6 +304,24 @@ typedef struct {
 } ngx_http_connection_t;
 
 
+/*
+ * per worker, the free ngx_http_request_t's are linked by r->main;
+ * "request_cache" sets the number of the cached requests and pools,
+ * not bytes: a worker keeps at most request_cache requests and as many
+ * pools of the largest request_pool_size
+ */
+
+typedef struct {
+    ngx_pool_cache_t                  pools;
+
+    ngx_http_request_t               *free;
+    ngx_uint_t                        nfree;
+    ngx_uint_t                        max;
+    ngx_uint_t                        hits;
+    ngx_uint_t                        misses;
+} ngx_http_request_cache_t;
+
+
 typedef struct ngx_http_server_name_s  ngx_http_server_name_t;
 
 
@@ -413,6 +438,7 @@ struct ngx_http_request_s {
     ngx_uint_t                        ncaptures;
     int                              *captures;
     u_char                           *captures_data;
+    ngx_http_regex_memo_t            *regex_memo;
 #endif
 
     size_t                            limit_rate;/*请求响应的限制速率，每秒多少字节*/
@@ -464,9 +490,12 @@ struct ngx_http_request_s {
     unsigned                          request_body_in_clean_file:1;
     unsigned                          request_body_file_group_access:1;
     unsigned                          request_body_file_log_level:3;
+    unsigned                          request_body_no_buffering:1;
 
     unsigned                          subrequest_in_memory:1;
     unsigned                          waited:1;
+    /* 后台子请求, 不产生输出, 不阻塞父请求 */
+    unsigned                          background:1;
 
 #if (NGX_HTTP_CACHE)
     unsigned                          cached:1;
@@ -501,6 +530,7 @@ struct ngx_http_request_s {
     unsigned                          keepalive:1;
     unsigned                          lingering_close:1;
     unsigned                          discard_body:1;
+    unsigned                          reading_body:1;
     unsigned                          internal:1;
     unsigned                          error_page:1;
     unsigned                          ignore_content_encoding:1;
@@ -520,6 +550,8 @@ struct ngx_http_request_s {
     unsigned                          filter_need_in_memory:1;
     unsigned                          filter_need_temporary:1;
     unsigned                          allow_ranges:1;
+    unsigned                          subrequest_ranges:1;
+    unsigned                          single_range:1;
 
 #if (NGX_STAT_STUB)
     unsigned                          stat_reading:1;
@@ -259,10 +259,19 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
     r->upstream->peer.free = ngx_http_upstream_free_round_robin_peer;
     r->upstream->peer.tries = rrp->peers->number;
 #if (NGX_HTTP_SSL)
-    r->upstream->peer.set_session =
+    if (rrp->peers->shpool) {
+
+        /* ssl sessions are local to a process, do not keep them in a zone */
+
+        r->upstream->peer.set_session = ngx_http_upstream_empty_set_session;
+        r->upstream->peer.save_session = ngx_http_upstream_empty_save_session;
+
+    } else {
+        r->upstream->peer.set_session =
                                ngx_http_upstream_set_round_robin_peer_session;
-    r->upstream->peer.save_session =
+        r->upstream->peer.save_session =
                                ngx_http_upstream_save_round_robin_peer_session;
+    }
 #endif
 
     return NGX_OK;
@@ -391,7 +400,7 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
 
     now = ngx_time();
 
-    /* ngx_lock_mutex(rrp->peers->mutex); */
+    ngx_http_upstream_rr_peers_lock(rrp->peers);
 
     if (rrp->peers->last_cached) {
 
@@ -400,7 +409,7 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
         c = rrp->peers->cached[rrp->peers->last_cached];
         rrp->peers->last_cached--;
 
-        /* ngx_unlock_mutex(ppr->peers->mutex); */
+        ngx_http_upstream_rr_peers_unlock(rrp->peers);
 
 #if (NGX_THREADS)
         c->read->lock = c->read->own_lock;
@@ -443,7 +452,7 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
                 if (!(rrp->tried[n] & m)) {
                     peer = &rrp->peers->peer[rrp->current];
 
-                    if (!peer->down) {
+                    if (!peer->down && !peer->check_down) {
 
                         if (peer->max_fails == 0
                             || peer->fails < peer->max_fails)
@@ -459,6 +468,10 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
                         peer->current_weight = 0;
 
                     } else {
+
+                        /* 否则ngx_http_upstream_get_peer()会一直选中它 */
+
+                        peer->current_weight = 0;
                         rrp->tried[n] |= m;
                     }
 
@@ -491,7 +504,7 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
 
                     peer = &rrp->peers->peer[rrp->current];
 
-                    if (!peer->down) {
+                    if (!peer->down && !peer->check_down) {
 
                         if (peer->max_fails == 0
                             || peer->fails < peer->max_fails)
@@ -541,7 +554,7 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
     pc->socklen = peer->socklen;
     pc->name = &peer->name;
 
-    /* ngx_unlock_mutex(rrp->peers->mutex); */
+    ngx_http_upstream_rr_peers_unlock(rrp->peers);
 
     if (pc->tries == 1 && rrp->peers->next) {
         pc->tries += rrp->peers->next->number;
@@ -560,7 +573,7 @@ failed:
 
     if (peers->next) {
 
-        /* ngx_unlock_mutex(peers->mutex); */
+        ngx_http_upstream_rr_peers_unlock(peers);
 
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0, "backup servers");
 
@@ -578,7 +591,7 @@ failed:
             return rc;
         }
 
-        /* ngx_lock_mutex(peers->mutex); */
+        ngx_http_upstream_rr_peers_lock(peers);
     }
 
     /* all peers failed, mark them as live for quick recovery */
@@ -587,7 +600,7 @@ failed:
         peers->peer[i].fails = 0;
     }
 
-    /* ngx_unlock_mutex(peers->mutex); */
+    ngx_http_upstream_rr_peers_unlock(peers);
 
     pc->name = peers->name;
 
@@ -673,11 +686,11 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
 
     peer = &rrp->peers->peer[rrp->current];
 
+    ngx_http_upstream_rr_peers_lock(rrp->peers);
+
     if (state & NGX_PEER_FAILED) {
         now = ngx_time();
 
-        /* ngx_lock_mutex(rrp->peers->mutex); */
-
         peer->fails++;
         peer->accessed = now;
         peer->checked = now;
@@ -694,8 +707,6 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
             peer->current_weight = 0;
         }
 
-        /* ngx_unlock_mutex(rrp->peers->mutex); */
-
     } else {
 
         /* mark peer live if check passed */
@@ -711,11 +722,11 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
         rrp->current = 0;
     }
 
+    ngx_http_upstream_rr_peers_unlock(rrp->peers);
+
     if (pc->tries) {
         pc->tries--;
     }
-
-    /* ngx_unlock_mutex(rrp->peers->mutex); */
 }
 
 
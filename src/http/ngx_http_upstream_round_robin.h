@@ -22,6 +22,12 @@ typedef struct {
     ngx_int_t                       current_weight;
     ngx_int_t                       weight;
 
+    ngx_uint_t                      conns;
+
+    /* peak_ewma 使用的响应时间均值，单位为 1/1024 毫秒 */
+    uint64_t                        ewma;
+    ngx_msec_t                      ewma_stamp;
+
     ngx_uint_t                      fails;
     time_t                          accessed;
     time_t                          checked;
@@ -31,6 +37,12 @@ typedef struct {
 
     ngx_uint_t                      down;          /* unsigned  down:1; */
 
+    /* 主动健康检查的结果，由 upstream check 模块维护 */
+    ngx_uint_t                      check_down;
+    ngx_uint_t                      check_rise;
+    ngx_uint_t                      check_fall;
+    ngx_msec_t                      check_time;
+
 #if (NGX_HTTP_SSL)
     ngx_ssl_session_t              *ssl_session;   /* local to a process */
 #endif
@@ -47,6 +59,9 @@ struct ngx_http_upstream_rr_peers_s {
  /* ngx_mutex_t                    *mutex; */
     ngx_connection_t              **cached;
 
+    ngx_slab_pool_t                *shpool;      /* upstream zone */
+    ngx_http_upstream_rr_peers_t   *zone_next;
+
     ngx_str_t                      *name;
 
     ngx_http_upstream_rr_peers_t   *next;
@@ -55,6 +70,24 @@ struct ngx_http_upstream_rr_peers_s {
 };
 
 
+/*
+ * peers placed into an upstream zone are shared by all worker processes,
+ * their state is protected by the zone's slab pool mutex
+ */
+
+#define ngx_http_upstream_rr_peers_lock(peers)                               \
+                                                                              \
+    if ((peers)->shpool) {                                                    \
+        ngx_shmtx_lock(&(peers)->shpool->mutex);                              \
+    }
+
+#define ngx_http_upstream_rr_peers_unlock(peers)                             \
+                                                                              \
+    if ((peers)->shpool) {                                                    \
+        ngx_shmtx_unlock(&(peers)->shpool->mutex);                            \
+    }
+
+
 typedef struct {
     ngx_http_upstream_rr_peers_t   *peers;
     ngx_uint_t                      current;
@@ -32,6 +32,8 @@ static ngx_int_t ngx_http_variable_request_line(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_cookie(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_variable_content_length(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_argument(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 #if (NGX_HAVE_TCP_INFO)
@@ -71,6 +73,8 @@ static ngx_int_t ngx_http_variable_remote_user(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_body_bytes_sent(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_variable_request_pool(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_request_completion(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_request_body(ngx_http_request_t *r,
@@ -100,6 +104,13 @@ static ngx_int_t ngx_http_variable_hostname(ngx_http_request_t *r,
 static ngx_int_t ngx_http_variable_pid(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 
+#if (NGX_PCRE)
+static ngx_http_regex_memo_elt_t *ngx_http_regex_memo_find(
+    ngx_http_request_t *r, ngx_http_regex_t *re, ngx_str_t *s);
+static void ngx_http_regex_memo_add(ngx_http_request_t *r,
+    ngx_http_regex_t *re, ngx_str_t *s, ngx_int_t rc, ngx_uint_t len);
+#endif
+
 /*
  * TODO:
  *     Apache CGI: AUTH_TYPE, PATH_INFO (null), PATH_TRANSLATED
@@ -140,8 +151,8 @@ static ngx_http_variable_t  ngx_http_core_variables[] = {
     { ngx_string("http_cookie"), NULL, ngx_http_variable_headers,
       offsetof(ngx_http_request_t, headers_in.cookies), 0, 0 },
 
-    { ngx_string("content_length"), NULL, ngx_http_variable_header,
-      offsetof(ngx_http_request_t, headers_in.content_length), 0, 0 },
+    { ngx_string("content_length"), NULL, ngx_http_variable_content_length,
+      0, 0, 0 },
 
     { ngx_string("content_type"), NULL, ngx_http_variable_header,
       offsetof(ngx_http_request_t, headers_in.content_type), 0, 0 },
@@ -213,6 +224,12 @@ static ngx_http_variable_t  ngx_http_core_variables[] = {
     { ngx_string("body_bytes_sent"), NULL, ngx_http_variable_body_bytes_sent,
       0, 0, 0 },
 
+    { ngx_string("request_pool_peak"), NULL, ngx_http_variable_request_pool,
+      offsetof(ngx_pool_stat_t, peak), NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("request_pool_wasted"), NULL, ngx_http_variable_request_pool,
+      offsetof(ngx_pool_stat_t, wasted), NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
     { ngx_string("request_completion"), NULL,
       ngx_http_variable_request_completion,
       0, 0, 0 },
@@ -659,6 +676,45 @@ ngx_http_variable_header(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 }
 
 
+/* 分块编码的请求没有 Content-Length 头，包体读完后使用实际长度 */
+
+static ngx_int_t
+ngx_http_variable_content_length(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char  *p;
+
+    if (r->headers_in.content_length) {
+        v->len = r->headers_in.content_length->value.len;
+        v->data = r->headers_in.content_length->value.data;
+        v->valid = 1;
+        v->no_cacheable = 0;
+        v->not_found = 0;
+
+    } else if (r->reading_body) {
+        v->not_found = 1;
+        v->no_cacheable = 1;
+
+    } else if (r->headers_in.content_length_n >= 0) {
+        p = ngx_pnalloc(r->pool, NGX_OFF_T_LEN);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        v->len = ngx_sprintf(p, "%O", r->headers_in.content_length_n) - p;
+        v->data = p;
+        v->valid = 1;
+        v->no_cacheable = 0;
+        v->not_found = 0;
+
+    } else {
+        v->not_found = 1;
+    }
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_variable_headers(ngx_http_request_t *r, ngx_http_variable_value_t *v,
     uintptr_t data)
@@ -1455,6 +1511,35 @@ ngx_http_variable_body_bytes_sent(ngx_http_request_t *r,
 }
 
 
+/*
+ * the request pool is shared by subrequests and is not freed till the end
+ * of the request, so in a log the values are almost the final ones
+ */
+
+static ngx_int_t
+ngx_http_variable_request_pool(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char           *p;
+    ngx_pool_stat_t   stat;
+
+    p = ngx_pnalloc(r->pool, NGX_SIZE_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_pool_stat(r->pool, &stat);
+
+    v->len = ngx_sprintf(p, "%uz", *(size_t *) ((char *) &stat + data)) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_variable_sent_content_type(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
@@ -1681,7 +1766,7 @@ ngx_http_variable_request_body(ngx_http_request_t *r,
 {
     u_char       *p;
     size_t        len;
-    ngx_buf_t    *buf, *next;
+    ngx_buf_t    *buf;
     ngx_chain_t  *cl;
 
     if (r->request_body == NULL
@@ -1706,8 +1791,15 @@ ngx_http_variable_request_body(ngx_http_request_t *r,
         return NGX_OK;
     }
 
-    next = cl->next->buf;
-    len = (buf->last - buf->pos) + (next->last - next->pos);
+    /* 分块编码的包体可能由多个缓冲区组成 */
+
+    len = buf->last - buf->pos;
+    cl = cl->next;
+
+    for ( /* void */ ; cl; cl = cl->next) {
+        buf = cl->buf;
+        len += buf->last - buf->pos;
+    }
 
     p = ngx_pnalloc(r->pool, len);
     if (p == NULL) {
@@ -1715,9 +1807,12 @@ ngx_http_variable_request_body(ngx_http_request_t *r,
     }
 
     v->data = p;
+    cl = r->request_body->bufs;
 
-    p = ngx_cpymem(p, buf->pos, buf->last - buf->pos);
-    ngx_memcpy(p, next->pos, next->last - next->pos);
+    for ( /* void */ ; cl; cl = cl->next) {
+        buf = cl->buf;
+        p = ngx_cpymem(p, buf->pos, buf->last - buf->pos);
+    }
 
     v->len = len;
     v->valid = 1;
@@ -1946,6 +2041,7 @@ ngx_http_regex_exec(ngx_http_request_t *r, ngx_http_regex_t *re, ngx_str_t *s)
 {
     ngx_int_t                   rc, index;
     ngx_uint_t                  i, n, len;
+    ngx_http_regex_memo_elt_t  *memo;
     ngx_http_variable_value_t  *vv;
     ngx_http_core_main_conf_t  *cmcf;
 
@@ -1965,7 +2061,25 @@ ngx_http_regex_exec(ngx_http_request_t *r, ngx_http_regex_t *re, ngx_str_t *s)
         len = 0;
     }
 
-    rc = ngx_regex_exec(re->regex, s, r->captures, len);
+    memo = ngx_http_regex_memo_find(r, re, s);
+
+    if (memo) {
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http regex memo: %i \"%V\"", memo->rc, s);
+
+        rc = memo->rc;
+
+        if (rc >= 0 && len) {
+            ngx_memcpy(r->captures, memo->captures, len * sizeof(int));
+        }
+
+    } else {
+        rc = ngx_regex_exec(re->regex, s, r->captures, len);
+
+        if (rc >= 0 || rc == NGX_REGEX_NO_MATCHED) {
+            ngx_http_regex_memo_add(r, re, s, rc, len);
+        }
+    }
 
     if (rc == NGX_REGEX_NO_MATCHED) {
         return NGX_DECLINED;
@@ -2009,6 +2123,99 @@ ngx_http_regex_exec(ngx_http_request_t *r, ngx_http_regex_t *re, ngx_str_t *s)
     return NGX_OK;
 }
 
+
+/*
+ * a match depends on the regex and the subject only, so the results are
+ * kept in the main request and are shared by its subrequests;
+ * the subject is compared by contents because its buffer may be reused
+ */
+
+static ngx_http_regex_memo_elt_t *
+ngx_http_regex_memo_find(ngx_http_request_t *r, ngx_http_regex_t *re,
+    ngx_str_t *s)
+{
+    ngx_uint_t                  i;
+    ngx_http_regex_memo_t      *memo;
+    ngx_http_regex_memo_elt_t  *elt;
+
+    memo = r->main->regex_memo;
+
+    if (memo == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < NGX_HTTP_REGEX_MEMO_N; i++) {
+        elt = &memo->elts[i];
+
+        if (elt->regex == re
+            && elt->len == s->len
+            && ngx_memcmp(elt->subject, s->data, s->len) == 0)
+        {
+            return elt;
+        }
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_regex_memo_add(ngx_http_request_t *r, ngx_http_regex_t *re,
+    ngx_str_t *s, ngx_int_t rc, ngx_uint_t len)
+{
+    ngx_http_regex_memo_t      *memo;
+    ngx_http_regex_memo_elt_t  *elt;
+
+    if (s->len > NGX_HTTP_REGEX_MEMO_LEN) {
+        return;
+    }
+
+    memo = r->main->regex_memo;
+
+    if (memo == NULL) {
+        memo = ngx_pcalloc(r->pool, sizeof(ngx_http_regex_memo_t));
+        if (memo == NULL) {
+            return;
+        }
+
+        r->main->regex_memo = memo;
+    }
+
+    elt = &memo->elts[memo->next];
+    memo->next = (memo->next + 1) % NGX_HTTP_REGEX_MEMO_N;
+
+    elt->regex = NULL;
+
+    if (elt->size < s->len) {
+        elt->subject = ngx_pnalloc(r->pool, s->len);
+        if (elt->subject == NULL) {
+            elt->size = 0;
+            return;
+        }
+
+        elt->size = s->len;
+    }
+
+    if (len) {
+        if (elt->captures == NULL) {
+            elt->captures = ngx_palloc(r->pool, len * sizeof(int));
+            if (elt->captures == NULL) {
+                return;
+            }
+        }
+
+        if (rc >= 0) {
+            ngx_memcpy(elt->captures, r->captures, len * sizeof(int));
+        }
+    }
+
+    ngx_memcpy(elt->subject, s->data, s->len);
+
+    elt->regex = re;
+    elt->rc = rc;
+    elt->len = s->len;
+}
+
 #endif
 
 
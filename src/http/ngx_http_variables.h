@@ -83,6 +83,25 @@ typedef struct {
 } ngx_http_map_regex_t;
 
 
+#define NGX_HTTP_REGEX_MEMO_N    8
+#define NGX_HTTP_REGEX_MEMO_LEN  2048
+
+typedef struct {
+    ngx_http_regex_t             *regex;
+    ngx_int_t                     rc;
+    int                          *captures;
+    u_char                       *subject;
+    size_t                        len;
+    size_t                        size;
+} ngx_http_regex_memo_elt_t;
+
+
+typedef struct {
+    ngx_http_regex_memo_elt_t     elts[NGX_HTTP_REGEX_MEMO_N];
+    ngx_uint_t                    next;
+} ngx_http_regex_memo_t;
+
+
 ngx_http_regex_t *ngx_http_regex_compile(ngx_conf_t *cf,
     ngx_regex_compile_t *rc);
 ngx_int_t ngx_http_regex_exec(ngx_http_request_t *r, ngx_http_regex_t *re,
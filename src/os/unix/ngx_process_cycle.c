@@ -33,6 +33,7 @@ static void ngx_cache_loader_process_handler(ngx_event_t *ev);
 
 
 ngx_uint_t    ngx_process;
+ngx_uint_t    ngx_worker;
 ngx_pid_t     ngx_pid;
 ngx_uint_t    ngx_threaded;
 
@@ -371,8 +372,8 @@ ngx_start_worker_processes(ngx_cycle_t *cycle, ngx_int_t n, ngx_int_t type)
 
         cpu_affinity = ngx_get_cpu_affinity(i);
 		/* 创建进程，新进程主体执行函数为ngx_worker_process_cycle */
-        ngx_spawn_process(cycle, ngx_worker_process_cycle, NULL,
-                          "worker process", type);
+        ngx_spawn_process(cycle, ngx_worker_process_cycle,
+                          (void *) (intptr_t) i, "worker process", type);
 		/*ngx_process_slot当前新创建的子进程的下标*/
         ch.pid = ngx_processes[ngx_process_slot].pid;
         ch.slot = ngx_process_slot;
@@ -623,6 +624,11 @@ ngx_reap_children(ngx_cycle_t *cycle)
                                       &ch, sizeof(ngx_channel_t), cycle->log);
                 }
             }
+
+#if (NGX_STAT_STUB)
+            ngx_stat_reset(i);
+#endif
+
 			/*需要重新生成新的进程来取代退出的进程*/
             if (ngx_processes[i].respawn
                 && !ngx_processes[i].exiting
@@ -737,6 +743,7 @@ ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data)
     ngx_connection_t  *c;
 
     ngx_process = NGX_PROCESS_WORKER;
+    ngx_worker = (ngx_uint_t) (intptr_t) data;/*worker进程的序号*/
 	
 	/*worker进程初始化，执行每个模块的init_process()方法*/
     ngx_worker_process_init(cycle, 1);
@@ -793,6 +800,8 @@ ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data)
 
         if (ngx_exiting) {/*准备退出*/
 
+            ngx_event_cancel_timers();
+
             c = cycle->connections;
 
             for (i = 0; i < cycle->connection_n; i++) {
@@ -805,8 +814,7 @@ ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data)
                 }
             }
 			/*如果红黑树为空，则表示没有要处理的事件*/
-            if (ngx_event_timer_rbtree.root == ngx_event_timer_rbtree.sentinel)
-            {
+            if (ngx_event_timers_empty()) {
                 ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "exiting");
 				/*清理资源，退出进程*/
                 ngx_worker_process_exit(cycle);